@@ -0,0 +1,276 @@
+#include "actor.h"
+
+#include "budget.h"
+#include "mpsc_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+const string INIT_METHOD = "__init__"s;
+
+// Ответ актора на синхронный вызов
+struct Reply {
+    mutex m;
+    condition_variable ready;
+    bool is_ready = false;
+    ObjectHolder result;
+    optional<string> error;
+};
+
+struct Message {
+    string method;
+    ArgumentList args;
+    // Пуст у сообщений, отправленных через send
+    shared_ptr<Reply> reply;
+    // Последнее сообщение актору: поток актора завершается
+    bool is_stop = false;
+};
+
+}  // namespace
+
+struct Actor::State {
+    State(Class& cls, ostream& output)
+        : cls(cls)
+        , output(output) {
+    }
+
+    Class& cls;
+    ostream& output;
+    MpscQueue<Message> mailbox;
+
+    // Вывод актора, ещё не перенесённый в поток вывода программы
+    mutex output_mutex;
+    string pending_output;
+    atomic<bool> has_output{false};
+
+    // Первая ошибка метода, вызванного через send
+    mutex error_mutex;
+    optional<string> send_error;
+
+    thread worker;
+};
+
+namespace {
+
+string DescribeError(const Class& cls, const string& method, const exception& e) {
+    string error = "Actor "s + cls.GetName() + "."s + method + " failed"s;
+    if (*e.what() != '\0') {
+        error += ": "s;
+        error += e.what();
+    }
+    return error;
+}
+
+ArgumentList CopyArguments(ArgumentSpan args) {
+    ArgumentList copies;
+    for (const auto& arg : args) {
+        copies.push_back(CopyForActor(arg));
+    }
+    return copies;
+}
+
+}  // namespace
+
+Actor::Actor(Class& cls, ArgumentSpan args, Context& context)
+    : state_(make_unique<State>(cls, context.GetOutputStream())) {
+    State& state = *state_;
+    // Актор получает остаток ограничений создавшей его программы и останавливается
+    // не позже, чем она, поэтому ожидание его завершения ограничено ими
+    state.worker = thread([&state, init_args = CopyArguments(args), budget = GetRemainingBudget()] {
+        optional<BudgetScope> budget_scope;
+        if (budget) {
+            budget_scope.emplace(*budget);
+        }
+        ostringstream output;
+        SimpleContext actor_context{output};
+        // Вывод переносится после каждого сообщения, чтобы программа видела его без задержки
+        auto publish_output = [&] {
+            if (output.tellp() == 0) {
+                return;
+            }
+            lock_guard lock(state.output_mutex);
+            state.pending_output += output.str();
+            state.has_output = true;
+            output.str({});
+        };
+        optional<string> init_error;
+        {
+            // Экземпляр и всё, что он хранит, в том числе запущенные им акторы, разрушаются
+            // в потоке актора до переноса последнего вывода
+            auto instance = ObjectHolder::Own(ClassInstance(state.cls));
+            auto& self = *instance.TryAs<ClassInstance>();
+            try {
+                if (self.HasMethod(INIT_METHOD, init_args.size())) {
+                    self.Call(INIT_METHOD, init_args, actor_context);
+                }
+            } catch (const exception& e) {
+                init_error = DescribeError(state.cls, INIT_METHOD, e);
+            }
+            publish_output();
+
+            while (true) {
+                Message message = state.mailbox.Pop();
+                if (message.is_stop) {
+                    break;
+                }
+                ObjectHolder result;
+                optional<string> error = init_error;
+                if (!error) {
+                    try {
+                        result = CopyForActor(self.Call(message.method, message.args, actor_context));
+                    } catch (const exception& e) {
+                        error = DescribeError(state.cls, message.method, e);
+                    }
+                }
+                message.args.clear();
+                publish_output();
+                if (message.reply) {
+                    Reply& reply = *message.reply;
+                    lock_guard lock(reply.m);
+                    reply.result = std::move(result);
+                    reply.error = std::move(error);
+                    reply.is_ready = true;
+                    reply.ready.notify_one();
+                } else if (error) {
+                    lock_guard lock(state.error_mutex);
+                    if (!state.send_error) {
+                        state.send_error = std::move(error);
+                    }
+                }
+            }
+        }
+        publish_output();
+    });
+}
+
+Actor::Actor(Actor&&) noexcept = default;
+
+Actor::~Actor() {
+    if (!state_) {
+        return;
+    }
+    Message stop;
+    stop.is_stop = true;
+    state_->mailbox.Push(std::move(stop));
+    state_->worker.join();
+    FlushOutput();
+}
+
+void Actor::Print(ostream& os, Context& /*context*/) {
+    os << "Actor "sv << state_->cls.GetName();
+}
+
+void Actor::Send(const string& method, ArgumentSpan args, Context& /*context*/) {
+    FlushOutput();
+    state_->mailbox.Push(Message{method, CopyArguments(args), nullptr, false});
+}
+
+ObjectHolder Actor::Ask(const string& method, ArgumentSpan args, Context& /*context*/) {
+    auto reply = make_shared<Reply>();
+    state_->mailbox.Push(Message{method, CopyArguments(args), reply, false});
+    {
+        // Ожидание ответа прерывается, когда истекает время, отведённое вызывающему коду
+        const auto budget = GetRemainingBudget();
+        const bool is_timed = budget && budget->max_wall_time.count() > 0;
+        const auto deadline = chrono::steady_clock::now() + (is_timed ? budget->max_wall_time : chrono::steady_clock::duration{});
+        unique_lock lock(reply->m);
+        while (!reply->is_ready) {
+            if (!is_timed) {
+                reply->ready.wait(lock);
+            } else if (reply->ready.wait_until(lock, deadline) == cv_status::timeout) {
+                lock.unlock();
+                detail::ChargeSteps(0);
+                lock.lock();
+            }
+        }
+    }
+    FlushOutput();
+    {
+        // Сообщения одного отправителя выполняются по порядку, поэтому к этому моменту
+        // выполнены все вызовы, отправленные им до этого через send
+        lock_guard lock(state_->error_mutex);
+        if (state_->send_error) {
+            string error = std::move(*state_->send_error);
+            state_->send_error.reset();
+            throw runtime_error(error);
+        }
+    }
+    if (reply->error) {
+        throw runtime_error(*reply->error);
+    }
+    return std::move(reply->result);
+}
+
+void Actor::FlushOutput() {
+    if (!state_->has_output.load(memory_order_acquire)) {
+        return;
+    }
+    lock_guard lock(state_->output_mutex);
+    state_->output << state_->pending_output;
+    state_->pending_output.clear();
+    state_->has_output = false;
+}
+
+ObjectHolder CopyForActor(const ObjectHolder& object) {
+    // Копии экземпляров по адресам оригиналов: общие и циклические ссылки
+    // воспроизводятся в копии. Поля копируются без рекурсии
+    unordered_map<const Object*, ObjectHolder> copies;
+    vector<pair<const ClassInstance*, ClassInstance*>> unfilled;
+
+    auto copy = [&copies, &unfilled](const ObjectHolder& value) -> ObjectHolder {
+        if (!value) {
+            return ObjectHolder::None();
+        }
+        if (const auto* number = value.TryAs<Number>()) {
+            return ObjectHolder::Own(Number(number->GetValue()));
+        }
+        if (const auto* boolean = value.TryAs<Bool>()) {
+            return ObjectHolder::Own(Bool(boolean->GetValue()));
+        }
+        if (const auto* str = value.TryAs<String>()) {
+            // Строки из пула не изменяются, а их общее хранилище освобождается по атомарному
+            // счётчику ссылок, поэтому копия может разделять его с оригиналом из другого потока
+            if (str->IsInterned()) {
+                return ObjectHolder::Own(String(*str));
+            }
+            return ObjectHolder::Own(String(str->GetValue()));
+        }
+        if (value.TryAs<Class>() != nullptr) {
+            return value;
+        }
+        if (const auto* instance = value.TryAs<ClassInstance>()) {
+            auto [it, inserted] = copies.emplace(instance, ObjectHolder());
+            if (inserted) {
+                it->second = ObjectHolder::Own(ClassInstance(instance->GetClass()));
+                unfilled.emplace_back(instance, it->second.TryAs<ClassInstance>());
+            }
+            return it->second;
+        }
+        Throw(runtime_error(
+            "Only numbers, strings, booleans, classes and class instances can be passed to an actor"s));
+    };
+
+    ObjectHolder result = copy(object);
+    while (!unfilled.empty()) {
+        auto [original, instance_copy] = unfilled.back();
+        unfilled.pop_back();
+        for (const auto& [name, value] : original->Fields()) {
+            instance_copy->Fields().emplace(name, copy(value));
+        }
+    }
+    return result;
+}
+
+}  // namespace runtime
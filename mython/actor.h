@@ -0,0 +1,71 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <memory>
+#include <string>
+
+namespace runtime {
+
+/*
+Актор: экземпляр класса Mython, выполняемый отдельным интерпретатором в собственном потоке.
+
+Актор создаётся встроенной функцией spawn(Class, args...). Его экземпляр, поля
+и кадры вызовов принадлежат только потоку актора, а общаются с ним сообщениями:
+send(actor, "method", args...) ставит вызов метода в почтовый ящик актора и сразу возвращает None,
+а actor.method(args...) дожидается выполнения метода и возвращает его результат.
+Аргументы и результаты передаются глубокими копиями (см. CopyForActor), поэтому у потоков
+нет общих изменяемых объектов.
+
+Почтовый ящик — очередь MPSC без блокировок: отправители не ждут друг друга, а сообщения
+выполняются в порядке отправки. Вывод print актора накапливается и переносится в поток вывода
+создавшей его программы при синхронных вызовах, отправке сообщений и остановке актора.
+Модули в акторе недоступны.
+
+Поток актора останавливается, когда удаляется последняя ссылка на актор: перед этим он
+выполняет все полученные сообщения.
+
+Актор выполняется с остатком ограничений (см. BudgetScope) создавшего его потока, поэтому
+ожидание его остановки не длится дольше них. Синхронный вызов, ожидающий ответа дольше,
+чем осталось времени у вызывающего потока, выбрасывает BudgetExceeded
+*/
+class Actor : public Object {
+public:
+    // Запускает актор с экземпляром класса cls. Если у класса есть метод __init__ с числом
+    // параметров, равным числу args, он вызывается в потоке актора с копиями args.
+    // Класс и поток вывода context должны существовать, пока существует актор
+    Actor(Class& cls, ArgumentSpan args, Context& context);
+    ~Actor() override;
+
+    Actor(Actor&&) noexcept;
+    Actor& operator=(Actor&&) = delete;
+
+    // Выводит в os строку "Actor <имя класса>"
+    void Print(std::ostream& os, Context& context) override;
+
+    // Ставит вызов метода method с копиями args в почтовый ящик актора.
+    // Ошибка такого вызова выбрасывается при следующем синхронном вызове актора
+    void Send(const std::string& method, ArgumentSpan args, Context& context);
+
+    // Выполняет метод method с копиями args в потоке актора и возвращает копию его результата.
+    // Ошибка метода выбрасывается как runtime_error
+    ObjectHolder Ask(const std::string& method, ArgumentSpan args, Context& context);
+
+private:
+    struct State;
+
+    // Переносит накопленный вывод актора в поток вывода программы
+    void FlushOutput();
+
+    std::unique_ptr<State> state_;
+};
+
+template <>
+inline constexpr ObjectKind OBJECT_KIND<Actor> = ObjectKind::ACTOR;
+
+// Возвращает глубокую копию object, которую можно передать другому потоку: числа, строки,
+// логические значения и экземпляры классов копируются, классы разделяются, так как
+// не изменяются при выполнении. Для акторов и модулей выбрасывает runtime_error
+[[nodiscard]] ObjectHolder CopyForActor(const ObjectHolder& object);
+
+}  // namespace runtime
@@ -0,0 +1,193 @@
+#include "actor.h"
+#include "budget.h"
+#include "mpsc_queue.h"
+#include "parse.h"
+#include "statement.h"
+#include "test_program_p.h"
+#include "test_runner_p.h"
+
+#include <thread>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+void TestMpscQueue() {
+    constexpr int producers = 4;
+    constexpr int count = 20000;
+    MpscQueue<pair<int, int>> queue;
+    vector<thread> threads;
+    for (int producer = 0; producer < producers; ++producer) {
+        threads.emplace_back([&queue, producer] {
+            for (int i = 0; i < count; ++i) {
+                queue.Push({producer, i});
+            }
+        });
+    }
+    // Сообщения каждого писателя приходят в порядке отправки
+    vector<int> next(producers, 0);
+    for (int received = 0; received < producers * count; ++received) {
+        auto [producer, i] = queue.Pop();
+        ASSERT_EQUAL(i, next[producer]);
+        ++next[producer];
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ASSERT(!queue.TryPop());
+}
+
+void TestActors() {
+    const string program = R"--(
+class Point:
+  def __init__(x, y):
+    self.x = x
+    self.y = y
+
+class Counter:
+  def __init__(start):
+    self.total = start
+    print 'started', start
+
+  def add(p):
+    self.total = self.total + p.x + p.y
+    p.x = 0
+
+  def get():
+    return self.total
+
+  def echo(s):
+    print 'echo', s
+    return s + '!'
+
+  def fail():
+    return 1 / 0
+
+class Relay:
+  def __init__():
+    self.counter = spawn(Counter, 0)
+
+  def forward(n):
+    send(self.counter, 'add', Point(n, 0))
+    return self.counter.get()
+
+c = spawn(Counter, 10)
+p = Point(1, 2)
+i = 0
+while i < 100:
+  send(c, 'add', p)
+  i = i + 1
+print c.get(), p.x
+print c.echo('hi')
+print c
+r = spawn(Relay)
+print r.forward(5)
+send(c, 'fail')
+)--"s;
+    auto tree = ParseProgramFromString(program);
+    DummyContext context;
+    {
+        Closure closure;
+        tree->Execute(closure, context);
+        // Актор копирует аргументы: изменение поля в актор не затронуло объект отправителя
+        ASSERT_EQUAL(context.output.str(),
+                     "started 10\n310 1\necho hi\nhi!\nActor Counter\nstarted 0\n5\n"s);
+
+        // Ошибка метода, вызванного через send, выбрасывается при следующем синхронном вызове
+        auto ask = ParseProgramFromString("x = c.get()\n"s);
+        try {
+            ask->Execute(closure, context);
+            ASSERT(false);
+        } catch (const runtime_error& e) {
+            ASSERT_EQUAL(string(e.what()), "Actor Counter.fail failed"s);
+        }
+        ask->Execute(closure, context);
+        ASSERT_EQUAL(closure.at("x"s).TryAs<Number>()->GetValue(), 310);
+    }
+
+    // Актор нельзя передать другому актору
+    auto bad =
+        ParseProgramFromString("class A:\n  def f(x):\n    return x\na = spawn(A)\nb = a.f(a)\n"s);
+    Closure closure;
+    ASSERT_THROWS(bad->Execute(closure, context), runtime_error);
+    ASSERT_THROWS(ParseProgramFromString("x = spawn(Missing)\n"s), ParseError);
+}
+
+void TestActorBudgets() {
+    const string program = R"--(
+class Loop:
+  def run():
+    while True:
+      x = 1
+
+a = spawn(Loop)
+send(a, 'run')
+print 'main done'
+)--"s;
+    auto tree = ParseProgramFromString(program);
+    ExecutionBudget budget;
+    budget.max_wall_time = chrono::milliseconds(10);
+
+    // Бесконечный цикл актора прерывается вместе с ограничениями программы, которая ждёт
+    // его остановки при удалении актора
+    const auto start = chrono::steady_clock::now();
+    DummyContext context;
+    {
+        BudgetScope scope(budget);
+        Closure closure;
+        tree->Execute(closure, context);
+    }
+    ASSERT_EQUAL(context.output.str(), "main done\n"s);
+    ASSERT(chrono::steady_clock::now() - start < chrono::seconds(5));
+
+    // Синхронный вызов перестаёт ждать ответа, когда у программы истекает время
+    auto ask = ParseProgramFromString(
+        "class Loop:\n  def run():\n    while True:\n      x = 1\na = spawn(Loop)\nprint a.run()\n"s);
+    try {
+        BudgetScope scope(budget);
+        Closure closure;
+        ask->Execute(closure, context);
+        ASSERT(false);
+    } catch (const BudgetExceeded& e) {
+        ASSERT(e.GetResource() == BudgetExceeded::Resource::WALL_TIME);
+    }
+    ASSERT(chrono::steady_clock::now() - start < chrono::seconds(5));
+}
+
+void TestCopyForActor() {
+    Class node_class("Node"s, {}, nullptr);
+    auto first = ObjectHolder::Own(ClassInstance(node_class));
+    auto second = ObjectHolder::Own(ClassInstance(node_class));
+    first.TryAs<ClassInstance>()->Fields()["next"s] = second;
+    first.TryAs<ClassInstance>()->Fields()["name"s] = ObjectHolder::Own(String("first"s));
+    second.TryAs<ClassInstance>()->Fields()["next"s] = ObjectHolder::Share(*first);
+    second.TryAs<ClassInstance>()->Fields()["flag"s] = ObjectHolder::Own(Bool(true));
+
+    auto copy = CopyForActor(first);
+    auto* copy_first = copy.TryAs<ClassInstance>();
+    ASSERT(copy_first != nullptr && copy_first != first.Get());
+    auto* copy_second = copy_first->Fields().at("next"s).TryAs<ClassInstance>();
+    ASSERT(copy_second != nullptr && copy_second != second.Get());
+    // Цикл воспроизводится в копии, а не копируется бесконечно
+    ASSERT_EQUAL(copy_second->Fields().at("next"s).Get(), copy.Get());
+    ASSERT_EQUAL(copy_first->Fields().at("name"s).TryAs<String>()->GetValue(), "first"s);
+    ASSERT(copy_second->Fields().at("flag"s).TryAs<Bool>()->GetValue());
+    ASSERT(!CopyForActor(ObjectHolder::None()));
+
+    // Разорвать циклы, чтобы объекты были освобождены
+    copy_second->Fields().clear();
+    second.TryAs<ClassInstance>()->Fields().clear();
+}
+
+}  // namespace
+
+void RunActorTests(TestRunner& tr) {
+    RUN_TEST(tr, TestMpscQueue);
+    RUN_TEST(tr, TestActors);
+    RUN_TEST(tr, TestActorBudgets);
+    RUN_TEST(tr, TestCopyForActor);
+}
+
+}  // namespace runtime
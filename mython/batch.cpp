@@ -0,0 +1,134 @@
+#include "batch.h"
+
+#include "lexer.h"
+#include "module.h"
+#include "runtime.h"
+#include "thread_pool.h"
+
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+double ToMilliseconds(chrono::steady_clock::duration duration) {
+    return chrono::duration<double, milli>(duration).count();
+}
+
+}  // namespace
+
+ScriptResult RunScript(const fs::path& path, const BatchOptions& options) {
+    ScriptResult result;
+    const auto start = chrono::steady_clock::now();
+    ostringstream output;
+    try {
+        ifstream input(path, ios::binary);
+        if (!input) {
+            throw runtime_error("Can't open "s + path.string());
+        }
+        ModuleLoader modules(options.module_paths.empty() ? vector<fs::path>{"."s}
+                                                          : options.module_paths,
+                             options.parse);
+        parse::Lexer lexer(input);
+        auto program = ParseProgram(lexer, options.parse);
+
+        runtime::SimpleContext context{output, &modules};
+        runtime::Closure closure;
+        runtime::BudgetScope budget(options.budget);
+        program->Execute(closure, context);
+    } catch (const exception& e) {
+        result.is_failed = true;
+        result.error = e.what();
+    }
+    result.output = std::move(output).str();
+    result.duration = chrono::steady_clock::now() - start;
+    return result;
+}
+
+size_t RunBatch(const std::vector<fs::path>& scripts, const BatchOptions& options,
+                std::ostream& output, std::ostream& report) {
+    const auto start = chrono::steady_clock::now();
+    vector<ScriptResult> results(scripts.size());
+    vector<bool> is_done(scripts.size(), false);
+    mutex results_mutex;
+    condition_variable result_ready;
+
+    unique_ptr<WorkStealingPool> pool;
+    if (options.green_threads) {
+        // Зелёные потоки выполняются на вызывающем потоке, поэтому к выводу результатов
+        // все сценарии уже завершены
+        runtime::GreenScheduler scheduler(options.slice);
+        for (size_t i = 0; i < scripts.size(); ++i) {
+            scheduler.Spawn([&, i] {
+                results[i] = RunScript(scripts[i], options);
+                is_done[i] = true;
+            });
+        }
+        scheduler.Run();
+        for (size_t i = 0; i < scripts.size(); ++i) {
+            results[i].slices = scheduler.GetStats(i).slices;
+            results[i].max_wait = scheduler.GetStats(i).max_wait;
+        }
+    } else {
+        pool = make_unique<WorkStealingPool>(options.jobs);
+        for (size_t i = 0; i < scripts.size(); ++i) {
+            pool->Submit([&, i] {
+                ScriptResult result = RunScript(scripts[i], options);
+                lock_guard lock(results_mutex);
+                results[i] = std::move(result);
+                is_done[i] = true;
+                result_ready.notify_one();
+            });
+        }
+    }
+
+    // Результаты выводятся по порядку, не дожидаясь окончания всего пакета
+    size_t failed = 0;
+    chrono::steady_clock::duration total{};
+    const auto report_flags = report.flags();
+    const auto report_precision = report.precision();
+    report << fixed << setprecision(3);
+    for (size_t i = 0; i < scripts.size(); ++i) {
+        ScriptResult result;
+        {
+            unique_lock lock(results_mutex);
+            result_ready.wait(lock, [&] {
+                return is_done[i];
+            });
+            result = std::move(results[i]);
+        }
+        output << result.output;
+        total += result.duration;
+        report << scripts[i].string() << ": "sv << ToMilliseconds(result.duration) << " ms"sv;
+        if (options.green_threads) {
+            report << ", "sv << result.slices << " slices, max wait "sv
+                   << ToMilliseconds(result.max_wait) << " ms"sv;
+        }
+        if (result.is_failed) {
+            ++failed;
+            report << ", error: "sv << result.error;
+        }
+        report << '\n';
+    }
+    output.flush();
+
+    report << scripts.size() << " scripts, "sv << failed << " failed, "sv;
+    if (pool) {
+        pool->Wait();
+        report << pool->GetThreadCount() << " threads"sv;
+    } else {
+        report << "green threads"sv;
+    }
+    report << ": script time "sv << ToMilliseconds(total) << " ms, wall time "sv
+           << ToMilliseconds(chrono::steady_clock::now() - start) << " ms"sv << endl;
+    report.flags(report_flags);
+    report.precision(report_precision);
+    return failed;
+}
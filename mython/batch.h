@@ -0,0 +1,55 @@
+#pragma once
+
+#include "budget.h"
+#include "parse.h"
+#include "scheduler.h"
+
+#include <chrono>
+#include <filesystem>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Настройки пакетного выполнения сценариев
+struct BatchOptions {
+    // Число потоков, выполняющих сценарии
+    size_t jobs = 1;
+    // Выполнять сценарии зелёными потоками на одном потоке ОС вместо пула потоков
+    bool green_threads = false;
+    // Число точек приостановки в кванте зелёного потока
+    size_t slice = runtime::GreenScheduler::DEFAULT_SLICE;
+    ParseOptions parse;
+    // Каталоги поиска модулей. Каждый сценарий загружает модули заново
+    std::vector<std::filesystem::path> module_paths;
+    // Ограничения выполнения каждого сценария
+    runtime::ExecutionBudget budget;
+};
+
+// Результат выполнения одного сценария пакета
+struct ScriptResult {
+    // Вывод сценария, в том числе сделанный до ошибки
+    std::string output;
+    // true, если сценарий завершился ошибкой
+    bool is_failed = false;
+    // Текст ошибки. Может быть пустым и у сценария, завершившегося ошибкой
+    std::string error;
+    // Время от начала чтения сценария до окончания его выполнения
+    std::chrono::steady_clock::duration duration{};
+    // Для зелёных потоков: число полученных квантов и наибольшее ожидание кванта
+    size_t slices = 0;
+    std::chrono::steady_clock::duration max_wait{};
+};
+
+// Читает, разбирает и выполняет сценарий из файла path с новыми Closure и SimpleContext
+ScriptResult RunScript(const std::filesystem::path& path, const BatchOptions& options);
+
+/*
+Выполняет сценарии scripts в пуле из options.jobs потоков с перехватом задач либо,
+если задан options.green_threads, зелёными потоками на вызывающем потоке.
+Вывод сценариев записывается в output в порядке их следования в scripts, как только
+выполнены все предшествующие сценарии. В report для каждого сценария выводится время
+его выполнения либо ошибка, а в конце — итоговая строка.
+Возвращает число сценариев, завершившихся ошибкой
+*/
+size_t RunBatch(const std::vector<std::filesystem::path>& scripts, const BatchOptions& options,
+                std::ostream& output, std::ostream& report);
@@ -0,0 +1,105 @@
+#include "batch.h"
+#include "test_runner_p.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+void TestWorkStealingPool() {
+    atomic<int> sum{0};
+    {
+        WorkStealingPool pool(4);
+        for (int i = 1; i <= 1000; ++i) {
+            pool.Submit([&sum, &pool, i] {
+                sum += i;
+                // Задачи, добавленные из потока пула, тоже выполняются до окончания Wait
+                if (i % 100 == 0) {
+                    pool.Submit([&sum] {
+                        sum += 1;
+                    });
+                }
+            });
+        }
+        pool.Wait();
+        ASSERT_EQUAL(sum.load(), 500500 + 10);
+    }
+
+    // Задачи из очереди занятого потока выполняет другой поток
+    WorkStealingPool pool(2);
+    mutex m;
+    condition_variable finished;
+    int done = 0;
+    pool.Submit([&] {
+        for (int i = 0; i < 10; ++i) {
+            pool.Submit([&] {
+                lock_guard lock(m);
+                ++done;
+                finished.notify_one();
+            });
+        }
+        unique_lock lock(m);
+        finished.wait(lock, [&] {
+            return done == 10;
+        });
+    });
+    pool.Wait();
+    ASSERT_EQUAL(done, 10);
+    ASSERT_EQUAL(pool.GetStolenCount(), 10U);
+}
+
+void TestRunBatch() {
+    const fs::path dir = fs::temp_directory_path()
+                         / ("mython_batch_"s
+                            + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+    fs::create_directories(dir);
+
+    vector<fs::path> scripts;
+    string expected_output;
+    for (int i = 0; i < 20; ++i) {
+        scripts.push_back(dir / ("script"s + to_string(i) + ".my"s));
+        // Сценарии разной длительности завершаются не в порядке следования
+        const int iterations = (20 - i) * 200;
+        ofstream(scripts.back()) << "x = 0\nfor i in range(0, "s << iterations
+                                 << "):\n  x = x + 1\nprint 'script', "s << i << ", x\n"s;
+        expected_output += "script "s + to_string(i) + " "s + to_string(iterations) + "\n"s;
+    }
+    ofstream(dir / "failing.my") << "print 'partial'\nprint 1 / 0\n";
+    scripts.push_back(dir / "failing.my");
+    expected_output += "partial\n"s;
+    scripts.push_back(dir / "missing.my");
+
+    ostringstream output;
+    ostringstream report;
+    BatchOptions options;
+    options.jobs = 4;
+    ASSERT_EQUAL(RunBatch(scripts, options, output, report), 2U);
+    ASSERT_EQUAL(output.str(), expected_output);
+
+    // В отчёте по строке на сценарий в порядке их следования и итоговая строка
+    istringstream lines(report.str());
+    string line;
+    for (const auto& script : scripts) {
+        ASSERT(getline(lines, line));
+        ASSERT_EQUAL(line.substr(0, script.string().size() + 2), script.string() + ": "s);
+    }
+    ASSERT(line.find("error: Can't open"s) != string::npos);
+    ASSERT(getline(lines, line));
+    ASSERT_EQUAL(line.substr(0, 32), "22 scripts, 2 failed, 4 threads:"s);
+
+    fs::remove_all(dir);
+}
+
+}  // namespace
+
+void RunBatchTests(TestRunner& tr) {
+    RUN_TEST(tr, TestWorkStealingPool);
+    RUN_TEST(tr, TestRunBatch);
+}
@@ -0,0 +1,169 @@
+#include "budget.h"
+
+#include "call_stack.h"
+#include "scheduler.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+// Ограничения текущего потока, которые проверяются только при обнулении счётчика
+// точек приостановки. Часто проверяемые значения хранятся в переменных из detail
+thread_local BudgetState budget_state;
+
+int64_t ToMilliseconds(chrono::steady_clock::duration duration) {
+    return chrono::duration_cast<chrono::milliseconds>(duration).count();
+}
+
+// Списывает шаги, пройденные с последней проверки, не проверяя ограничений
+void FlushSteps() {
+    const int64_t passed = detail::TakePassedSafePoints();
+    if (budget_state.is_active) {
+        budget_state.steps_left -= passed;
+    }
+}
+
+}  // namespace
+
+namespace detail {
+
+void ThrowHeapBudgetExceeded(size_t bytes) {
+    live_heap_bytes -= static_cast<int64_t>(bytes);
+    Throw(BudgetExceeded(BudgetExceeded::Resource::HEAP_BYTES,
+                         "Heap budget of "s + to_string(budget_state.max_heap_bytes)
+                             + " bytes exceeded"s));
+}
+
+void ThrowCallDepthBudgetExceeded() {
+    Throw(BudgetExceeded(BudgetExceeded::Resource::CALL_DEPTH,
+                         "Call depth budget of "s + to_string(budget_state.max_call_depth)
+                             + " exceeded"s));
+}
+
+void ChargeSteps(int64_t steps) {
+    BudgetState& state = budget_state;
+    if (!state.is_active) {
+        return;
+    }
+    state.steps_left -= steps;
+    if (state.steps_left < 0) {
+        Throw(BudgetExceeded(BudgetExceeded::Resource::STEPS,
+                             "Step budget of "s + to_string(state.max_steps) + " exceeded"s));
+    }
+    if (state.is_timed && chrono::steady_clock::now() >= state.deadline) {
+        // Время проверяется не реже чем раз в WALL_TIME_CHECK_INTERVAL шагов. После ошибки
+        // счётчик точек приостановки не перезагружается, и проверка повторяется на следующем шаге
+        Throw(BudgetExceeded(BudgetExceeded::Resource::WALL_TIME,
+                             "Time budget of "s + to_string(ToMilliseconds(state.max_wall_time))
+                                 + " ms exceeded"s));
+    }
+}
+
+int64_t StepsUntilBudgetCheck() {
+    const BudgetState& state = budget_state;
+    if (!state.is_active) {
+        return numeric_limits<int64_t>::max();
+    }
+    // Проверка выполняется на шаге, следующем за последним разрешённым
+    int64_t steps = state.steps_left < numeric_limits<int64_t>::max() ? state.steps_left + 1
+                                                                       : state.steps_left;
+    if (state.is_timed) {
+        steps = min(steps, BudgetScope::WALL_TIME_CHECK_INTERVAL);
+    }
+    return max<int64_t>(steps, 1);
+}
+
+BudgetState ExchangeBudgetState(BudgetState state) {
+    state.live_heap_bytes = exchange(live_heap_bytes, state.live_heap_bytes);
+    state.heap_limit = exchange(heap_limit, state.heap_limit);
+    state.call_depth_limit = exchange(budget_call_depth, state.call_depth_limit);
+    swap(state, budget_state);
+    return state;
+}
+
+}  // namespace detail
+
+BudgetScope::BudgetScope(const ExecutionBudget& budget) {
+    FlushSteps();
+    BudgetState& state = budget_state;
+    saved_ = state;
+    saved_.live_heap_bytes = detail::live_heap_bytes;
+    saved_.heap_limit = detail::heap_limit;
+    saved_.call_depth_limit = detail::budget_call_depth;
+
+    state.is_active = state.is_active || budget.IsLimited();
+    if (budget.max_steps != 0) {
+        const auto max_steps = static_cast<int64_t>(
+            min<uint64_t>(budget.max_steps, numeric_limits<int64_t>::max() - 1));
+        state.steps_left = min(state.steps_left, max_steps);
+        state.max_steps = budget.max_steps;
+    }
+    if (budget.max_wall_time.count() > 0) {
+        const auto deadline = chrono::steady_clock::now() + budget.max_wall_time;
+        state.deadline = state.is_timed ? min(state.deadline, deadline) : deadline;
+        state.is_timed = true;
+        state.max_wall_time = budget.max_wall_time;
+    }
+    if (budget.max_call_depth != 0) {
+        detail::budget_call_depth =
+            min(detail::budget_call_depth, detail::GetCallDepth() + budget.max_call_depth);
+        state.max_call_depth = budget.max_call_depth;
+    }
+    if (budget.max_heap_bytes != 0) {
+        detail::heap_limit =
+            min(detail::heap_limit,
+                detail::live_heap_bytes + static_cast<int64_t>(min<size_t>(
+                                              budget.max_heap_bytes,
+                                              numeric_limits<int64_t>::max() / 2)));
+        state.max_heap_bytes = budget.max_heap_bytes;
+    }
+    initial_steps_ = state.steps_left;
+    detail::ReloadSafePoints();
+}
+
+BudgetScope::~BudgetScope() {
+    // Шаги вложенных ограничений расходуют и внешние
+    if (saved_.is_active) {
+        saved_.steps_left -= static_cast<int64_t>(GetUsedSteps());
+    }
+    // Объекты, созданные под ограничениями, продолжают учитываться после их снятия
+    saved_.live_heap_bytes = detail::live_heap_bytes;
+    detail::ExchangeBudgetState(saved_);
+    detail::ReloadSafePoints();
+}
+
+uint64_t BudgetScope::GetUsedSteps() const {
+    FlushSteps();
+    return static_cast<uint64_t>(initial_steps_ - budget_state.steps_left);
+}
+
+optional<ExecutionBudget> GetRemainingBudget() {
+    const BudgetState& state = budget_state;
+    if (!state.is_active) {
+        return nullopt;
+    }
+    ExecutionBudget budget;
+    if (state.max_steps != 0) {
+        budget.max_steps = static_cast<uint64_t>(max<int64_t>(state.steps_left, 1));
+    }
+    if (state.is_timed) {
+        budget.max_wall_time = max(state.deadline - chrono::steady_clock::now(),
+                                   chrono::steady_clock::duration(1));
+    }
+    if (state.max_call_depth != 0) {
+        budget.max_call_depth = max<size_t>(detail::budget_call_depth - detail::GetCallDepth(), 1);
+    }
+    if (state.max_heap_bytes != 0) {
+        budget.max_heap_bytes =
+            static_cast<size_t>(max<int64_t>(detail::heap_limit - detail::live_heap_bytes, 1));
+    }
+    return budget;
+}
+
+}  // namespace runtime
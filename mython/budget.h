@@ -0,0 +1,143 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+namespace runtime {
+
+// Ограничения ресурсов, которые может израсходовать программа. Нулевое значение
+// означает, что ресурс не ограничен
+struct ExecutionBudget {
+    // Сколько шагов может выполнить программа. Шаг — инструкция составной инструкции
+    // либо вызов метода, то есть точка приостановки (см. SafePoint)
+    uint64_t max_steps = 0;
+    // Наибольшая глубина вызовов методов
+    size_t max_call_depth = 0;
+    // Наибольшее время выполнения
+    std::chrono::steady_clock::duration max_wall_time{};
+    // Сколько байт могут занимать объекты, созданные программой: объекты Mython,
+    // поля экземпляров, переменные и содержимое строк
+    size_t max_heap_bytes = 0;
+
+    [[nodiscard]] bool IsLimited() const {
+        return max_steps != 0 || max_call_depth != 0 || max_wall_time.count() != 0
+               || max_heap_bytes != 0;
+    }
+};
+
+// Исключение, которым прерывается программа, израсходовавшая один из ресурсов ExecutionBudget
+class BudgetExceeded : public std::runtime_error {
+public:
+    enum class Resource { STEPS, CALL_DEPTH, WALL_TIME, HEAP_BYTES };
+
+    BudgetExceeded(Resource resource, const std::string& what)
+        : std::runtime_error(what)
+        , resource_(resource) {
+    }
+
+    [[nodiscard]] Resource GetResource() const {
+        return resource_;
+    }
+
+private:
+    Resource resource_;
+};
+
+// Ограничения текущего потока. Зелёные потоки хранят собственные ограничения
+struct BudgetState {
+    bool is_active = false;
+    // Сколько ещё шагов разрешено выполнить
+    int64_t steps_left = std::numeric_limits<int64_t>::max();
+    // Момент, после которого выполнение прерывается, если is_timed
+    bool is_timed = false;
+    std::chrono::steady_clock::time_point deadline;
+    // Наибольшая глубина вызовов методов и исходные значения ограничений для сообщений об ошибках
+    size_t call_depth_limit = std::numeric_limits<size_t>::max();
+    uint64_t max_steps = 0;
+    size_t max_call_depth = 0;
+    std::chrono::steady_clock::duration max_wall_time{};
+    size_t max_heap_bytes = 0;
+    // Сколько байт занимают объекты, созданные потоком, и сколько им разрешено занимать
+    int64_t live_heap_bytes = 0;
+    int64_t heap_limit = std::numeric_limits<int64_t>::max();
+};
+
+/*
+Устанавливает ограничения для кода, выполняемого текущим потоком, на время своего существования.
+
+Проверки не добавляют работы на пути выполнения: шаги считает счётчик точек приостановки,
+который уже уменьшается в каждой точке, и ограничения проверяются, лишь когда он обнуляется,
+то есть не чаще чем раз в WALL_TIME_CHECK_INTERVAL шагов, если ограничено время.
+Глубина вызовов сравнивается с предельной при каждом вызове метода, а занятая память —
+при выделении каждого блока.
+
+Ограничения действуют на потоке, создавшем BudgetScope, и в зелёном потоке, в котором он создан.
+Итерации parallel for, выполняемые другими потоками, получают остаток ограничений, а их шаги
+учитываются после завершения цикла. Актор также получает остаток ограничений создавшего его
+потока, но его шаги расходуют только его собственные ограничения.
+Вложенный BudgetScope может только сузить действующие ограничения
+*/
+class BudgetScope {
+public:
+    // Сколько шагов проходит между проверками времени выполнения
+    static constexpr int64_t WALL_TIME_CHECK_INTERVAL = 4096;
+
+    explicit BudgetScope(const ExecutionBudget& budget);
+    ~BudgetScope();
+
+    BudgetScope(const BudgetScope&) = delete;
+    BudgetScope& operator=(const BudgetScope&) = delete;
+
+    // Сколько шагов выполнено с момента создания
+    [[nodiscard]] uint64_t GetUsedSteps() const;
+
+private:
+    int64_t initial_steps_;
+    // Ограничения, действовавшие до создания объекта
+    BudgetState saved_;
+};
+
+// Возвращает неизрасходованную часть ограничений текущего потока либо nullopt,
+// если ограничения не установлены
+[[nodiscard]] std::optional<ExecutionBudget> GetRemainingBudget();
+
+namespace detail {
+// Сколько байт занимают блоки, выделенные текущим потоком и ещё не освобождённые, и их предел.
+// Блоки, освобождённые другим потоком, уменьшают его счётчик, поэтому учёт приблизителен
+inline thread_local int64_t live_heap_bytes = 0;
+inline thread_local int64_t heap_limit = std::numeric_limits<int64_t>::max();
+// Наибольшая глубина вызовов методов, разрешённая ограничениями текущего потока
+inline thread_local size_t budget_call_depth = std::numeric_limits<size_t>::max();
+
+[[noreturn]] void ThrowHeapBudgetExceeded(size_t bytes);
+[[noreturn]] void ThrowCallDepthBudgetExceeded();
+
+// Учитывает выделение блока размером bytes. Если превышен предел памяти,
+// выбрасывает BudgetExceeded, не учитывая блок
+inline void ChargeHeap(size_t bytes) {
+    live_heap_bytes += static_cast<int64_t>(bytes);
+    if (live_heap_bytes > heap_limit) {
+        ThrowHeapBudgetExceeded(bytes);
+    }
+}
+
+// Учитывает освобождение блока размером bytes
+inline void ReleaseHeap(size_t bytes) {
+    live_heap_bytes -= static_cast<int64_t>(bytes);
+}
+
+// Списывает steps шагов и проверяет время выполнения. При превышении ограничений
+// выбрасывает BudgetExceeded
+void ChargeSteps(int64_t steps);
+// Сколько шагов можно выполнить до следующей проверки ограничений
+[[nodiscard]] int64_t StepsUntilBudgetCheck();
+// Устанавливает ограничения текущего потока и возвращает прежние
+BudgetState ExchangeBudgetState(BudgetState state);
+}  // namespace detail
+
+}  // namespace runtime
@@ -0,0 +1,204 @@
+#include "budget.h"
+#include "scheduler.h"
+#include "statement.h"
+#include "test_program_p.h"
+#include "test_runner_p.h"
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+// Выполняет программу с ограничениями budget и возвращает ресурс, который она превысила
+BudgetExceeded::Resource RunOverBudget(const string& program, const ExecutionBudget& budget) {
+    ostringstream output;
+    try {
+        BudgetScope scope(budget);
+        RunProgram(program, output);
+    } catch (const BudgetExceeded& e) {
+        return e.GetResource();
+    }
+    ASSERT(false);
+    return {};
+}
+
+const string ENDLESS_LOOP = "i = 0\nwhile True:\n  i = i + 1\n"s;
+
+const string DEEP_RECURSION = R"--(
+class R:
+  def depth(n):
+    if n == 0:
+      return 0
+    return 1 + self.depth(n - 1)
+r = R()
+print r.depth(DEPTH)
+)--"s;
+
+string WithDepth(size_t depth) {
+    string program = DEEP_RECURSION;
+    program.replace(program.find("DEPTH"s), 5, to_string(depth));
+    return program;
+}
+
+void TestStepBudget() {
+    ExecutionBudget budget;
+    budget.max_steps = 1000;
+    ASSERT(RunOverBudget(ENDLESS_LOOP, budget) == BudgetExceeded::Resource::STEPS);
+
+    // Шаги считаются точно: программа из трёх инструкций выполняет три шага
+    {
+        BudgetScope scope(budget);
+        ostringstream output;
+        RunProgram("x = 1\ny = 2\nprint x + y\n"s, output);
+        ASSERT_EQUAL(scope.GetUsedSteps(), 3U);
+        ASSERT_EQUAL(output.str(), "3\n"s);
+    }
+    budget.max_steps = 3;
+    {
+        BudgetScope scope(budget);
+        ostringstream output;
+        RunProgram("x = 1\ny = 2\nprint x + y\n"s, output);
+    }
+    budget.max_steps = 2;
+    ASSERT(RunOverBudget("x = 1\ny = 2\nprint x + y\n"s, budget)
+           == BudgetExceeded::Resource::STEPS);
+
+    // Вложенные ограничения расходуют внешние
+    budget.max_steps = 5;
+    BudgetScope outer(budget);
+    {
+        ExecutionBudget inner_budget;
+        inner_budget.max_steps = 100;
+        BudgetScope inner(inner_budget);
+        ostringstream output;
+        RunProgram("x = 1\ny = 2\nz = 3\n"s, output);
+    }
+    ASSERT_EQUAL(outer.GetUsedSteps(), 3U);
+    ASSERT_EQUAL(GetRemainingBudget()->max_steps, 2U);
+    ostringstream output;
+    ASSERT_THROWS(RunProgram("x = 1\ny = 2\nz = 3\n"s, output), BudgetExceeded);
+}
+
+void TestCallDepthBudget() {
+    ExecutionBudget budget;
+    budget.max_call_depth = 50;
+    {
+        BudgetScope scope(budget);
+        ostringstream output;
+        RunProgram(WithDepth(40), output);
+        ASSERT_EQUAL(output.str(), "40\n"s);
+    }
+    ASSERT(RunOverBudget(WithDepth(60), budget) == BudgetExceeded::Resource::CALL_DEPTH);
+
+    // Превышение ограничения отличается от исчерпания максимальной глубины вызовов
+    const size_t max_call_depth = GetMaxCallDepth();
+    SetMaxCallDepth(30);
+    ostringstream output;
+    try {
+        BudgetScope scope(budget);
+        RunProgram(WithDepth(40), output);
+        ASSERT(false);
+    } catch (const BudgetExceeded&) {
+        ASSERT(false);
+    } catch (const RecursionError&) {
+    }
+    SetMaxCallDepth(max_call_depth);
+}
+
+void TestWallTimeBudget() {
+    ExecutionBudget budget;
+    budget.max_wall_time = chrono::milliseconds(20);
+    const auto start = chrono::steady_clock::now();
+    ASSERT(RunOverBudget(ENDLESS_LOOP, budget) == BudgetExceeded::Resource::WALL_TIME);
+    ASSERT(chrono::steady_clock::now() - start < chrono::seconds(5));
+
+    // Итерации parallel for, выполняемые другими потоками, получают остаток ограничений
+    const string parallel = R"--(
+parallel for i in range(0, 8):
+  j = 0
+  while True:
+    j = j + 1
+)--"s;
+    ASSERT(RunOverBudget(parallel, budget) == BudgetExceeded::Resource::WALL_TIME);
+}
+
+void TestHeapBudget() {
+    const int64_t live_before = detail::live_heap_bytes;
+    ExecutionBudget budget;
+    budget.max_heap_bytes = 1 << 20;
+    const string chain = R"--(
+class Node:
+  def __init__(next):
+    self.next = next
+n = None
+while True:
+  n = Node(n)
+)--"s;
+    ASSERT(RunOverBudget(chain, budget) == BudgetExceeded::Resource::HEAP_BYTES);
+    // После прерывания программы её объекты освобождены
+    ASSERT_EQUAL(detail::live_heap_bytes, live_before);
+
+    // Содержимое строки учитывается до того, как оно собрано из частей
+    const string doubling = R"--(
+s = 'abcdefghijklmnopqrstuvwxyz'
+i = 0
+while i < 40:
+  s = s + s
+  i = i + 1
+print s
+)--"s;
+    ASSERT(RunOverBudget(doubling, budget) == BudgetExceeded::Resource::HEAP_BYTES);
+    ASSERT_EQUAL(detail::live_heap_bytes, live_before);
+}
+
+void TestBudgetsOfGreenThreads() {
+    // Каждый зелёный поток расходует собственные ограничения
+    GreenScheduler scheduler(10);
+    string output;
+    scheduler.Spawn([] {
+        ExecutionBudget budget;
+        budget.max_steps = 1000;
+        BudgetScope scope(budget);
+        ostringstream output;
+        RunProgram(ENDLESS_LOOP, output);
+    });
+    scheduler.Spawn([&output] {
+        ExecutionBudget budget;
+        budget.max_steps = 5000;
+        BudgetScope scope(budget);
+        ostringstream program_output;
+        RunProgram("i = 0\nwhile i < 1000:\n  i = i + 1\nprint i\n"s, program_output);
+        output = program_output.str();
+    });
+    scheduler.Run();
+    ASSERT(scheduler.GetStats(0).is_failed);
+    ASSERT_EQUAL(scheduler.GetStats(0).error, "Step budget of 1000 exceeded"s);
+    ASSERT(!scheduler.GetStats(1).is_failed);
+    ASSERT_EQUAL(output, "1000\n"s);
+    ASSERT(!GetRemainingBudget());
+
+    // Длинная цепочка экземпляров освобождается и на наименьшем стеке зелёного потока
+    GreenScheduler releasing(GreenScheduler::DEFAULT_SLICE, detail::MIN_STACK_SIZE);
+    releasing.Spawn([] {
+        ostringstream output;
+        RunProgram(
+            "class Node:\n  def __init__(next):\n    self.next = next\n"
+            "n = None\ni = 0\nwhile i < 5000:\n  n = Node(n)\n  i = i + 1\n"s,
+            output);
+    });
+    releasing.Run();
+    ASSERT(releasing.GetStats(0).is_finished && !releasing.GetStats(0).is_failed);
+}
+
+}  // namespace
+
+void RunBudgetTests(TestRunner& tr) {
+    RUN_TEST(tr, TestStepBudget);
+    RUN_TEST(tr, TestCallDepthBudget);
+    RUN_TEST(tr, TestWallTimeBudget);
+    RUN_TEST(tr, TestHeapBudget);
+    RUN_TEST(tr, TestBudgetsOfGreenThreads);
+}
+
+}  // namespace runtime
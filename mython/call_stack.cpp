@@ -0,0 +1,205 @@
+#include "call_stack.h"
+
+#include "budget.h"
+#include "stats.h"
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if __has_include(<ucontext.h>) && __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#include <ucontext.h>
+#define MYTHON_HAS_STACK_SEGMENTS 1
+#endif
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+// Размер сегмента стека, выделяемого в куче
+constexpr size_t STACK_SEGMENT_SIZE = 4 * 1024 * 1024;
+// Сколько места должно оставаться на сегменте, чтобы выполнить на нём очередной вызов
+constexpr size_t STACK_RESERVE = 256 * 1024;
+// Сколько стека потока разрешено занять вызовам методов до перехода на сегменты из кучи.
+// Значение заведомо меньше стандартного размера стека потока
+constexpr size_t THREAD_STACK_BUDGET = 512 * 1024;
+// Сколько освобождённых сегментов хранится для повторного использования
+constexpr size_t MAX_FREE_SEGMENTS = 4;
+// Размер защитной области под сегментом. Обращение к ней, например вызовом, которому не хватило
+// STACK_RESERVE, завершает программу по SIGSEGV, а не портит соседнюю память
+constexpr size_t STACK_GUARD_SIZE = 64 * 1024;
+
+#ifdef MYTHON_HAS_STACK_SEGMENTS
+// Сегмент стека с защитной областью снизу. Память отображается без заполнения нулями,
+// поэтому физические страницы выделяются, только когда стек до них дорастает
+class StackSegment {
+public:
+    StackSegment() {
+        void* memory = mmap(nullptr, STACK_GUARD_SIZE + STACK_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (memory == MAP_FAILED) {
+            throw bad_alloc();
+        }
+        memory_ = static_cast<char*>(memory);
+        if (mprotect(memory_, STACK_GUARD_SIZE, PROT_NONE) != 0) {
+            munmap(memory_, STACK_GUARD_SIZE + STACK_SEGMENT_SIZE);
+            throw bad_alloc();
+        }
+    }
+
+    ~StackSegment() {
+        munmap(memory_, STACK_GUARD_SIZE + STACK_SEGMENT_SIZE);
+    }
+
+    StackSegment(const StackSegment&) = delete;
+    StackSegment& operator=(const StackSegment&) = delete;
+
+    // Начало области, доступной стеку. Стек растёт вниз, к защитной области
+    [[nodiscard]] char* GetStack() const {
+        return memory_ + STACK_GUARD_SIZE;
+    }
+
+private:
+    char* memory_ = nullptr;
+};
+#else
+class StackSegment {};
+#endif
+
+atomic<size_t> max_call_depth{DEFAULT_MAX_CALL_DEPTH};
+
+struct StackState {
+    size_t depth = 0;
+    // Граница, после которой вызовы переходят на новый сегмент. Стек растёт вниз
+    const char* limit = nullptr;
+    // Освобождённые сегменты, которые можно использовать повторно
+    vector<unique_ptr<StackSegment>> free_segments;
+    // Задача, выполняемая на только что созданном сегменте
+    const function<void()>* task = nullptr;
+    exception_ptr task_exception;
+};
+
+thread_local StackState stack_state;
+
+#ifdef MYTHON_HAS_STACK_SEGMENTS
+void RunTask() {
+    StackState& state = stack_state;
+    try {
+        (*state.task)();
+    } catch (...) {
+        state.task_exception = current_exception();
+    }
+}
+
+// Выполняет задачу потока на сегменте segment и возвращается, когда она завершится.
+// Переключение стека похоже на longjmp, поэтому функция не встраивается и не имеет
+// локальных объектов с деструкторами
+[[gnu::noinline]] void SwitchToSegment(StackSegment& segment) {
+    ucontext_t caller;
+    ucontext_t callee;
+    getcontext(&callee);
+    callee.uc_stack.ss_sp = segment.GetStack();
+    callee.uc_stack.ss_size = STACK_SEGMENT_SIZE;
+    callee.uc_link = &caller;
+    makecontext(&callee, RunTask, 0);
+    swapcontext(&caller, &callee);
+}
+#endif
+
+}  // namespace
+
+void SetMaxCallDepth(size_t depth) {
+    max_call_depth = depth;
+}
+
+size_t GetMaxCallDepth() {
+    return max_call_depth;
+}
+
+CallDepthGuard::CallDepthGuard() {
+    if (stack_state.depth >= max_call_depth) {
+        Throw(RecursionError("Maximum call depth of "s + to_string(max_call_depth) + " exceeded"s));
+    }
+    if (stack_state.depth >= detail::budget_call_depth) {
+        detail::ThrowCallDepthBudgetExceeded();
+    }
+    ++stack_state.depth;
+}
+
+CallDepthGuard::~CallDepthGuard() {
+    --stack_state.depth;
+}
+
+namespace detail {
+
+size_t GetCallDepth() {
+    return stack_state.depth;
+}
+
+CallStackState MakeCallStackState(const char* stack, size_t size) {
+    static_assert(MIN_STACK_SIZE > STACK_RESERVE);
+    return {0, size > STACK_RESERVE ? stack + STACK_RESERVE : stack + size};
+}
+
+CallStackState ExchangeCallStackState(CallStackState state) {
+    CallStackState previous{stack_state.depth, stack_state.limit};
+    stack_state.depth = state.depth;
+    stack_state.limit = state.limit;
+    return previous;
+}
+
+bool HasStackReserve() {
+    // Адрес локальной переменной задаёт текущую позицию на стеке
+    char marker = 0;
+    const char* position = &marker;
+    if (stack_state.limit == nullptr) {
+        // Граница лежит вне объекта marker, поэтому вычисляется над адресом, а не указателем
+        stack_state.limit =
+            reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(position) - THREAD_STACK_BUDGET);
+    }
+    return position > stack_state.limit;
+}
+
+void RunOnNewStackSegment(const function<void()>& fn) {
+#ifdef MYTHON_HAS_STACK_SEGMENTS
+    StackState& state = stack_state;
+
+    unique_ptr<StackSegment> segment;
+    if (state.free_segments.empty()) {
+        segment = make_unique<StackSegment>();
+    } else {
+        segment = std::move(state.free_segments.back());
+        state.free_segments.pop_back();
+    }
+
+    const char* saved_limit = state.limit;
+    state.limit = segment->GetStack() + STACK_RESERVE;
+    state.task = &fn;
+    state.task_exception = nullptr;
+
+    SwitchToSegment(*segment);
+
+    state.limit = saved_limit;
+    state.task = nullptr;
+    if (state.free_segments.size() < MAX_FREE_SEGMENTS) {
+        state.free_segments.push_back(std::move(segment));
+    }
+    if (auto error = std::exchange(state.task_exception, nullptr)) {
+        rethrow_exception(error);
+    }
+#else
+    fn();
+#endif
+}
+
+}  // namespace detail
+
+}  // namespace runtime
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+
+namespace runtime {
+
+// Исключение, выбрасываемое при превышении максимальной глубины вызовов методов
+class RecursionError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Максимальная глубина вызовов методов по умолчанию
+inline constexpr size_t DEFAULT_MAX_CALL_DEPTH = 100000;
+
+// Задаёт максимальную глубину вызовов методов Mython. Ограничение общее для всех потоков
+void SetMaxCallDepth(size_t depth);
+[[nodiscard]] size_t GetMaxCallDepth();
+
+/*
+Учитывает вызов метода в глубине стека вызовов текущего потока.
+Если глубина превышает максимальную, конструктор выбрасывает RecursionError,
+а если она превышает разрешённую ограничениями выполнения (см. BudgetScope) — BudgetExceeded
+*/
+class CallDepthGuard {
+public:
+    CallDepthGuard();
+    ~CallDepthGuard();
+
+    CallDepthGuard(const CallDepthGuard&) = delete;
+    CallDepthGuard& operator=(const CallDepthGuard&) = delete;
+};
+
+// Глубина вызовов методов и граница стека, на котором они выполняются.
+// Планировщик зелёных потоков хранит своё состояние для каждого зелёного потока
+struct CallStackState {
+    size_t depth = 0;
+    const char* limit = nullptr;
+};
+
+namespace detail {
+// Возвращает состояние стека вызовов для выполнения на стеке [stack, stack + size).
+// Размер стека должен превышать MIN_STACK_SIZE
+CallStackState MakeCallStackState(const char* stack, size_t size);
+// Устанавливает состояние стека вызовов текущего потока и возвращает прежнее
+CallStackState ExchangeCallStackState(CallStackState state);
+// Возвращает глубину вызовов методов на текущем потоке
+size_t GetCallDepth();
+// Наименьший размер стека, на котором можно выполнять вызовы методов
+inline constexpr size_t MIN_STACK_SIZE = 320 * 1024;
+
+// Возвращает true, если на текущем сегменте стека достаточно места для очередного вызова метода
+bool HasStackReserve();
+// Выполняет fn на сегменте стека с защитной областью, выделенном вне стека потока,
+// и передаёт вызывающему её исключения
+void RunOnNewStackSegment(const std::function<void()>& fn);
+}  // namespace detail
+
+/*
+Выполняет fn на стеке текущего потока либо, если на нём осталось мало места,
+на новом сегменте стека, выделенном в куче. Так глубина рекурсии методов Mython
+ограничена только максимальной глубиной вызовов, а не размером стека потока
+*/
+template <typename Fn>
+void RunWithStackReserve(Fn&& fn) {
+    if (detail::HasStackReserve()) {
+        fn();
+    } else {
+        detail::RunOnNewStackSegment(std::ref(fn));
+    }
+}
+
+}  // namespace runtime
@@ -1,7 +1,10 @@
 #include "lexer.h"
 
-#include <algorithm>
-#include <charconv>
+#include <array>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 
 using namespace std;
 
@@ -67,6 +70,11 @@ std::ostream& operator<<(std::ostream& os, const Token& rhs) {
     UNVALUED_OUTPUT(None);
     UNVALUED_OUTPUT(True);
     UNVALUED_OUTPUT(False);
+    UNVALUED_OUTPUT(While);
+    UNVALUED_OUTPUT(For);
+    UNVALUED_OUTPUT(In);
+    UNVALUED_OUTPUT(Import);
+    UNVALUED_OUTPUT(Parallel);
     UNVALUED_OUTPUT(Eof);
 
 #undef UNVALUED_OUTPUT
@@ -74,287 +82,401 @@ std::ostream& operator<<(std::ostream& os, const Token& rhs) {
     return os << "Unknown token :("sv;
 }
 
-Token Lexer::ParseIndent() {
-    is_need_to_parse_indent_ = false;
-    size_t this_indent = 0;
-    char c;
-    while (input_.get(c) && c == ' ') {
-        this_indent++;
+namespace {
+
+// Класс символа определяет, в какое состояние переходит автомат лексера
+enum class CharClass : uint8_t {
+    INVALID,   // Недопустимый символ
+    SPACE,     // Пробельный символ внутри строки
+    NEWLINE,   // Конец строки
+    DIGIT,     // Начало числа
+    NAME,      // Начало идентификатора или ключевого слова
+    QUOTE,     // Начало строковой константы
+    HASH,      // Начало комментария
+    OPERATOR,  // Символ, который может быть началом двухсимвольной операции: = < > !
+    CHAR,      // Односимвольная лексема
+};
+
+constexpr std::array<CharClass, 256> MakeCharClasses() {
+    std::array<CharClass, 256> classes{};
+    for (int c = 0x21; c < 0x7f; ++c) {
+        classes[c] = CharClass::CHAR;
     }
-    if (c == '\n') {
-        input_.putback(c);
-        return GetTokenFromIstream(input_);
+    for (int c = 0x80; c < 0x100; ++c) {
+        classes[c] = CharClass::NAME;
     }
-    input_.putback(c);
-    if (indent_ > this_indent) {
-        size_t buff_size = indent_ / 2 - this_indent / 2;
-        for (size_t i = 0; i < buff_size; ++i) {
-            token_buffer_.push_back(token_type::Dedent{});
-        }
-        indent_ -= 2 * buff_size;
-        return NextToken();
-    } else if (indent_ < this_indent) {
-        indent_ += 2;
-        return token_type::Indent{};
-    } else {
-        return GetTokenFromIstream(input_);
+    for (int c = 'a'; c <= 'z'; ++c) {
+        classes[c] = CharClass::NAME;
+    }
+    for (int c = 'A'; c <= 'Z'; ++c) {
+        classes[c] = CharClass::NAME;
     }
+    for (int c = '0'; c <= '9'; ++c) {
+        classes[c] = CharClass::DIGIT;
+    }
+    classes['_'] = CharClass::NAME;
+    classes[' '] = CharClass::SPACE;
+    classes['\t'] = CharClass::SPACE;
+    classes['\r'] = CharClass::SPACE;
+    classes['\n'] = CharClass::NEWLINE;
+    classes['\''] = CharClass::QUOTE;
+    classes['"'] = CharClass::QUOTE;
+    classes['#'] = CharClass::HASH;
+    classes['='] = CharClass::OPERATOR;
+    classes['<'] = CharClass::OPERATOR;
+    classes['>'] = CharClass::OPERATOR;
+    classes['!'] = CharClass::OPERATOR;
+    return classes;
 }
 
-Token Lexer::ParseConstString() {
+constexpr std::array<CharClass, 256> CHAR_CLASSES = MakeCharClasses();
 
-    char string_start = input_.get();
-    auto it = std::istreambuf_iterator<char>(input_);
-    auto end = std::istreambuf_iterator<char>();
-    std::string s;
-    while (true) {
-        if (it == end) {
-            throw invalid_argument(""s);
-        }
-        const char ch = *it;
-        if (ch == string_start) {
-            ++it;
-            break;
-        } else if (ch == '\\') {
-            ++it;
-            if (it == end) {
-                throw invalid_argument(""s);
-            }
-            const char escaped_char = *(it);
-            switch (escaped_char) {
-                case 'n':
-                    s.push_back('\n');
-                    break;
-                case 't':
-                    s.push_back('\t');
-                    break;
-                case 'r':
-                    s.push_back('\r');
-                    break;
-                case '"':
-                    s.push_back('"');
-                    break;
-                case '\\':
-                    s.push_back('\\');
-                    break;
-                case '\'':
-                    s.push_back('\'');
-                    break;
-                default:
-                    throw invalid_argument(""s);
-            }
-        } else if (ch == '\n' || ch == '\r') {
-            throw invalid_argument(""s);
+CharClass ClassOf(int c) {
+    return CHAR_CLASSES[static_cast<unsigned char>(c)];
+}
+
+bool IsNameChar(int c) {
+    const CharClass char_class = ClassOf(c);
+    return c != std::char_traits<char>::eof()
+           && (char_class == CharClass::NAME || char_class == CharClass::DIGIT);
+}
+
+template <typename T>
+CompactToken MakeToken(uint32_t payload = 0) {
+    return {TOKEN_KIND<T>, payload};
+}
+
+const std::unordered_map<std::string_view, CompactToken>& KeyWords() {
+    using namespace token_type;
+    static const std::unordered_map<std::string_view, CompactToken> key_words = {
+        {"class"sv, MakeToken<Class>()}, {"return"sv, MakeToken<Return>()},
+        {"if"sv, MakeToken<If>()},       {"else"sv, MakeToken<Else>()},
+        {"def"sv, MakeToken<Def>()},     {"print"sv, MakeToken<Print>()},
+        {"and"sv, MakeToken<And>()},     {"or"sv, MakeToken<Or>()},
+        {"not"sv, MakeToken<Not>()},     {"None"sv, MakeToken<None>()},
+        {"True"sv, MakeToken<True>()},   {"False"sv, MakeToken<False>()},
+        {"while"sv, MakeToken<While>()}, {"for"sv, MakeToken<For>()},
+        {"in"sv, MakeToken<In>()},       {"import"sv, MakeToken<Import>()},
+        {"parallel"sv, MakeToken<Parallel>()},
+    };
+    return key_words;
+}
+
+template <size_t... Kinds>
+std::array<Token, sizeof...(Kinds)> MakeEmptyTokens(std::index_sequence<Kinds...>) {
+    return {Token(std::in_place_index<Kinds>)...};
+}
+
+// Лексемы без значения, индекс в массиве совпадает с видом лексемы
+const std::array<Token, std::variant_size_v<TokenBase>>& EmptyTokens() {
+    static const auto tokens = MakeEmptyTokens(std::make_index_sequence<std::variant_size_v<TokenBase>>{});
+    return tokens;
+}
+
+}  // namespace
+
+Lexer::Lexer(std::istream& input)
+    : input_(input.rdbuf()) {
+    current_ = ReadToken();
+    current_line_ = line_;
+}
+
+Lexer::Lexer(TokenSequence recorded)
+    : recorded_(std::move(recorded.tokens))
+    , recorded_lines_(std::move(recorded.lines))
+    , texts_(std::move(recorded.texts)) {
+    Advance();
+}
+
+CompactToken Lexer::Advance() {
+    if (input_ == nullptr) {
+        if (recorded_pos_ < recorded_.size()) {
+            current_line_ = recorded_pos_ < recorded_lines_.size() ? recorded_lines_[recorded_pos_] : 0;
+            current_ = recorded_[recorded_pos_++];
         } else {
-            s.push_back(ch);
+            current_ = CompactToken{};
         }
-        ++it;
+        current_token_.reset();
+    } else if (!current_.Is<token_type::Eof>()) {
+        current_ = ReadToken();
+        current_line_ = line_;
+        current_token_.reset();
     }
-    return token_type::String({s});
+    return current_;
 }
 
-Token Lexer::LoadNumberIdKeywordBool() {
-    string id;
-    char current_char;
-    while (input_.get(current_char) && current_char != ' ' && current_char != '\n' && unexpected_symbols.count(current_char) == 0) {
-        id.push_back(current_char);
-    }
-    input_.putback(current_char);
-    if (key_words_.count(id)) {
-        if (id == "return") {
-            return token_type::Return{};
-        }
-        if (id == "class") {
-            return token_type::Class{};
-        }
-        if (id == "if") {
-            return token_type::If{};
-        }
-        if (id == "else") {
-            return token_type::Else{};
-        }
-        if (id == "def") {
-            return token_type::Def{};
-        }
-        if (id == "print") {
-            return token_type::Print{};
-        }
-        if (id == "or") {
-            return token_type::Or{};
-        }
-        if (id == "None") {
-            return token_type::None{};
-        }
-        if (id == "True") {
-            return token_type::True{};
-        }
-        if (id == "False") {
-            return token_type::False{};
-        }
-        if (id == "not") {
-            return token_type::Not{};
+const std::string& Lexer::TextOf(CompactToken token) const {
+    return texts_->at(token.payload);
+}
+
+TokenSequence Lexer::RecordBlock() {
+    TokenSequence block{texts_, {}, {}};
+    Expect<token_type::Newline>();
+    block.tokens.push_back(current_);
+    block.lines.push_back(current_line_);
+    ExpectNext<token_type::Indent>();
+    block.tokens.push_back(current_);
+    block.lines.push_back(current_line_);
+    for (size_t depth = 1; depth > 0;) {
+        const CompactToken token = Advance();
+        if (token.Is<token_type::Eof>()) {
+            throw LexerError("Unexpected end of file inside a block"s);
         }
-        if (id == "and") {
-            return token_type::And{};
+        block.tokens.push_back(token);
+        block.lines.push_back(current_line_);
+        if (token.Is<token_type::Indent>()) {
+            ++depth;
+        } else if (token.Is<token_type::Dedent>()) {
+            --depth;
         }
     }
-    try {
-        auto number = stoi(id);
-        return token_type::Number({number});
-    } catch(...) {
-        return token_type::Id({id});
+    Advance();
+    return block;
+}
+
+TokenSequence Lexer::RecordAll() {
+    TokenSequence sequence{texts_, {}, {}};
+    for (; !current_.Is<token_type::Eof>(); Advance()) {
+        sequence.tokens.push_back(current_);
+        sequence.lines.push_back(current_line_);
     }
+    return sequence;
 }
 
-Token Lexer::GetTokenFromIstream(std::istream& input) {
-    if (!token_buffer_.empty()) {
-        token_buffer_.pop_back();
-        return token_type::Dedent{};
+const std::string& Lexer::ExpectId() const {
+    if (!current_.Is<token_type::Id>()) {
+        throw LexerError("Expected identifier"s);
     }
-    if (is_need_to_parse_indent_) {
-        return ParseIndent();
+    return TextOf(current_);
+}
+
+const Token& Lexer::CurrentToken() const {
+    if (!current_token_) {
+        if (current_.Is<token_type::Number>()) {
+            current_token_.emplace(token_type::Number{current_.AsNumber()});
+        } else if (current_.Is<token_type::Char>()) {
+            current_token_.emplace(token_type::Char{current_.AsChar()});
+        } else if (current_.Is<token_type::Id>()) {
+            current_token_.emplace(token_type::Id{TextOf(current_)});
+        } else if (current_.Is<token_type::String>()) {
+            current_token_.emplace(token_type::String{TextOf(current_)});
+        } else {
+            current_token_.emplace(EmptyTokens().at(current_.kind));
+        }
     }
-    char c;
-    while (input.get(c)) {
-        switch (c) {
-            case '_':
-                input_.putback(c);
-                return LoadNumberIdKeywordBool();
-            case '-':
-                return token_type::Char({c});
-            case '\n':
-
-                if (tokens_.empty()) continue;
-                is_new_line = true;
-                is_need_to_parse_indent_ = true;
-                if (tokens_.at(tokens_.size() - 1) == token_type::Newline{}) return ParseIndent();
-
-                return token_type::Newline();
-            case '.':
-                return token_type::Char({c});
-            case ',':
-                return token_type::Char({c});
-            case '(':
-                return token_type::Char({c});
-            case '+':
-                return token_type::Char({c});
-            case ')':
-                return token_type::Char({c});
-            case ' ':
-                break;
-            case '\"':
-                input_.putback(c);
-                return ParseConstString();
-            case '\'':
-                input_.putback(c);
-                return ParseConstString();
-            case '#':
-                while (c != '\n' && input_) {
-                    input_.get(c);
-                }
+    return *current_token_;
+}
 
-                if (is_token_in_last_line_) {
-                    is_new_line = true;
-                    is_token_in_last_line_ = false;
-                    is_need_to_parse_indent_ = true;
-                    return token_type::Newline{};
-                }
-                is_new_line = true;
-                if (tokens_.empty()) break;
-                return GetTokenFromIstream(input_);
-            case '=':
-                if (!input_) {
-                    return token_type::Char({c});
-                }
-                char new_char;
-                input_.get(new_char);
-                if (new_char == ' ') {
-                    return token_type::Char({c});
-                }
-                if (new_char == '=') {
-                    return token_type::Eq{};
-                }
-                input_.putback(new_char);
-                return token_type::Char({c});
-            case '<':
-                if (!input_) {
-                    return token_type::Char({c});
-                }
-                input_.get(new_char);
+Token Lexer::NextToken() {
+    Advance();
+    return CurrentToken();
+}
 
-                if (new_char == '=') {
-                    return token_type::LessOrEq{};
-                }
-                input_.putback(new_char);
-                return token_type::Char({c});
-
-            case '!':
-                input_.get();
-                return token_type::NotEq{};
-            case '*':
-                return token_type::Char({c});
-            case '/':
-                return token_type::Char({c});
-            case ':':
-                return token_type::Char({c});
-            case '>':
-                if (!input_) {
-                    return token_type::Char({c});
-                }
-                input_.get(new_char);
-                if (new_char == '=') {
-                    return token_type::GreaterOrEq{};
+uint32_t Lexer::InternText(std::string_view text) {
+    if (auto it = text_ids_.find(text); it != text_ids_.end()) {
+        return it->second;
+    }
+    const auto id = static_cast<uint32_t>(texts_->size());
+    texts_->emplace_back(text);
+    text_ids_.emplace(texts_->back(), id);
+    return id;
+}
+
+CompactToken Lexer::ReadToken() {
+    using Traits = std::char_traits<char>;
+    if (is_line_ended_) {
+        // Лексема Newline относится к строке, которую она завершает
+        is_line_ended_ = false;
+        ++line_;
+    }
+    while (true) {
+        if (pending_dedents_ > 0) {
+            --pending_dedents_;
+            return MakeToken<token_type::Dedent>();
+        }
+        if (at_line_start_) {
+            const size_t prev_indent = indent_;
+            if (ReadIndent() && indent_ > prev_indent) {
+                return MakeToken<token_type::Indent>();
+            }
+            continue;
+        }
+
+        const int c = input_->sbumpc();
+        if (c == Traits::eof()) {
+            if (line_has_tokens_) {
+                line_has_tokens_ = false;
+                at_line_start_ = true;
+                return MakeToken<token_type::Newline>();
+            }
+            if (indent_ > 0) {
+                pending_dedents_ = indent_ / 2;
+                indent_ = 0;
+                continue;
+            }
+            return MakeToken<token_type::Eof>();
+        }
+
+        const CharClass char_class = ClassOf(c);
+        switch (char_class) {
+            case CharClass::SPACE:
+                continue;
+            case CharClass::NEWLINE:
+                at_line_start_ = true;
+                if (line_has_tokens_) {
+                    line_has_tokens_ = false;
+                    is_line_ended_ = true;
+                    return MakeToken<token_type::Newline>();
                 }
-                input_.putback(new_char);
-                return token_type::Char({c});
-                //throw std::logic_error("");
+                ++line_;
+                continue;
+            case CharClass::HASH:
+                SkipComment();
+                continue;
+            case CharClass::INVALID:
+                throw LexerError("Unexpected character with code "s + std::to_string(c));
             default:
-                input_.putback(c);
-                return LoadNumberIdKeywordBool();
+                break;
         }
-    }
 
-    if (!is_new_line) {
-        is_new_line = true;
-        is_need_to_parse_indent_ = true;
-        return token_type::Newline{};
+        line_has_tokens_ = true;
+        before_first_token_ = false;
+        const char ch = static_cast<char>(c);
+        switch (char_class) {
+            case CharClass::DIGIT:
+                return ReadNumber(ch);
+            case CharClass::NAME:
+                return ReadName(ch);
+            case CharClass::QUOTE:
+                return ReadString(ch);
+            case CharClass::OPERATOR:
+                return ReadOperator(ch);
+            default:
+                return MakeToken<token_type::Char>(static_cast<unsigned char>(ch));
+        }
     }
-    return token_type::Eof{};
 }
 
-Lexer::Lexer(std::istream& input) : input_(input) {
-    char c;
-    input_.get(c);
-    if (input_.eof()) {
-        tokens_.push_back(token_type::Eof{});
-    } else {
-        input.putback(c);
-        tokens_.push_back(GetTokenFromIstream(input_));
+bool Lexer::ReadIndent() {
+    size_t spaces = 0;
+    while (input_->sgetc() == ' ') {
+        input_->sbumpc();
+        ++spaces;
+    }
+
+    const int c = input_->sgetc();
+    if (c == '\n') {
+        input_->sbumpc();
+        ++line_;
+        return false;
+    }
+    if (c == '#') {
+        SkipComment();
+        return false;
+    }
+
+    at_line_start_ = false;
+    if (c == std::char_traits<char>::eof() || before_first_token_) {
+        // Конец файла обрабатывается в ReadToken, отступ первой строки не учитывается
+        return true;
+    }
+    if (spaces > indent_) {
+        indent_ += 2;
+    } else if (spaces < indent_) {
+        pending_dedents_ = indent_ / 2 - spaces / 2;
+        indent_ -= 2 * pending_dedents_;
     }
+    return true;
+}
 
+void Lexer::SkipComment() {
+    using Traits = std::char_traits<char>;
+    // Символ конца строки остаётся в потоке, чтобы его обработал ReadToken
+    for (int c = input_->sgetc(); c != Traits::eof() && c != '\n'; c = input_->snextc()) {
+    }
 }
 
-const Token& Lexer::CurrentToken() const {
-    return tokens_.at(tokens_.size() - 1);
+CompactToken Lexer::ReadNumber(char first) {
+    int value = first - '0';
+    for (int c = input_->sgetc(); ClassOf(c) == CharClass::DIGIT && c != std::char_traits<char>::eof();
+         c = input_->snextc()) {
+        if (value > (std::numeric_limits<int>::max() - (c - '0')) / 10) {
+            throw LexerError("Number is too large"s);
+        }
+        value = value * 10 + (c - '0');
+    }
+    return MakeToken<token_type::Number>(static_cast<uint32_t>(value));
 }
 
-Token Lexer::NextToken() {
-    if (CurrentToken() == token_type::Eof{}) return  CurrentToken();
-    if (!token_buffer_.empty()) {
-        token_buffer_.pop_back();
-        return token_type::Dedent{};
+CompactToken Lexer::ReadName(char first) {
+    buffer_.assign(1, first);
+    for (int c = input_->sgetc(); IsNameChar(c); c = input_->snextc()) {
+        buffer_.push_back(static_cast<char>(c));
     }
-    if (CurrentToken() != token_type::Newline{} && CurrentToken() != token_type::Indent{}) {
-        is_token_in_last_line_ = true;
-    } else {
-        is_token_in_last_line_ = false;
+    const auto& key_words = KeyWords();
+    if (auto it = key_words.find(buffer_); it != key_words.end()) {
+        return it->second;
     }
-    tokens_.push_back(GetTokenFromIstream(input_));
+    return MakeToken<token_type::Id>(InternText(buffer_));
+}
 
-    if (CurrentToken() != token_type::Newline{} && CurrentToken() != token_type::Eof{} && CurrentToken() != token_type::Dedent{} && CurrentToken() != token_type::Indent{}) {
-        is_new_line = false;
+CompactToken Lexer::ReadString(char quote) {
+    using Traits = std::char_traits<char>;
+    std::string& s = buffer_;
+    s.clear();
+    while (true) {
+        const int c = input_->sbumpc();
+        if (c == Traits::eof() || c == '\n' || c == '\r') {
+            throw LexerError("Unterminated string constant"s);
+        }
+        if (c == quote) {
+            break;
+        }
+        if (c != '\\') {
+            s.push_back(static_cast<char>(c));
+            continue;
+        }
+        switch (input_->sbumpc()) {
+            case 'n':
+                s.push_back('\n');
+                break;
+            case 't':
+                s.push_back('\t');
+                break;
+            case 'r':
+                s.push_back('\r');
+                break;
+            case '"':
+                s.push_back('"');
+                break;
+            case '\\':
+                s.push_back('\\');
+                break;
+            case '\'':
+                s.push_back('\'');
+                break;
+            default:
+                throw LexerError("Unknown escape sequence in string constant"s);
+        }
+    }
+    return MakeToken<token_type::String>(InternText(s));
+}
+
+CompactToken Lexer::ReadOperator(char first) {
+    if (input_->sgetc() != '=') {
+        return MakeToken<token_type::Char>(static_cast<unsigned char>(first));
+    }
+    input_->sbumpc();
+    switch (first) {
+        case '=':
+            return MakeToken<token_type::Eq>();
+        case '<':
+            return MakeToken<token_type::LessOrEq>();
+        case '>':
+            return MakeToken<token_type::GreaterOrEq>();
+        default:
+            return MakeToken<token_type::NotEq>();
     }
-    return tokens_.at(tokens_.size() - 1);
 }
 
-}  // namespace parse
\ No newline at end of file
+}  // namespace parse
@@ -1,14 +1,19 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <iosfwd>
+#include <limits>
+#include <memory>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 #include <variant>
 #include <vector>
-#include <set>
-#include <deque>
 
 namespace parse {
 
@@ -49,6 +54,11 @@ struct GreaterOrEq {};  // Лексема «>=»
 struct None {};         // Лексема «None»
 struct True {};         // Лексема «True»
 struct False {};        // Лексема «False»
+struct While {};        // Лексема «while»
+struct For {};          // Лексема «for»
+struct In {};           // Лексема «in»
+struct Import {};       // Лексема «import»
+struct Parallel {};     // Лексема «parallel»
 }  // namespace token_type
 
 using TokenBase
@@ -57,7 +67,9 @@ using TokenBase
                    token_type::Def, token_type::Newline, token_type::Print, token_type::Indent,
                    token_type::Dedent, token_type::And, token_type::Or, token_type::Not,
                    token_type::Eq, token_type::NotEq, token_type::LessOrEq, token_type::GreaterOrEq,
-                   token_type::None, token_type::True, token_type::False, token_type::Eof>;
+                   token_type::None, token_type::True, token_type::False, token_type::While,
+                   token_type::For, token_type::In, token_type::Import, token_type::Parallel,
+                   token_type::Eof>;
 
 struct Token : TokenBase {
     using TokenBase::TokenBase;
@@ -78,6 +90,61 @@ struct Token : TokenBase {
     }
 };
 
+namespace detail {
+template <typename T, typename... Ts>
+constexpr uint8_t IndexOfAlternative(const std::variant<Ts...>*) {
+    uint8_t index = 0;
+    const bool found = ((std::is_same_v<T, Ts> ? true : (++index, false)) || ...);
+    return found ? index : std::numeric_limits<uint8_t>::max();
+}
+}  // namespace detail
+
+// Номер вида лексемы T, совпадает с индексом альтернативы в TokenBase
+template <typename T>
+constexpr uint8_t TOKEN_KIND = detail::IndexOfAlternative<T>(static_cast<const TokenBase*>(nullptr));
+
+/*
+Компактное представление лексемы: вид лексемы и 32-битное значение.
+Для Number значение хранит само число, для Char — код символа,
+для Id и String — индекс строки в таблице строк лексера.
+Копирование такой лексемы не выделяет память
+*/
+struct CompactToken {
+    uint8_t kind = TOKEN_KIND<token_type::Eof>;
+    uint32_t payload = 0;
+
+    template <typename T>
+    [[nodiscard]] bool Is() const {
+        return kind == TOKEN_KIND<T>;
+    }
+
+    [[nodiscard]] bool IsChar(char c) const {
+        return Is<token_type::Char>() && static_cast<char>(payload) == c;
+    }
+
+    [[nodiscard]] int AsNumber() const {
+        return static_cast<int>(payload);
+    }
+
+    [[nodiscard]] char AsChar() const {
+        return static_cast<char>(payload);
+    }
+};
+
+static_assert(sizeof(CompactToken) == 8);
+
+// Таблица строк лексера: имена идентификаторов и значения строковых констант
+using TextTable = std::deque<std::string>;
+
+// Записанная последовательность лексем вместе с таблицей строк, на которую ссылаются лексемы.
+// Позволяет разобрать фрагмент программы повторно, не читая исходный текст
+struct TokenSequence {
+    std::shared_ptr<TextTable> texts;
+    std::vector<CompactToken> tokens;
+    // Номера строк, на которых начинаются лексемы
+    std::vector<uint32_t> lines;
+};
+
 bool operator==(const Token& lhs, const Token& rhs);
 bool operator!=(const Token& lhs, const Token& rhs);
 
@@ -90,32 +157,75 @@ public:
 
 class Lexer {
 public:
-    Token ParseIndent();
-    Token ParseConstString();
-    Token LoadId();
-    Token LoadNumberIdKeywordBool();
-    Token GetTokenFromIstream(std::istream& input);
-
     explicit Lexer(std::istream& input);
+    // Создаёт лексер, выдающий записанные лексемы, а после них — Eof
+    explicit Lexer(TokenSequence recorded);
+
+    // Текущая лексема в компактном виде
+    [[nodiscard]] CompactToken Current() const {
+        return current_;
+    }
+
+    // Переходит к следующей лексеме и возвращает её в компактном виде
+    CompactToken Advance();
+
+    // Номер строки программы, на которой начинается текущая лексема. Строки нумеруются с 1
+    [[nodiscard]] uint32_t CurrentLine() const {
+        return current_line_;
+    }
+
+    // Имя идентификатора либо значение строковой константы из таблицы строк лексера
+    [[nodiscard]] const std::string& TextOf(CompactToken token) const;
 
+    // Текущая лексема в виде Token. Строки копируются из таблицы лексера при первом обращении
     [[nodiscard]] const Token& CurrentToken() const;
 
     Token NextToken();
 
+    // Проверяет, что текущая лексема — идентификатор, и возвращает его имя
+    const std::string& ExpectId() const;
+
+    const std::string& ExpectNextId() {
+        Advance();
+        return ExpectId();
+    }
+
+    // Записывает лексемы блока Newline Indent ... Dedent, начиная с текущей лексемы Newline,
+    // и переходит к лексеме, следующей за блоком
+    TokenSequence RecordBlock();
+    // Записывает текущую и все следующие лексемы до конца программы, после чего
+    // текущей становится лексема Eof. Позволяет отделить чтение программы от её разбора
+    TokenSequence RecordAll();
+
     template <typename T>
     const T& Expect() const {
         using namespace std::literals;
-        if (CurrentToken().template Is<T>()) {
+        if (!current_.Is<T>()) {
+            throw LexerError("Expected other token type"s);
+        }
+        if constexpr (std::is_empty_v<T>) {
+            static const T token;
+            return token;
+        } else {
             return CurrentToken().template As<T>();
         }
-        throw LexerError("Expected other token type"s);
     }
 
     template <typename T, typename U>
     void Expect(const U& value) const {
         using namespace std::literals;
-        if (CurrentToken().Is<T>() && CurrentToken() == T({value})) {
-            return;
+        if (current_.Is<T>()) {
+            if constexpr (std::is_same_v<T, token_type::Char>) {
+                if (current_.AsChar() == value) {
+                    return;
+                }
+            } else if constexpr (std::is_same_v<T, token_type::Number>) {
+                if (current_.AsNumber() == value) {
+                    return;
+                }
+            } else if (TextOf(current_) == value) {
+                return;
+            }
         }
         throw LexerError("expected other value or type of current token"s);
     }
@@ -123,34 +233,65 @@ public:
     template <typename T>
     const T& ExpectNext() {
         using namespace std::literals;
-        NextToken();
+        Advance();
         return Expect<T>();
     }
 
     template <typename T, typename U>
     void ExpectNext(const U& value) {
         using namespace std::literals;
-        NextToken();
+        Advance();
         Expect<T>(value);
     }
 
 private:
-    const std::set<std::string> key_words_ = {"return", "class", "if", "else", "def", "print", "or", "None", "True", "False", "and", "not"};
-    std::set<std::string> ids_;
-
-    bool is_new_line = false;
+    // Читает следующую лексему. Пустые строки, комментарии и отступы обрабатываются
+    // в цикле конечного автомата, без рекурсии
+    CompactToken ReadToken();
+    // Считывает отступ в начале строки. Возвращает false, если строка пустая или состоит из комментария
+    bool ReadIndent();
+    CompactToken ReadNumber(char first);
+    CompactToken ReadName(char first);
+    CompactToken ReadString(char quote);
+    CompactToken ReadOperator(char first);
+    void SkipComment();
+    // Возвращает индекс строки text в таблице строк, добавляя её при необходимости
+    uint32_t InternText(std::string_view text);
 
-    std::deque<Token> token_buffer_;
+    // Источник текста программы. Равен nullptr, если лексер выдаёт записанные лексемы
+    std::streambuf* input_ = nullptr;
+    // Записанные лексемы и номер следующей из них
+    std::vector<CompactToken> recorded_;
+    std::vector<uint32_t> recorded_lines_;
+    size_t recorded_pos_ = 0;
 
-    const std::set<char> unexpected_symbols = {':', '(', ',', ')', '.', '#', '+', '<', '=', '*', '\'', '"', '!', '/', '-'};
+    // Номер строки, которую читает лексер, и строки текущей лексемы
+    uint32_t line_ = 1;
+    uint32_t current_line_ = 1;
+    // Прочитан конец строки, завершённой лексемой Newline
+    bool is_line_ended_ = false;
 
-    std::vector<Token> tokens_;
-
-    bool is_need_to_parse_indent_ = false;
-    bool is_token_in_last_line_ = false;
+    // Текущий отступ в пробелах
     size_t indent_ = 0;
+    // Сколько лексем Dedent осталось выдать
+    size_t pending_dedents_ = 0;
+    // Автомат находится в начале строки и должен считать отступ
+    bool at_line_start_ = true;
+    // В текущей строке была хотя бы одна лексема, поэтому в её конце нужен Newline
+    bool line_has_tokens_ = false;
+    // Лексем ещё не было: отступ первой непустой строки не учитывается
+    bool before_first_token_ = true;
+
+    // deque не перемещает строки при росте, поэтому ключи text_ids_ остаются действительными.
+    // Таблица разделяется с записанными последовательностями лексем
+    std::shared_ptr<TextTable> texts_ = std::make_shared<TextTable>();
+    std::unordered_map<std::string_view, uint32_t> text_ids_;
+    // Буфер для считывания имён и строк без выделения памяти на каждую лексему
+    std::string buffer_;
 
-    std::istream& input_;
+    CompactToken current_;
+    // Текущая лексема в виде Token, создаётся по запросу CurrentToken
+    mutable std::optional<Token> current_token_;
 };
 
 }  // namespace parse
\ No newline at end of file
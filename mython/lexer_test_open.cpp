@@ -40,6 +40,19 @@ namespace parse {
             ASSERT_EQUAL(lexer.NextToken(), Token(token_type::False{}));
         }
 
+        void TestLoopKeywords() {
+            istringstream input("while for in range While import parallel"s);
+            Lexer lexer(input);
+
+            ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::While{}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::For{}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::In{}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Id{"range"s}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Id{"While"s}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Import{}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Parallel{}));
+        }
+
         void TestNumbers() {
             istringstream input("42 15 -53"s);
             Lexer lexer(input);
@@ -351,11 +364,51 @@ abc#
                 ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Eof{}));
             }
         }
+        void TestManyEmptyAndCommentLines() {
+            // Пустые строки и комментарии пропускаются в цикле, глубина рекурсии от их числа не зависит
+            string text = "x\n"s;
+            for (int i = 0; i < 200000; ++i) {
+                text += (i % 2 == 0) ? "# comment\n"s : "   \n"s;
+            }
+            text += "    # indented comment\ny\n"s;
+            istringstream is(text);
+            Lexer lexer(is);
+
+            ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Id{"x"s}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Newline{}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Id{"y"s}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Newline{}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Eof{}));
+        }
+        void TestCompactTokens() {
+            istringstream is("x y x 'x' 42 +"s);
+            Lexer lexer(is);
+
+            const CompactToken first = lexer.Current();
+            ASSERT(first.Is<token_type::Id>());
+            ASSERT_EQUAL(lexer.TextOf(first), "x"s);
+            ASSERT_EQUAL(lexer.ExpectNextId(), "y"s);
+
+            // Одинаковые имена хранятся в таблице строк лексера один раз
+            const CompactToken second_x = lexer.Advance();
+            ASSERT_EQUAL(&lexer.TextOf(second_x), &lexer.TextOf(first));
+
+            const CompactToken str = lexer.Advance();
+            ASSERT(str.Is<token_type::String>());
+            ASSERT_EQUAL(lexer.TextOf(str), "x"s);
+            ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::String{"x"s}));
+
+            ASSERT_EQUAL(lexer.Advance().AsNumber(), 42);
+            ASSERT(lexer.Advance().IsChar('+'));
+            ASSERT(lexer.Advance().Is<token_type::Newline>());
+            ASSERT(lexer.Advance().Is<token_type::Eof>());
+        }
     }  // namespace
 
     void RunOpenLexerTests(TestRunner& tr) {
         RUN_TEST(tr, parse::TestSimpleAssignment);
         RUN_TEST(tr, parse::TestKeywords);
+        RUN_TEST(tr, parse::TestLoopKeywords);
         RUN_TEST(tr, parse::TestNumbers);
         RUN_TEST(tr, parse::TestIds);
         RUN_TEST(tr, parse::TestStrings);
@@ -367,6 +420,8 @@ abc#
         RUN_TEST(tr, parse::TestMythonProgram);
         RUN_TEST(tr, parse::TestAlwaysEmitsNewlineAtTheEndOfNonemptyLine);
         RUN_TEST(tr, parse::TestCommentsAreIgnored);
+        RUN_TEST(tr, parse::TestManyEmptyAndCommentLines);
+        RUN_TEST(tr, parse::TestCompactTokens);
     }
 
 }  // namespace parse
\ No newline at end of file
@@ -1,10 +1,28 @@
+#include "actor.h"
+#include "batch.h"
+#include "budget.h"
+#include "call_stack.h"
 #include "lexer.h"
+#include "module.h"
 #include "parse.h"
+#include "profiler.h"
 #include "runtime.h"
+#include "scheduler.h"
+#include "server.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
 #include "statement.h"
+#include "test_program_p.h"
 #include "test_runner_p.h"
 
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <thread>
 
 using namespace std;
 
@@ -18,19 +36,314 @@ namespace ast {
 namespace runtime {
     void RunObjectHolderTests(TestRunner& tr);
     void RunObjectsTests(TestRunner& tr);
+    void RunMemoryPoolTests(TestRunner& tr);
+    void RunSchedulerTests(TestRunner& tr);
+    void RunActorTests(TestRunner& tr);
+    void RunBudgetTests(TestRunner& tr);
+    void RunProfilerTests(TestRunner& tr);
+    void RunStatsTests(TestRunner& tr);
+    void RunTraceTests(TestRunner& tr);
 }  // namespace runtime
 
 void TestParseProgram(TestRunner& tr);
+void RunModuleTests(TestRunner& tr);
+void RunServerTests(TestRunner& tr);
+void RunSnapshotTests(TestRunner& tr);
+void RunBatchTests(TestRunner& tr);
 
 namespace {
 
-    void RunMythonProgram(istream& input, ostream& output) {
+    // Настройки запуска программы
+    struct RunOptions {
+        ParseOptions parse;
+        // Запоминать ли результаты чистых методов (--memoize). Как и другие настройки,
+        // общие для всего процесса, применяется после самопроверки: тесты рассчитывают
+        // на значения по умолчанию
+        bool memoize = false;
+        // Максимальная глубина вызовов методов (--max-call-depth)
+        std::optional<size_t> max_call_depth;
+        // Наибольшее число результатов, запоминаемых для метода (--memo-limit)
+        std::optional<size_t> memo_limit;
+        // Выводить ли в cerr статистику запомненных результатов методов
+        bool print_memo_stats = false;
+        // Выводить ли в cerr статистику выполнения (--stats)
+        bool print_stats = false;
+        // Каталоги поиска модулей. Если не заданы, модули ищутся в текущем каталоге
+        std::vector<std::filesystem::path> module_paths;
+        // Сокет, на котором программа работает как сервер (--serve),
+        // либо сокет сервера, которому отправляется программа (--connect)
+        std::filesystem::path serve_socket;
+        std::filesystem::path connect_socket;
+        // Число потоков и размер кэша программ сервера, время на получение программы
+        size_t server_threads = 4;
+        size_t server_cache_size = 64;
+        std::chrono::milliseconds server_receive_timeout{10000};
+        // Снимок, состояние из которого восстанавливается перед выполнением программы
+        std::filesystem::path snapshot;
+        // Файл, в который записывается снимок состояния программы после её выполнения
+        std::filesystem::path save_snapshot;
+        // Сценарии, выполняемые пакетом вместо программы из cin, и число потоков для них
+        std::vector<std::filesystem::path> scripts;
+        size_t jobs = std::max(std::thread::hardware_concurrency(), 1U);
+        // Выполнять сценарии пакета зелёными потоками с квантом green_slice точек приостановки
+        bool green_threads = false;
+        size_t green_slice = runtime::GreenScheduler::DEFAULT_SLICE;
+        // Число сообщений для замера пропускной способности акторов (--actor-bench)
+        size_t actor_bench_messages = 0;
+        // Размер строки в байтах для замера сложения строк (--bench-concat)
+        size_t concat_bench_bytes = 0;
+        // Число операндов выражений для замера скорости разбора (--bench-parse)
+        size_t parse_bench_terms = 0;
+        // Ограничения выполнения программы, каждого сценария пакета и каждого запроса к серверу
+        runtime::ExecutionBudget budget;
+        // Файл свёрнутых стеков профилировщика (--profile), период выборок
+        // и число методов в таблице, которая выводится в cerr
+        std::filesystem::path profile;
+        std::chrono::microseconds profile_interval = runtime::SamplingProfiler::DEFAULT_INTERVAL;
+        size_t profile_top = 20;
+        // Файл трассы выполнения в формате Trace Event (--trace) и настройки её записи
+        std::filesystem::path trace;
+        runtime::TraceOptions trace_options;
+    };
+
+    // Замеряет пропускную способность акторов: messages сообщений раздаются по кругу
+    // 1, 2, 4, ..., 32 акторам, после чего программа дожидается их обработки всеми акторами
+    void RunActorBenchmark(size_t messages, ostream& report) {
+        istringstream input(R"(
+class Sink:
+  def __init__():
+    self.total = 0
+
+  def take(n):
+    self.total = self.total + n
+
+  def total():
+    return self.total
+)"s);
         parse::Lexer lexer(input);
-        auto program = ParseProgram(lexer);
+        ClassTable classes;
+        // Дерево программы владеет классом Sink
+        const auto program = ParseProgram(lexer, {}, classes);
+        runtime::Class& sink = *classes.at("Sink"s);
+        runtime::DummyContext context;
+        const string take = "take"s;
+        const string total = "total"s;
+        const auto one = runtime::ObjectHolder::Own(runtime::Number(1));
+
+        for (size_t actor_count = 1; actor_count <= 32; actor_count *= 2) {
+            vector<runtime::Actor> actors;
+            actors.reserve(actor_count);
+            for (size_t i = 0; i < actor_count; ++i) {
+                actors.emplace_back(sink, runtime::ArgumentSpan{}, context);
+            }
+            const auto start = chrono::steady_clock::now();
+            for (size_t i = 0; i < messages; ++i) {
+                actors[i % actor_count].Send(take, {one}, context);
+            }
+            size_t processed = 0;
+            for (auto& actor : actors) {
+                processed += actor.Ask(total, {}, context).TryAs<runtime::Number>()->GetValue();
+            }
+            const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            report << actor_count << " actors: "sv << processed << " messages in "sv
+                   << static_cast<int64_t>(elapsed.count() * 1000) << " ms, "sv
+                   << static_cast<int64_t>(static_cast<double>(processed) / elapsed.count())
+                   << " messages/s"sv << endl;
+        }
+    }
 
-        runtime::SimpleContext context{output};
+    // Замеряет сборку строки размером около bytes байт сложением по 100 байт
+    // и последующее сравнение, которому нужно её содержимое целиком
+    void RunConcatBenchmark(size_t bytes, ostream& report) {
+        constexpr size_t CHUNK_SIZE = 100;
+        const size_t chunks = max<size_t>(bytes / CHUNK_SIZE, 1);
+        const string chunk(CHUNK_SIZE, 'a');
+        const auto build = ParseProgramFromString(
+            "s = ''\ni = 0\nwhile i < "s + to_string(chunks) + ":\n  s = s + '"s + chunk
+            + "'\n  i = i + 1\n"s);
+        const auto compare = ParseProgramFromString("x = s < 'b'\n"s);
+        runtime::DummyContext context;
         runtime::Closure closure;
-        program->Execute(closure, context);
+
+        const auto start = chrono::steady_clock::now();
+        build->Execute(closure, context);
+        const auto built = chrono::steady_clock::now();
+        compare->Execute(closure, context);
+        const auto compared = chrono::steady_clock::now();
+
+        const auto to_ms = [](chrono::steady_clock::duration duration) {
+            return chrono::duration_cast<chrono::milliseconds>(duration).count();
+        };
+        const size_t total = chunks * CHUNK_SIZE;
+        const chrono::duration<double> elapsed = compared - start;
+        report << total << " bytes in "sv << chunks << " additions: built in "sv
+               << to_ms(built - start) << " ms, compared in "sv << to_ms(compared - built) << " ms, "sv
+               << static_cast<int64_t>(static_cast<double>(total) / elapsed.count() / (1 << 20))
+               << " MB/s"sv << endl;
+    }
+
+    // Замеряет разбор выражений из terms операндов: длинной суммы, суммы произведений
+    // и операнда в terms вложенных скобках. Оптимизация отключена, чтобы замерялся только разбор,
+    // а время разрушения дерева не учитывается
+    void RunParseBenchmark(size_t terms, ostream& report) {
+        terms = max<size_t>(terms, 1);
+        string sum = "x = 1"s;
+        string mixed = "x = 1"s;
+        for (size_t i = 1; i < terms; ++i) {
+            sum += " + 1"s;
+            mixed += i % 2 == 0 ? " + 2"s : " * 3"s;
+        }
+        const vector<pair<string_view, string>> sources = {
+            {"sum"sv, std::move(sum)},
+            {"mixed"sv, std::move(mixed)},
+            {"parens"sv, "x = "s + string(terms, '(') + "1"s + string(terms, ')')}};
+
+        for (const auto& [name, source] : sources) {
+            istringstream input(source + "\n"s);
+            const auto start = chrono::steady_clock::now();
+            parse::Lexer lexer(input);
+            auto tree = ParseProgram(lexer, ParseOptions{false});
+            const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            report << name << ": "sv << terms << " terms, "sv << source.size() << " bytes in "sv
+                   << static_cast<int64_t>(elapsed.count() * 1000) << " ms, "sv
+                   << static_cast<int64_t>(static_cast<double>(terms) / elapsed.count())
+                   << " terms/s"sv << endl;
+        }
+    }
+
+    // Выводит статистику запомненных результатов методов всех классов из closure
+    void PrintMemoStats(const runtime::Closure& closure, const runtime::MemoCache& memo,
+                        ostream& out) {
+        for (const auto& [name, value] : closure) {
+            auto* cls = value.TryAs<runtime::Class>();
+            if (cls == nullptr) {
+                continue;
+            }
+            for (const auto& [method, stats] : memo.GetStats(*cls)) {
+                out << name << '.' << method << ": hits "sv << stats.hits << ", misses "sv
+                    << stats.misses << ", entries "sv << stats.entries << endl;
+            }
+        }
+    }
+
+    // Собирает статистику выполнения от создания до удаления и выводит её в cerr
+    class StatsReport {
+    public:
+        explicit StatsReport(bool is_enabled)
+            : is_enabled_(is_enabled) {
+            if (is_enabled_) {
+                runtime::ResetStats();
+            }
+        }
+
+        ~StatsReport() {
+            if (is_enabled_) {
+                runtime::PrintStats(runtime::GetStats(), cerr);
+            }
+        }
+
+        StatsReport(const StatsReport&) = delete;
+        StatsReport& operator=(const StatsReport&) = delete;
+
+    private:
+        bool is_enabled_;
+    };
+
+    // Останавливает профилировщик и выводит свёрнутые стеки в файл, а таблицу методов — в cerr
+    void WriteProfile(runtime::SamplingProfiler& profiler, const RunOptions& options) {
+        profiler.Stop();
+        ofstream out(options.profile);
+        if (!out) {
+            throw runtime_error("Can't write the profile to "s + options.profile.string());
+        }
+        profiler.WriteCollapsedStacks(out);
+        profiler.WriteTopTable(cerr, options.profile_top);
+    }
+
+    // Прекращает запись трассы и выводит её в файл
+    void WriteTrace(runtime::TraceRecorder& trace, const RunOptions& options) {
+        trace.Stop();
+        ofstream out(options.trace);
+        if (!out) {
+            throw runtime_error("Can't write the trace to "s + options.trace.string());
+        }
+        trace.WriteJson(out);
+    }
+
+    void RunMythonProgram(istream& input, ostream& output, const RunOptions& options = {}) {
+        ModuleLoader modules(options.module_paths.empty() ? vector<filesystem::path>{"."s}
+                                                          : options.module_paths,
+                             options.parse);
+
+        // Программа выполняется в глобальных именах из снимка, и ей видны его классы
+        RestoredSnapshot snapshot;
+        if (!options.snapshot.empty()) {
+            snapshot = LoadSnapshotFile(options.snapshot, options.parse);
+        }
+
+        // Для записи снимка нужен текст программы
+        string source;
+        istringstream source_input;
+        istream* program_input = &input;
+        if (!options.save_snapshot.empty()) {
+            source.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+            source_input.str(source);
+            program_input = &source_input;
+        }
+
+        optional<runtime::TraceRecorder> trace;
+        if (!options.trace.empty()) {
+            trace.emplace(options.trace_options);
+            trace->Start();
+        }
+
+        parse::Lexer lexer(*program_input);
+        // При записи трассы программа сначала читается целиком, чтобы чтение и разбор
+        // были отдельными отрезками. Иначе лексемы читаются по мере разбора
+        optional<parse::Lexer> recorded;
+        if (trace) {
+            runtime::TraceSpan span("lex");
+            recorded.emplace(lexer.RecordAll());
+        }
+        unique_ptr<runtime::Executable> program;
+        {
+            runtime::TraceSpan span("parse");
+            program = ParseProgram(recorded ? *recorded : lexer, options.parse, snapshot.classes);
+        }
+
+        runtime::SimpleContext context{output, &modules};
+        runtime::Closure closure = std::move(snapshot.globals);
+        // Имена методов в выборках и трассе определяются при остановке записи,
+        // поэтому она останавливается, пока дерево программы существует
+        optional<runtime::SamplingProfiler> profiler;
+        if (!options.profile.empty()) {
+            profiler.emplace(options.profile_interval);
+            profiler->Start();
+        }
+        const auto write_diagnostics = [&] {
+            if (profiler) {
+                WriteProfile(*profiler, options);
+            }
+            if (trace) {
+                WriteTrace(*trace, options);
+            }
+        };
+        try {
+            runtime::BudgetScope budget(options.budget);
+            runtime::TraceSpan span("execute");
+            program->Execute(closure, context);
+        } catch (...) {
+            write_diagnostics();
+            throw;
+        }
+        write_diagnostics();
+
+        if (!options.save_snapshot.empty()) {
+            SaveSnapshotFile(options.save_snapshot, source, snapshot.classes, closure);
+        }
+        if (options.print_memo_stats) {
+            PrintMemoStats(closure, *context.GetMemoCache(), cerr);
+        }
     }
 
     void TestSimplePrints() {
@@ -116,8 +429,19 @@ print y.value
         parse::RunOpenLexerTests(tr);
         runtime::RunObjectHolderTests(tr);
         runtime::RunObjectsTests(tr);
+        runtime::RunMemoryPoolTests(tr);
         ast::RunUnitTests(tr);
         TestParseProgram(tr);
+        RunModuleTests(tr);
+        RunServerTests(tr);
+        RunSnapshotTests(tr);
+        RunBatchTests(tr);
+        runtime::RunSchedulerTests(tr);
+        runtime::RunActorTests(tr);
+        runtime::RunBudgetTests(tr);
+        runtime::RunProfilerTests(tr);
+        runtime::RunStatsTests(tr);
+        runtime::RunTraceTests(tr);
 
         RUN_TEST(tr, TestSimplePrints);
         RUN_TEST(tr, TestAssignments);
@@ -127,11 +451,138 @@ print y.value
 
 }  // namespace
 
-int main() {
+int main(int argc, char* argv[]) {
     try {
-        TestAll();
+        RunOptions options;
+        for (int i = 1; i < argc; ++i) {
+            if (argv[i] == "--no-optimize"sv) {
+                options.parse.optimize = false;
+            } else if (argv[i] == "--lazy-methods"sv) {
+                options.parse.lazy_methods = true;
+            } else if (argv[i] == "--max-call-depth"sv && i + 1 < argc) {
+                options.max_call_depth = std::stoul(argv[++i]);
+            } else if (argv[i] == "--memoize"sv) {
+                options.memoize = true;
+            } else if (argv[i] == "--memo-limit"sv && i + 1 < argc) {
+                options.memo_limit = std::stoul(argv[++i]);
+            } else if (argv[i] == "--module-path"sv && i + 1 < argc) {
+                options.module_paths.emplace_back(argv[++i]);
+            } else if (argv[i] == "--serve"sv && i + 1 < argc) {
+                options.serve_socket = argv[++i];
+            } else if (argv[i] == "--connect"sv && i + 1 < argc) {
+                options.connect_socket = argv[++i];
+            } else if (argv[i] == "--threads"sv && i + 1 < argc) {
+                options.server_threads = std::stoul(argv[++i]);
+            } else if (argv[i] == "--cache-size"sv && i + 1 < argc) {
+                options.server_cache_size = std::stoul(argv[++i]);
+            } else if (argv[i] == "--receive-timeout-ms"sv && i + 1 < argc) {
+                options.server_receive_timeout = chrono::milliseconds(std::stoul(argv[++i]));
+            } else if (argv[i] == "--snapshot"sv && i + 1 < argc) {
+                options.snapshot = argv[++i];
+            } else if (argv[i] == "--save-snapshot"sv && i + 1 < argc) {
+                options.save_snapshot = argv[++i];
+            } else if (argv[i] == "--memo-stats"sv) {
+                options.print_memo_stats = true;
+            } else if (argv[i] == "--stats"sv) {
+                options.print_stats = true;
+            } else if (argv[i] == "--jobs"sv && i + 1 < argc) {
+                options.jobs = std::stoul(argv[++i]);
+            } else if (argv[i] == "--green"sv) {
+                options.green_threads = true;
+            } else if (argv[i] == "--slice"sv && i + 1 < argc) {
+                options.green_slice = std::stoul(argv[++i]);
+            } else if (argv[i] == "--parallel-threads"sv && i + 1 < argc) {
+                ast::ParallelFor::SetThreadCount(std::stoul(argv[++i]));
+            } else if (argv[i] == "--budget-steps"sv && i + 1 < argc) {
+                options.budget.max_steps = std::stoull(argv[++i]);
+            } else if (argv[i] == "--budget-call-depth"sv && i + 1 < argc) {
+                options.budget.max_call_depth = std::stoul(argv[++i]);
+            } else if (argv[i] == "--budget-time-ms"sv && i + 1 < argc) {
+                options.budget.max_wall_time = chrono::milliseconds(std::stoul(argv[++i]));
+            } else if (argv[i] == "--budget-heap"sv && i + 1 < argc) {
+                options.budget.max_heap_bytes = std::stoull(argv[++i]);
+            } else if (argv[i] == "--profile"sv && i + 1 < argc) {
+                options.profile = argv[++i];
+            } else if (argv[i] == "--profile-interval"sv && i + 1 < argc) {
+                options.profile_interval = chrono::microseconds(std::stoul(argv[++i]));
+            } else if (argv[i] == "--profile-top"sv && i + 1 < argc) {
+                options.profile_top = std::stoul(argv[++i]);
+            } else if (argv[i] == "--trace"sv && i + 1 < argc) {
+                options.trace = argv[++i];
+            } else if (argv[i] == "--trace-sample"sv && i + 1 < argc) {
+                options.trace_options.call_sample_rate = std::stoul(argv[++i]);
+            } else if (argv[i] == "--trace-depth"sv && i + 1 < argc) {
+                options.trace_options.max_call_depth = std::stoul(argv[++i]);
+            } else if (argv[i] == "--actor-bench"sv && i + 1 < argc) {
+                options.actor_bench_messages = std::stoul(argv[++i]);
+            } else if (argv[i] == "--bench-concat"sv && i + 1 < argc) {
+                options.concat_bench_bytes = std::stoul(argv[++i]);
+            } else if (argv[i] == "--bench-parse"sv && i + 1 < argc) {
+                options.parse_bench_terms = std::stoul(argv[++i]);
+            } else if (argv[i][0] != '-') {
+                options.scripts.emplace_back(argv[i]);
+            } else {
+                throw std::invalid_argument("Unknown option "s + argv[i]);
+            }
+        }
+
+        // Клиент только пересылает программу серверу, поэтому не тратит время на тесты
+        if (!options.connect_socket.empty()) {
+            return RunOnServer(options.connect_socket, cin, cout, cerr);
+        }
+
+        if (!options.snapshot.empty() && !options.save_snapshot.empty()) {
+            throw std::invalid_argument("--snapshot and --save-snapshot can't be used together"s);
+        }
+        if ((!options.profile.empty() || !options.trace.empty())
+            && (!options.scripts.empty() || !options.serve_socket.empty())) {
+            throw std::invalid_argument("--profile and --trace can only be used with a single program"s);
+        }
 
-        RunMythonProgram(cin, cout);
+        TestAll();
+        if (options.max_call_depth) {
+            runtime::SetMaxCallDepth(*options.max_call_depth);
+        }
+        if (options.memoize) {
+            runtime::SetMemoizationEnabled(true);
+        }
+        if (options.memo_limit) {
+            runtime::SetMemoTableLimit(*options.memo_limit);
+        }
+        StatsReport stats_report(options.print_stats);
+
+        if (!options.serve_socket.empty()) {
+            Server server({options.serve_socket, options.server_threads, options.server_cache_size,
+                           options.parse, options.module_paths, options.budget,
+                           options.server_receive_timeout});
+            server.Start();
+            server.Wait();
+            return 0;
+        }
+
+        if (options.actor_bench_messages > 0) {
+            RunActorBenchmark(options.actor_bench_messages, cout);
+            return 0;
+        }
+        if (options.concat_bench_bytes > 0) {
+            RunConcatBenchmark(options.concat_bench_bytes, cout);
+            return 0;
+        }
+        if (options.parse_bench_terms > 0) {
+            RunParseBenchmark(options.parse_bench_terms, cout);
+            return 0;
+        }
+
+        if (!options.scripts.empty()) {
+            const size_t failed = RunBatch(options.scripts,
+                                           {options.jobs, options.green_threads,
+                                            options.green_slice, options.parse,
+                                            options.module_paths, options.budget},
+                                           cout, cerr);
+            return failed == 0 ? 0 : 1;
+        }
+
+        RunMythonProgram(cin, cout, options);
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return 1;
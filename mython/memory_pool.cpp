@@ -0,0 +1,140 @@
+#include "memory_pool.h"
+
+#include <new>
+#include <vector>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+// Блоки выделяются с шагом в GRANULARITY байт, для каждого шага - свой список свободных блоков
+constexpr size_t GRANULARITY = alignof(max_align_t);
+constexpr size_t SIZE_CLASS_COUNT = detail::MAX_POOLED_BLOCK_SIZE / GRANULARITY;
+// Сколько байт может храниться в одном списке свободных блоков. Блоки, выделенные одним потоком,
+// а освобождённые другим, не возвращаются выделившему их потоку, поэтому без предела
+// пул освобождающего потока рос бы без ограничений
+constexpr size_t MAX_FREE_LIST_BYTES = 256 * 1024;
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// Устанавливается, когда пул потока уже уничтожен, а другие thread_local объекты
+// ещё освобождают память
+thread_local bool thread_pool_destroyed = false;
+
+thread_local size_t system_allocation_count = 0;
+
+// Пул блоков потока. При завершении потока свободные блоки возвращаются системе,
+// как и блоки, не поместившиеся в заполненный список свободных блоков
+class ThreadPool {
+public:
+    ThreadPool() = default;
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        thread_pool_destroyed = true;
+        for (FreeBlock* head : free_lists_) {
+            while (head != nullptr) {
+                FreeBlock* next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+
+    static void* AllocateNew(size_t size) {
+        detail::CountSystemAllocation();
+        return ::operator new(BlockSize(SizeClass(size)));
+    }
+
+    void* Allocate(size_t size) {
+        FreeBlock*& head = free_lists_[SizeClass(size)];
+        if (head == nullptr) {
+            return AllocateNew(size);
+        }
+        FreeBlock* block = head;
+        head = block->next;
+        --free_counts_[SizeClass(size)];
+        return block;
+    }
+
+    void Deallocate(void* block, size_t size) {
+        const size_t size_class = SizeClass(size);
+        if (free_counts_[size_class] >= MAX_FREE_LIST_BYTES / BlockSize(size_class)) {
+            ::operator delete(block);
+            return;
+        }
+        FreeBlock*& head = free_lists_[size_class];
+        head = new (block) FreeBlock{head};
+        ++free_counts_[size_class];
+    }
+
+    [[nodiscard]] size_t GetFreeBytes() const {
+        size_t bytes = 0;
+        for (size_t size_class = 0; size_class < SIZE_CLASS_COUNT; ++size_class) {
+            bytes += free_counts_[size_class] * BlockSize(size_class);
+        }
+        return bytes;
+    }
+
+private:
+    static size_t SizeClass(size_t size) {
+        return (size + GRANULARITY - 1) / GRANULARITY - 1;
+    }
+
+    static size_t BlockSize(size_t size_class) {
+        return (size_class + 1) * GRANULARITY;
+    }
+
+    FreeBlock* free_lists_[SIZE_CLASS_COUNT] = {};
+    size_t free_counts_[SIZE_CLASS_COUNT] = {};
+};
+
+// Возвращает пул текущего потока либо nullptr, если поток уже завершается
+ThreadPool* GetThreadPool() {
+    if (thread_pool_destroyed) {
+        return nullptr;
+    }
+    thread_local ThreadPool pool;
+    return &pool;
+}
+
+}  // namespace
+
+namespace detail {
+
+void* PoolAllocate(size_t size) {
+    if (ThreadPool* pool = GetThreadPool()) {
+        return pool->Allocate(size);
+    }
+    return ThreadPool::AllocateNew(size);
+}
+
+void PoolDeallocate(void* block, size_t size) {
+    if (ThreadPool* pool = GetThreadPool()) {
+        pool->Deallocate(block, size);
+    } else {
+        ::operator delete(block);
+    }
+}
+
+void CountSystemAllocation() {
+    ++system_allocation_count;
+}
+
+size_t GetSystemAllocationCount() {
+    return system_allocation_count;
+}
+
+size_t GetPooledFreeBytes() {
+    const ThreadPool* pool = GetThreadPool();
+    return pool != nullptr ? pool->GetFreeBytes() : 0;
+}
+
+}  // namespace detail
+
+}  // namespace runtime
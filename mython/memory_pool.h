@@ -0,0 +1,82 @@
+#pragma once
+
+#include "budget.h"
+
+#include <cstddef>
+#include <memory>
+
+namespace runtime {
+
+namespace detail {
+// Наибольший размер блока, который выделяется из пула
+inline constexpr size_t MAX_POOLED_BLOCK_SIZE = 256;
+
+// Выделяет блок размером size (не больше MAX_POOLED_BLOCK_SIZE) из пула текущего потока
+void* PoolAllocate(size_t size);
+// Возвращает блок размером size в пул текущего потока
+void PoolDeallocate(void* block, size_t size);
+
+// Учитывает память, которую распределитель PoolAllocator запросил у системы в текущем потоке
+void CountSystemAllocation();
+// Возвращает, сколько раз распределители PoolAllocator текущего потока обращались к системе:
+// пополняли пул или выделяли массив либо крупный объект
+[[nodiscard]] size_t GetSystemAllocationCount();
+// Возвращает, сколько байт занимают свободные блоки в пуле текущего потока
+[[nodiscard]] size_t GetPooledFreeBytes();
+}  // namespace detail
+
+/*
+Распределитель памяти для одиночных объектов небольшого размера.
+Освобождённые блоки не возвращаются системе, а хранятся в пуле освободившего их потока
+и выдаются повторно, поэтому после разогрева узлы контейнеров создаются без обращения к malloc.
+Пул потока хранит ограниченное число свободных блоков, а лишние возвращает системе.
+Массивы и крупные объекты выделяются обычным образом.
+Все выделенные блоки учитываются в памяти, занятой потоком (см. BudgetScope)
+*/
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& /*other*/) {  // NOLINT(google-explicit-constructor)
+    }
+
+    T* allocate(size_t n) {
+        detail::ChargeHeap(sizeof(T) * n);
+        if (IsPooled(n)) {
+            return static_cast<T*>(detail::PoolAllocate(sizeof(T)));
+        }
+        detail::CountSystemAllocation();
+        return std::allocator<T>{}.allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        detail::ReleaseHeap(sizeof(T) * n);
+        if (IsPooled(n)) {
+            detail::PoolDeallocate(p, sizeof(T));
+        } else {
+            std::allocator<T>{}.deallocate(p, n);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& /*other*/) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& /*other*/) const {
+        return false;
+    }
+
+private:
+    static bool IsPooled(size_t n) {
+        return n == 1 && sizeof(T) <= detail::MAX_POOLED_BLOCK_SIZE
+               && alignof(T) <= alignof(std::max_align_t);
+    }
+};
+
+}  // namespace runtime
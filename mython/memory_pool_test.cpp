@@ -0,0 +1,147 @@
+#include "memory_pool.h"
+
+#include "runtime.h"
+#include "small_vector.h"
+#include "statement.h"
+#include "test_program_p.h"
+#include "test_runner_p.h"
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+// Возвращает true, если элементы хранятся внутри самого объекта v
+template <typename T, size_t N>
+bool IsStoredInline(const SmallVector<T, N>& v) {
+    const auto* data = reinterpret_cast<const char*>(v.data());
+    const auto* object = reinterpret_cast<const char*>(&v);
+    return data >= object && data < object + sizeof(v);
+}
+
+void TestSmallVector() {
+    SmallVector<string, 2> v;
+    ASSERT(v.empty());
+    v.push_back("a"s);
+    v.push_back("b"s);
+    ASSERT(IsStoredInline(v));
+    v.push_back("c"s);
+    ASSERT(!IsStoredInline(v));
+    ASSERT_EQUAL(vector<string>(v.begin(), v.end()), (vector<string>{"a"s, "b"s, "c"s}));
+
+    // Перемещённая последовательность пуста, и её можно заполнять снова
+    SmallVector<string, 2> moved(std::move(v));
+    ASSERT_EQUAL(moved.size(), 3U);
+    ASSERT_EQUAL(moved[2], "c"s);
+    ASSERT(v.empty());
+    ASSERT(v.begin() == v.end());
+    v.push_back("d"s);
+    ASSERT(IsStoredInline(v));
+    ASSERT_EQUAL(v[0], "d"s);
+
+    SmallVector<string, 2> assigned;
+    assigned.push_back("x"s);
+    assigned = std::move(v);
+    ASSERT_EQUAL(assigned.size(), 1U);
+    ASSERT_EQUAL(assigned[0], "d"s);
+    ASSERT(v.empty());
+    moved = std::move(assigned);
+    ASSERT_EQUAL(moved.size(), 1U);
+    ASSERT(IsStoredInline(moved));
+
+    SmallVector<string, 2> copy = moved;
+    copy.clear();
+    ASSERT(copy.empty());
+    ASSERT_EQUAL(moved[0], "d"s);
+}
+
+void TestPoolAllocator() {
+    PoolAllocator<string> allocator;
+    // Освобождённый блок выдаётся повторно тем же потоком без обращения к системе
+    string* first = allocator.allocate(1);
+    allocator.deallocate(first, 1);
+    const size_t system_allocations = detail::GetSystemAllocationCount();
+    string* second = allocator.allocate(1);
+    ASSERT_EQUAL(second, first);
+    ASSERT_EQUAL(detail::GetSystemAllocationCount(), system_allocations);
+
+    // Блок, освобождённый другим потоком, попадает в пул этого потока
+    string* reused = nullptr;
+    thread worker([&] {
+        PoolAllocator<string> worker_allocator;
+        worker_allocator.deallocate(second, 1);
+        reused = worker_allocator.allocate(1);
+        worker_allocator.deallocate(reused, 1);
+    });
+    worker.join();
+    ASSERT_EQUAL(reused, second);
+
+    // Массивы выделяются системой
+    string* array = allocator.allocate(3);
+    ASSERT_EQUAL(detail::GetSystemAllocationCount(), system_allocations + 1);
+    allocator.deallocate(array, 3);
+
+    // Пул потока, освобождающего блоки, выделенные другим потоком, не растёт без предела
+    vector<string*> blocks(100000);
+    for (auto& block : blocks) {
+        block = allocator.allocate(1);
+    }
+    size_t worker_free_bytes = 0;
+    thread releasing([&] {
+        PoolAllocator<string> worker_allocator;
+        for (auto* block : blocks) {
+            worker_allocator.deallocate(block, 1);
+        }
+        worker_free_bytes = detail::GetPooledFreeBytes();
+    });
+    releasing.join();
+    ASSERT(worker_free_bytes > 0);
+    ASSERT(worker_free_bytes < blocks.size() * sizeof(string) / 4);
+}
+
+void TestCallsWithoutAllocations() {
+    auto tree = ParseProgramFromString(R"--(
+class Adder:
+  def add(a, b):
+    return a + b
+
+adder = Adder()
+)--"s);
+    DummyContext context;
+    Closure closure;
+    tree->Execute(closure, context);
+    auto* adder = closure.at("adder"s).TryAs<ClassInstance>();
+
+    const ObjectHolder one = ObjectHolder::Own(Number{1});
+    ArgumentList args;
+    args.push_back(one);
+    args.push_back(one);
+    ASSERT(IsStoredInline(args));
+    ArgumentSpan span(args);
+    ASSERT_EQUAL(span.size(), 2U);
+    ASSERT_EQUAL(span[1].Get(), one.Get());
+
+    // После первого вызова кадры, узлы таблиц символов и объекты берутся из пулов потока
+    ASSERT_EQUAL(adder->Call("add"s, args, context).TryAs<Number>()->GetValue(), 2);
+    const size_t system_allocations = detail::GetSystemAllocationCount();
+    for (int i = 0; i < 1000; ++i) {
+        adder->Call("add"s, args, context);
+    }
+    ASSERT_EQUAL(detail::GetSystemAllocationCount(), system_allocations);
+}
+
+}  // namespace
+
+void RunMemoryPoolTests(TestRunner& tr) {
+    RUN_TEST(tr, TestSmallVector);
+    RUN_TEST(tr, TestPoolAllocator);
+    RUN_TEST(tr, TestCallsWithoutAllocations);
+}
+
+}  // namespace runtime
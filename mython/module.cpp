@@ -0,0 +1,58 @@
+#include "module.h"
+
+#include "lexer.h"
+
+#include <fstream>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+ModuleLoader::ModuleLoader(std::vector<fs::path> search_paths, const ParseOptions& options)
+    : search_paths_(std::move(search_paths))
+    , options_(options) {
+}
+
+runtime::ObjectHolder ModuleLoader::Import(const std::string& name, runtime::Context& context) {
+    lock_guard lock(mutex_);
+    if (auto it = modules_.find(name); it != modules_.end()) {
+        if (it->second.is_loading) {
+            runtime::Throw(runtime_error("Circular import of module "s + name));
+        }
+        return it->second.module;
+    }
+
+    Entry& entry = modules_[name];
+    entry.is_loading = true;
+    try {
+        ifstream input(FindSource(name), ios::binary);
+        parse::Lexer lexer(input);
+        entry.program = ParseProgram(lexer, options_);
+        ++parsed_count_;
+
+        entry.module = runtime::ObjectHolder::Own(runtime::Module(name));
+        entry.program->Execute(entry.module.TryAs<runtime::Module>()->Names(), context);
+    } catch (...) {
+        // Объекты частично выполненного модуля могли остаться доступными из других модулей,
+        // поэтому его программа сохраняется, а следующий import загрузит модуль заново
+        failed_programs_.push_back(std::move(entry.program));
+        modules_.erase(name);
+        throw;
+    }
+    entry.is_loading = false;
+    return entry.module;
+}
+
+size_t ModuleLoader::GetParsedCount() const {
+    lock_guard lock(mutex_);
+    return parsed_count_;
+}
+
+fs::path ModuleLoader::FindSource(const std::string& name) const {
+    for (const fs::path& dir : search_paths_) {
+        fs::path candidate = dir / (name + ".my"s);
+        if (fs::is_regular_file(candidate)) {
+            return candidate;
+        }
+    }
+    runtime::Throw(runtime_error("Module "s + name + " not found"s));
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "parse.h"
+#include "runtime.h"
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Загрузчик модулей для инструкций import. Модуль name — это файл name.my
+в одном из каталогов поиска. Модуль разбирается и выполняется при первом импорте,
+повторные импорты возвращают тот же объект модуля
+*/
+class ModuleLoader {
+public:
+    // Модули разбираются с настройками options, каталоги search_paths просматриваются по порядку
+    ModuleLoader(std::vector<std::filesystem::path> search_paths, const ParseOptions& options);
+
+    ModuleLoader(const ModuleLoader&) = delete;
+    ModuleLoader& operator=(const ModuleLoader&) = delete;
+
+    // Возвращает модуль name, загружая и выполняя его при первом обращении.
+    // Модуль выполняется в контексте context импортирующей программы. Если модуль не найден либо импортирует
+    // сам себя через цепочку других модулей, выбрасывает runtime_error
+    runtime::ObjectHolder Import(const std::string& name, runtime::Context& context);
+
+    // Возвращает, сколько модулей было разобрано
+    [[nodiscard]] size_t GetParsedCount() const;
+
+private:
+    struct Entry {
+        std::unique_ptr<runtime::Executable> program;
+        runtime::ObjectHolder module;
+        // Модуль выполняется прямо сейчас
+        bool is_loading = false;
+    };
+
+    // Возвращает путь к файлу модуля name
+    [[nodiscard]] std::filesystem::path FindSource(const std::string& name) const;
+
+    std::vector<std::filesystem::path> search_paths_;
+    ParseOptions options_;
+
+    // Модуль может импортировать другие модули, поэтому мьютекс рекурсивный
+    mutable std::recursive_mutex mutex_;
+    std::unordered_map<std::string, Entry> modules_;
+    // Программы модулей, выполнение которых завершилось ошибкой
+    std::vector<std::unique_ptr<runtime::Executable>> failed_programs_;
+    size_t parsed_count_ = 0;
+};
@@ -0,0 +1,100 @@
+#include "module.h"
+#include "statement.h"
+#include "test_program_p.h"
+#include "test_runner_p.h"
+
+#include <chrono>
+#include <fstream>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+// Временный каталог, который удаляется вместе с содержимым по окончании теста
+class TempDir {
+public:
+    TempDir()
+        : path_(fs::temp_directory_path()
+                / ("mython_modules_"s
+                   + to_string(chrono::steady_clock::now().time_since_epoch().count()))) {
+        fs::create_directories(path_);
+    }
+
+    ~TempDir() {
+        error_code ec;
+        fs::remove_all(path_, ec);
+    }
+
+    void Write(const string& file_name, const string& content) const {
+        ofstream(path_ / file_name) << content;
+    }
+
+    [[nodiscard]] const fs::path& Path() const {
+        return path_;
+    }
+
+private:
+    fs::path path_;
+};
+
+string RunWithModules(const string& program, ModuleLoader& modules) {
+    auto tree = ParseProgramFromString(program);
+
+    runtime::DummyContext context;
+    context.modules = &modules;
+    runtime::Closure closure;
+    tree->Execute(closure, context);
+    return context.output.str();
+}
+
+void TestImport() {
+    TempDir dir;
+    dir.Write("shapes.my"s, R"(
+print "loading shapes"
+unit = "cm"
+
+class Rect:
+  def __init__(w, h):
+    self.w = w
+    self.h = h
+
+  def area():
+    return self.w * self.h
+)"s);
+
+    const string program = R"(
+import shapes
+
+class Builder:
+  def square(side):
+    import shapes
+    return shapes.Rect(side, side)
+
+r = shapes.Rect(3, 4)
+b = Builder()
+s = b.square(5)
+print r.area(), s.area(), shapes.unit, shapes
+if r.area() > 100:
+  import missing
+)"s;
+
+    ModuleLoader modules({dir.Path()}, {});
+    // Модуль выполняется один раз, а модуль из невыполненной ветки не загружается
+    ASSERT_EQUAL(RunWithModules(program, modules), "loading shapes\n12 25 cm Module shapes\n"s);
+    ASSERT_EQUAL(RunWithModules("import shapes\nprint shapes.unit\n"s, modules), "cm\n"s);
+    ASSERT_EQUAL(modules.GetParsedCount(), 1U);
+
+    ASSERT_THROWS(RunWithModules("import missing\n"s, modules), runtime_error);
+    ASSERT_THROWS(RunWithModules("import shapes\nx = shapes.Square(1)\n"s, modules), runtime_error);
+
+    dir.Write("first.my"s, "import second\n"s);
+    dir.Write("second.my"s, "import first\n"s);
+    ASSERT_THROWS(RunWithModules("import first\n"s, modules), runtime_error);
+}
+
+}  // namespace
+
+void RunModuleTests(TestRunner& tr) {
+    RUN_TEST(tr, TestImport);
+}
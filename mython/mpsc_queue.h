@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+/*
+Очередь с многими писателями и одним читателем (MPSC) без блокировок на пути сообщения.
+
+Push сводится к одной атомарной замене головы списка, поэтому писатели не ждут ни друг друга,
+ни читателя. Читатель забирает элементы с хвоста. Когда очередь пуста, читатель
+какое-то время проверяет её снова, а затем засыпает; писатель обращается к мьютексу,
+только если застал читателя спящим.
+
+Push может вызываться из любых потоков, TryPop и Pop — только из одного потока-читателя
+*/
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue()
+        : head_(&stub_)
+        , tail_(&stub_) {
+    }
+
+    ~MpscQueue() {
+        while (TryPop()) {
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void Push(T value) {
+        Node* node = new Node{{nullptr}, std::move(value)};
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        // Между заменой головы и этой записью читатель видит очередь пустой
+        prev->next.store(node, std::memory_order_release);
+        // Парный барьер — в Pop: читатель объявляет о сне до повторной проверки очереди,
+        // поэтому либо писатель увидит флаг, либо читатель — новый элемент
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (is_reader_waiting_.load(std::memory_order_relaxed)) {
+            std::lock_guard lock(mutex_);
+            wake_up_.notify_one();
+        }
+    }
+
+    // Извлекает элемент, если очередь не пуста
+    std::optional<T> TryPop() {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (next == nullptr) {
+                return std::nullopt;
+            }
+            // Заглушка остаётся в списке, только пока очередь пуста
+            tail_ = tail = next;
+            next = tail->next.load(std::memory_order_acquire);
+        }
+        if (next == nullptr) {
+            if (tail != head_.load(std::memory_order_acquire)) {
+                // Писатель уже заменил голову, но ещё не связал узел с предыдущим
+                return std::nullopt;
+            }
+            // Последний узел можно забрать, только поставив за ним заглушку
+            stub_.next.store(nullptr, std::memory_order_relaxed);
+            Node* prev = head_.exchange(&stub_, std::memory_order_acq_rel);
+            prev->next.store(&stub_, std::memory_order_release);
+            next = tail->next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                return std::nullopt;
+            }
+        }
+        tail_ = next;
+        std::optional<T> value(std::move(tail->value));
+        delete tail;
+        return value;
+    }
+
+    // Извлекает элемент, дожидаясь его появления
+    T Pop() {
+        while (true) {
+            for (int attempt = 0; attempt < SPIN_ATTEMPTS; ++attempt) {
+                if (auto value = TryPop()) {
+                    return std::move(*value);
+                }
+                std::this_thread::yield();
+            }
+            std::unique_lock lock(mutex_);
+            is_reader_waiting_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (auto value = TryPop()) {
+                is_reader_waiting_.store(false, std::memory_order_relaxed);
+                return std::move(*value);
+            }
+            wake_up_.wait(lock);
+            is_reader_waiting_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    // Сколько раз пустая очередь проверяется перед тем, как читатель заснёт
+    static constexpr int SPIN_ATTEMPTS = 64;
+
+    struct Node {
+        std::atomic<Node*> next;
+        T value;
+    };
+
+    // Узел-заглушка не хранит значения; T должен иметь конструктор по умолчанию
+    Node stub_{{nullptr}, T{}};
+    // Последний добавленный узел. Его меняют писатели
+    alignas(64) std::atomic<Node*> head_;
+    // Следующий извлекаемый узел. Его меняет только читатель
+    alignas(64) Node* tail_;
+
+    std::atomic<bool> is_reader_waiting_{false};
+    std::mutex mutex_;
+    std::condition_variable wake_up_;
+};
@@ -0,0 +1,102 @@
+#include "optimizer.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace ast {
+
+using runtime::Closure;
+using runtime::ObjectHolder;
+
+namespace {
+
+// Вычисляет инструкцию, не зависящую от переменных и контекста
+ObjectHolder Evaluate(Statement& statement) {
+    Closure closure;
+    // Константные выражения ничего не выводят, поэтому контекст создаётся один раз на поток:
+    // создание потока вывода дороже вычисления большинства выражений
+    thread_local runtime::DummyContext context;
+    return statement.Execute(closure, context);
+}
+
+// Создаёт константу со значением value. Для значений, не являющихся константами, возвращает nullptr
+unique_ptr<Statement> MakeConstant(const ObjectHolder& value) {
+    if (!value) {
+        return make_unique<None>();
+    }
+    if (const auto* num = value.TryAs<runtime::Number>()) {
+        return make_unique<NumericConst>(num->GetValue());
+    }
+    if (const auto* str = value.TryAs<runtime::String>()) {
+        return make_unique<StringConst>(runtime::String::Intern(*str));
+    }
+    if (const auto* boolean = value.TryAs<runtime::Bool>()) {
+        return make_unique<BoolConst>(runtime::Bool(boolean->GetValue()));
+    }
+    return nullptr;
+}
+
+// Возвращает результат or/and, если он определяется одним левым операндом
+unique_ptr<Statement> FoldShortCircuit(BinaryOperation& operation) {
+    if (!IsConstant(*operation.lhs_)) {
+        return nullptr;
+    }
+    const bool lhs = runtime::IsTrue(Evaluate(*operation.lhs_));
+    if ((dynamic_cast<Or*>(&operation) != nullptr && lhs)
+        || (dynamic_cast<And*>(&operation) != nullptr && !lhs)) {
+        return make_unique<BoolConst>(runtime::Bool(lhs));
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+bool IsConstant(const Statement& statement) {
+    return dynamic_cast<const NumericConst*>(&statement) != nullptr
+           || dynamic_cast<const StringConst*>(&statement) != nullptr
+           || dynamic_cast<const BoolConst*>(&statement) != nullptr
+           || dynamic_cast<const None*>(&statement) != nullptr;
+}
+
+unique_ptr<Statement> FoldConstants(unique_ptr<Statement> statement) {
+    if (auto* operation = dynamic_cast<BinaryOperation*>(statement.get())) {
+        if (auto folded = FoldShortCircuit(*operation)) {
+            return folded;
+        }
+        if (!IsConstant(*operation->lhs_) || !IsConstant(*operation->rhs_)) {
+            return statement;
+        }
+    } else if (auto* operation = dynamic_cast<UnaryOperation*>(statement.get())) {
+        if (!IsConstant(*operation->arg_)) {
+            return statement;
+        }
+    } else {
+        return statement;
+    }
+
+    try {
+        if (auto folded = MakeConstant(Evaluate(*statement))) {
+            return folded;
+        }
+    } catch (const runtime_error&) {
+        // Ошибка должна проявиться при исполнении, а не при разборе программы
+    }
+    return statement;
+}
+
+unique_ptr<Statement> FoldIfElse(unique_ptr<Statement> condition, unique_ptr<Statement> if_body,
+                                 unique_ptr<Statement> else_body) {
+    if (!IsConstant(*condition)) {
+        return make_unique<IfElse>(std::move(condition), std::move(if_body), std::move(else_body));
+    }
+    if (runtime::IsTrue(Evaluate(*condition))) {
+        return if_body;
+    }
+    if (else_body) {
+        return else_body;
+    }
+    return make_unique<Compound>();
+}
+
+}  // namespace ast
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "statement.h"
+
+#include <memory>
+
+namespace ast {
+
+// Возвращает true, если инструкция - константа: число, строка, логическое значение или None
+bool IsConstant(const Statement& statement);
+
+/*
+Свёртка констант. Если операнды унарной или бинарной операции statement - константы,
+вычисляет операцию во время разбора и возвращает константу с её результатом.
+Операции, вычисление которых завершается ошибкой (например, деление на ноль),
+остаются без изменений, чтобы ошибка возникла при исполнении программы.
+*/
+std::unique_ptr<Statement> FoldConstants(std::unique_ptr<Statement> statement);
+
+/*
+Создаёт инструкцию if <condition> <if_body> else <else_body>.
+Если условие - константа, возвращает только ту ветку, которая будет исполнена
+(либо пустую составную инструкцию, если исполнять нечего).
+*/
+std::unique_ptr<Statement> FoldIfElse(std::unique_ptr<Statement> condition,
+                                      std::unique_ptr<Statement> if_body,
+                                      std::unique_ptr<Statement> else_body);
+
+}  // namespace ast
@@ -1,39 +1,73 @@
 #include "parse.h"
 
 #include "lexer.h"
+#include "optimizer.h"
 #include "statement.h"
 
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
 using namespace std;
 
 namespace TokenType = parse::token_type;
 
 namespace {
-bool operator==(const parse::Token& token, char c) {
-    const auto* p = token.TryAs<TokenType::Char>();
-    return p != nullptr && p->value == c;
+bool operator==(parse::CompactToken token, char c) {
+    return token.IsChar(c);
 }
 
-bool operator!=(const parse::Token& token, char c) {
+bool operator!=(parse::CompactToken token, char c) {
     return !(token == c);
 }
 
+// Общие данные разбора программы. Сохраняются, пока не разобраны тела всех методов
+struct ParseContext {
+    explicit ParseContext(const ParseOptions& options)
+        : options(options) {
+    }
+
+    ParseOptions options;
+    // Объявленные классы и их порядковые номера. Классами владеют узлы ClassDefinition
+    unordered_map<string, pair<size_t, runtime::Class*>> classes;
+    // Тела методов могут разбираться из разных потоков, а разбор может объявлять классы
+    mutex lazy_parse_mutex;
+};
+
 class Parser {
 public:
-    explicit Parser(parse::Lexer& lexer)
-        : lexer_(lexer) {
+    // Разбор видит только первые visible_classes классов из context,
+    // то есть классы, объявленные до начала разбираемого фрагмента
+    Parser(parse::Lexer& lexer, shared_ptr<ParseContext> context,
+           size_t visible_classes = numeric_limits<size_t>::max())
+        : lexer_(lexer)
+        , context_(std::move(context))
+        , options_(context_->options)
+        , visible_classes_(visible_classes) {
     }
 
     // Program -> eps
     //          | Statement \n Program
     unique_ptr<ast::Statement> ParseProgram() {
         auto result = make_unique<ast::Compound>();
-        while (!lexer_.CurrentToken().Is<TokenType::Eof>()) {
-            result->AddStatement(ParseStatement());
+        while (!lexer_.Current().Is<TokenType::Eof>()) {
+            const uint32_t line = lexer_.CurrentLine();
+            result->AddStatement(ParseStatement(), line);
         }
 
         return result;
     }
 
+    // Разбирает записанное тело метода: Suite, за которым следует конец записи
+    unique_ptr<ast::Statement> ParseMethodBody() {
+        is_in_method_ = true;
+        auto result = ParseSuite();
+        lexer_.Expect<TokenType::Eof>();
+        return result;
+    }
+
 private:
     // Suite -> NEWLINE INDENT (Statement)+ DEDENT
     unique_ptr<ast::Statement> ParseSuite()  // NOLINT
@@ -41,15 +75,16 @@ private:
         lexer_.Expect<TokenType::Newline>();
         lexer_.ExpectNext<TokenType::Indent>();
 
-        lexer_.NextToken();
+        lexer_.Advance();
 
         auto result = make_unique<ast::Compound>();
-        while (!lexer_.CurrentToken().Is<TokenType::Dedent>()) {
-            result->AddStatement(ParseStatement());  // NOLINT
+        while (!lexer_.Current().Is<TokenType::Dedent>()) {
+            const uint32_t line = lexer_.CurrentLine();
+            result->AddStatement(ParseStatement(), line);  // NOLINT
         }
 
         lexer_.Expect<TokenType::Dedent>();
-        lexer_.NextToken();
+        lexer_.Advance();
 
         return result;
     }
@@ -59,48 +94,78 @@ private:
     {
         vector<runtime::Method> result;
 
-        while (lexer_.CurrentToken().Is<TokenType::Def>()) {
+        while (lexer_.Current().Is<TokenType::Def>()) {
             runtime::Method m;
 
-            m.name = lexer_.ExpectNext<TokenType::Id>().value;
+            m.name = lexer_.ExpectNextId();
             lexer_.ExpectNext<TokenType::Char>('(');
 
-            if (lexer_.NextToken().Is<TokenType::Id>()) {
-                m.formal_params.push_back(lexer_.Expect<TokenType::Id>().value);
-                while (lexer_.NextToken() == ',') {
-                    m.formal_params.push_back(lexer_.ExpectNext<TokenType::Id>().value);
+            if (lexer_.Advance().Is<TokenType::Id>()) {
+                m.formal_params.push_back(lexer_.ExpectId());
+                while (lexer_.Advance() == ',') {
+                    m.formal_params.push_back(lexer_.ExpectNextId());
                 }
             }
 
             lexer_.Expect<TokenType::Char>(')');
             lexer_.ExpectNext<TokenType::Char>(':');
-            lexer_.NextToken();
+            lexer_.Advance();
 
-            m.body = std::make_unique<ast::MethodBody>(ParseSuite());  // NOLINT
+            if (options_.lazy_methods) {
+                m.body = MakeLazyMethodBody();
+            } else {
+                m.effects.is_side_effect_free = true;
+                runtime::MethodEffects* outer_effects = std::exchange(effects_, &m.effects);
+                is_in_method_ = true;
+                m.body = std::make_unique<ast::MethodBody>(ParseSuite());  // NOLINT
+                is_in_method_ = false;
+                effects_ = outer_effects;
+            }
 
             result.push_back(std::move(m));
         }
         return result;
     }
 
+    // Запоминает лексемы тела метода. Тело разбирается при первом вызове метода
+    // с тем же набором видимых классов, что и при немедленном разборе
+    unique_ptr<ast::MethodBody> MakeLazyMethodBody() {
+        auto parse_body = [tokens = lexer_.RecordBlock(), context = context_,
+                           visible_classes = context_->classes.size()] {
+            lock_guard lock(context->lazy_parse_mutex);
+            parse::Lexer lexer(tokens);
+            return Parser(lexer, context, visible_classes).ParseMethodBody();
+        };
+        return make_unique<ast::MethodBody>(std::move(parse_body));
+    }
+
+    // Возвращает объявленный класс name, видимый в разбираемом фрагменте, либо nullptr
+    runtime::Class* FindClass(const string& name) const {
+        auto it = context_->classes.find(name);
+        if (it == context_->classes.end() || it->second.first >= visible_classes_) {
+            return nullptr;
+        }
+        return it->second.second;
+    }
+
     // ClassDefinition -> Id ['(' Id ')'] : new_line indent MethodList dedent
     unique_ptr<ast::Statement> ParseClassDefinition()  // NOLINT
     {
-        string class_name = lexer_.Expect<TokenType::Id>().value;
+        MarkSideEffect();
+        string class_name = lexer_.ExpectId();
 
-        lexer_.NextToken();
+        lexer_.Advance();
 
         const runtime::Class* base_class = nullptr;
-        if (lexer_.CurrentToken() == '(') {
-            auto name = lexer_.ExpectNext<TokenType::Id>().value;
+        if (lexer_.Current() == '(') {
+            auto name = lexer_.ExpectNextId();
             lexer_.ExpectNext<TokenType::Char>(')');
-            lexer_.NextToken();
+            lexer_.Advance();
 
-            auto it = declared_classes_.find(name);
-            if (it == declared_classes_.end()) {
+            base_class = FindClass(name);
+            if (base_class == nullptr) {
                 throw ParseError("Base class "s + name + " not found for class "s + class_name);
             }
-            base_class = static_cast<const runtime::Class*>(it->second.Get());  // NOLINT
         }
 
         lexer_.Expect<TokenType::Char>(':');
@@ -110,25 +175,22 @@ private:
         vector<runtime::Method> methods = ParseMethods();  // NOLINT
 
         lexer_.Expect<TokenType::Dedent>();
-        lexer_.NextToken();
-
-        auto [it, inserted] = declared_classes_.insert({
-            class_name,
-            runtime::ObjectHolder::Own(runtime::Class(class_name, std::move(methods), base_class)),
-        });
+        lexer_.Advance();
 
-        if (!inserted) {
+        if (context_->classes.count(class_name) != 0) {
             throw ParseError("Class "s + class_name + " already exists"s);
         }
+        auto cls = runtime::ObjectHolder::Own(runtime::Class(class_name, std::move(methods), base_class));
+        context_->classes.emplace(class_name, pair{context_->classes.size(), cls.TryAs<runtime::Class>()});
 
-        return make_unique<ast::ClassDefinition>(it->second);
+        return make_unique<ast::ClassDefinition>(cls);
     }
 
     vector<string> ParseDottedIds() {
-        vector<string> result(1, lexer_.Expect<TokenType::Id>().value);
+        vector<string> result(1, lexer_.ExpectId());
 
-        while (lexer_.NextToken() == '.') {
-            result.push_back(lexer_.ExpectNext<TokenType::Id>().value);
+        while (lexer_.Advance() == '.') {
+            result.push_back(lexer_.ExpectNextId());
         }
 
         return result;
@@ -143,146 +205,92 @@ private:
         string last_name = id_list.back();
         id_list.pop_back();
 
-        if (lexer_.CurrentToken() == '=') {
-            lexer_.NextToken();
+        if (lexer_.Current() == '=') {
+            lexer_.Advance();
 
             if (id_list.empty()) {
+                if (last_name == "self"sv) {
+                    MarkSideEffect();
+                }
                 return make_unique<ast::Assignment>(std::move(last_name), ParseTest());
             }
+            MarkSideEffect();
             return make_unique<ast::FieldAssignment>(ast::VariableValue{std::move(id_list)},
                                                      std::move(last_name), ParseTest());
         }
         lexer_.Expect<TokenType::Char>('(');
-        lexer_.NextToken();
+        lexer_.Advance();
 
-        if (id_list.empty()) {
+        // Из встроенных функций отдельной инструкцией имеет смысл только send
+        const bool is_send = id_list.empty() && last_name == "send"sv && FindClass(last_name) == nullptr;
+        if (id_list.empty() && !is_send) {
             throw ParseError("Mython doesn't support functions, only methods: "s + last_name);
         }
 
         vector<unique_ptr<ast::Statement>> args;
-        if (lexer_.CurrentToken() != ')') {
+        if (lexer_.Current() != ')') {
             args = ParseTestList();
         }
         lexer_.Expect<TokenType::Char>(')');
-        lexer_.NextToken();
+        lexer_.Advance();
 
+        if (is_send) {
+            return MakeCall({std::move(last_name)}, std::move(args));
+        }
+        NoteMethodCall(id_list, last_name);
         return make_unique<ast::MethodCall>(make_unique<ast::VariableValue>(std::move(id_list)),
                                             std::move(last_name), std::move(args));
     }
 
-    // Expr -> Adder ['+'/'-' Adder]*
-    unique_ptr<ast::Statement> ParseExpression()  // NOLINT
-    {
-        unique_ptr<ast::Statement> result = ParseAdder();
-        while (lexer_.CurrentToken() == '+' || lexer_.CurrentToken() == '-') {
-            char op = lexer_.CurrentToken().As<TokenType::Char>().value;
-            lexer_.NextToken();
+    // Строит вызов names(args): метод объекта, создание экземпляра класса либо встроенную функцию
+    unique_ptr<ast::Statement> MakeCall(vector<string> names,
+                                        vector<unique_ptr<ast::Statement>> args) {
+        auto method_name = names.back();
+        names.pop_back();
 
-            if (op == '+') {
-                result = make_unique<ast::Add>(std::move(result), ParseAdder());
-            } else {
-                result = make_unique<ast::Sub>(std::move(result), ParseAdder());
-            }
+        if (!names.empty()) {
+            NoteMethodCall(names, method_name);
+            return make_unique<ast::MethodCall>(make_unique<ast::VariableValue>(std::move(names)),
+                                                std::move(method_name), std::move(args));
         }
-        return result;
-    }
-
-    // Adder -> Mult ['*'/'/' Mult]*
-    unique_ptr<ast::Statement> ParseAdder()  // NOLINT
-    {
-        unique_ptr<ast::Statement> result = ParseMult();
-        while (lexer_.CurrentToken() == '*' || lexer_.CurrentToken() == '/') {
-            char op = lexer_.CurrentToken().As<TokenType::Char>().value;
-            lexer_.NextToken();
-
-            if (op == '*') {
-                result = make_unique<ast::Mult>(std::move(result), ParseMult());
-            } else {
-                result = make_unique<ast::Div>(std::move(result), ParseMult());
-            }
+        if (runtime::Class* cls = FindClass(method_name)) {
+            MarkSideEffect();
+            return make_unique<ast::NewInstance>(*cls, std::move(args));
         }
-        return result;
-    }
-
-    // Mult -> '(' Expr ')'
-    //       | NUMBER
-    //       | '-' Mult
-    //       | STRING
-    //       | NONE
-    //       | TRUE
-    //       | FALSE
-    //       | DottedIds '(' ExprList ')'
-    //       | DottedIds
-    unique_ptr<ast::Statement> ParseMult()  // NOLINT
-    {
-        if (lexer_.CurrentToken() == '(') {
-            lexer_.NextToken();
-            auto result = ParseTest();
-            lexer_.Expect<TokenType::Char>(')');
-            lexer_.NextToken();
-            return result;
-        }
-        if (lexer_.CurrentToken() == '-') {
-            lexer_.NextToken();
-            return make_unique<ast::Mult>(ParseMult(), make_unique<ast::NumericConst>(-1));
-        }
-        if (const auto* num = lexer_.CurrentToken().TryAs<TokenType::Number>()) {
-            int result = num->value;
-            lexer_.NextToken();
-            return make_unique<ast::NumericConst>(result);
-        }
-        if (const auto* str = lexer_.CurrentToken().TryAs<TokenType::String>()) {
-            string result = str->value;
-            lexer_.NextToken();
-            return make_unique<ast::StringConst>(std::move(result));
-        }
-        if (lexer_.CurrentToken().Is<TokenType::True>()) {
-            lexer_.NextToken();
-            return make_unique<ast::BoolConst>(runtime::Bool(true));
-        }
-        if (lexer_.CurrentToken().Is<TokenType::False>()) {
-            lexer_.NextToken();
-            return make_unique<ast::BoolConst>(runtime::Bool(false));
+        if (method_name == "str"sv) {
+            if (args.size() != 1) {
+                throw ParseError("Function str takes exactly one argument"s);
+            }
+            return Fold(make_unique<ast::Stringify>(std::move(args.front())));
+        }
+        if (method_name == "spawn"sv) {
+            // Класс актора известен при разборе, как и в выражении создания экземпляра
+            const auto* cls_name = args.empty() ? nullptr
+                                                : dynamic_cast<ast::VariableValue*>(args.front().get());
+            runtime::Class* cls = cls_name != nullptr && cls_name->GetDottedIds().size() == 1
+                                      ? FindClass(cls_name->GetDottedIds().front())
+                                      : nullptr;
+            if (cls == nullptr) {
+                throw ParseError("Function spawn takes a class name and its arguments"s);
+            }
+            MarkSideEffect();
+            args.erase(args.begin());
+            return make_unique<ast::Spawn>(*cls, std::move(args));
         }
-        if (lexer_.CurrentToken().Is<TokenType::None>()) {
-            lexer_.NextToken();
-            return make_unique<ast::None>();
+        if (method_name == "send"sv) {
+            if (args.size() < 2) {
+                throw ParseError("Function send takes an actor, a method name and its arguments"s);
+            }
+            MarkSideEffect();
+            return make_unique<ast::Send>(std::move(args));
         }
-
-        return ParseDottedIdsInMultExpr();
+        throw ParseError("Unknown call to "s + method_name + "()"s);
     }
 
-    std::unique_ptr<ast::Statement> ParseDottedIdsInMultExpr() {
-        vector<string> names = ParseDottedIds();
-
-        if (lexer_.CurrentToken() == '(') {
-            // various calls
-            vector<unique_ptr<ast::Statement>> args;
-            if (lexer_.NextToken() != ')') {
-                args = ParseTestList();
-            }
-            lexer_.Expect<TokenType::Char>(')');
-            lexer_.NextToken();
-
-            auto method_name = names.back();
-            names.pop_back();
-
-            if (!names.empty()) {
-                return make_unique<ast::MethodCall>(
-                    make_unique<ast::VariableValue>(std::move(names)), std::move(method_name),
-                    std::move(args));
-            }
-            if (auto it = declared_classes_.find(method_name); it != declared_classes_.end()) {
-                return make_unique<ast::NewInstance>(
-                    static_cast<runtime::Class&>(*it->second), std::move(args));  // NOLINT
-            }
-            if (method_name == "str"sv) {
-                if (args.size() != 1) {
-                    throw ParseError("Function str takes exactly one argument"s);
-                }
-                return make_unique<ast::Stringify>(std::move(args.front()));
-            }
-            throw ParseError("Unknown call to "s + method_name + "()"s);
+    unique_ptr<ast::Statement> MakeVariable(vector<string> names) {
+        // Значение зависит от состояния объекта, а не только от аргументов метода
+        if (names.size() > 1 || names.front() == "self"sv) {
+            MarkSideEffect();
         }
         return make_unique<ast::VariableValue>(std::move(names));
     }
@@ -292,8 +300,8 @@ private:
         vector<unique_ptr<ast::Statement>> result;
         result.push_back(ParseTest());
 
-        while (lexer_.CurrentToken() == ',') {
-            lexer_.NextToken();
+        while (lexer_.Current() == ',') {
+            lexer_.Advance();
             result.push_back(ParseTest());
         }
         return result;
@@ -303,22 +311,25 @@ private:
     unique_ptr<ast::Statement> ParseCondition()  // NOLINT
     {
         lexer_.Expect<TokenType::If>();
-        lexer_.NextToken();
+        lexer_.Advance();
 
         auto condition = ParseTest();
 
         lexer_.Expect<TokenType::Char>(':');
-        lexer_.NextToken();
+        lexer_.Advance();
 
         auto if_body = ParseSuite();
 
         unique_ptr<ast::Statement> else_body;
-        if (lexer_.CurrentToken().Is<TokenType::Else>()) {
+        if (lexer_.Current().Is<TokenType::Else>()) {
             lexer_.ExpectNext<TokenType::Char>(':');
-            lexer_.NextToken();
+            lexer_.Advance();
             else_body = ParseSuite();
         }
 
+        if (options_.optimize) {
+            return ast::FoldIfElse(std::move(condition), std::move(if_body), std::move(else_body));
+        }
         return make_unique<ast::IfElse>(std::move(condition), std::move(if_body),
                                         std::move(else_body));
     }
@@ -327,109 +338,476 @@ private:
     // AndTest -> NotTest [AND NotTest]
     // NotTest -> [NOT] NotTest
     //          | Comparison
-    unique_ptr<ast::Statement> ParseTest()  // NOLINT
-    {
-        auto result = ParseAndTest();
-        while (lexer_.CurrentToken().Is<TokenType::Or>()) {
-            lexer_.NextToken();
-            result = make_unique<ast::Or>(std::move(result), ParseAndTest());
+    // Comparison -> Expr [COMP_OP Expr]
+    // Expr -> Adder ['+'/'-' Adder]*
+    // Adder -> Mult ['*'/'/' Mult]*
+    // Mult -> '(' LogicalExpr ')'
+    //       | NUMBER
+    //       | '-' Mult
+    //       | STRING
+    //       | NONE
+    //       | TRUE
+    //       | FALSE
+    //       | DottedIds '(' ExprList ')'
+    //       | DottedIds
+    //
+    // Выражение разбирается методом приоритетов операций с явными стеками операндов
+    // и операций, поэтому глубина вложенности скобок и длина выражения не ограничены стеком
+    unique_ptr<ast::Statement> ParseTest() {
+        ExpressionStacks stacks;
+        // Ожидается операнд (true) либо бинарная операция (false)
+        bool expect_operand = true;
+
+        while (true) {
+            const auto tok = lexer_.Current();
+            if (expect_operand) {
+                expect_operand = ParsePrefix(tok, stacks);
+                continue;
+            }
+
+            const Operation op = BinaryOperationOf(tok);
+            if (op != Operation::NONE) {
+                lexer_.Advance();
+                ReduceOperations(stacks, Priority(op), IsComparison(op));
+                stacks.operations.push_back(op);
+                expect_operand = true;
+                continue;
+            }
+
+            const bool closes_call = tok == ',' || tok == ')';
+            const bool group_is_open = !stacks.groups.empty();
+            if (!closes_call || !group_is_open) {
+                break;
+            }
+            ReduceOperations(stacks, 0, false);
+            if (tok == ',') {
+                if (stacks.operations.back() != Operation::CALL) {
+                    break;
+                }
+                lexer_.Advance();
+                expect_operand = true;
+                continue;
+            }
+            lexer_.Advance();
+            CloseGroup(stacks);
         }
-        return result;
-    }
 
-    unique_ptr<ast::Statement> ParseAndTest()  // NOLINT
-    {
-        auto result = ParseNotTest();
-        while (lexer_.CurrentToken().Is<TokenType::And>()) {
-            lexer_.NextToken();
-            result = make_unique<ast::And>(std::move(result), ParseNotTest());
+        if (!stacks.groups.empty()) {
+            lexer_.Expect<TokenType::Char>(')');
         }
-        return result;
+        ReduceOperations(stacks, 0, false);
+        return std::move(stacks.operands.back());
     }
 
-    unique_ptr<ast::Statement> ParseNotTest()  // NOLINT
-    {
-        if (lexer_.CurrentToken().Is<TokenType::Not>()) {
-            lexer_.NextToken();
-            return make_unique<ast::Not>(ParseNotTest());  // NOLINT
+    // Операции выражения. Открывающая скобка и вызов служат границами вложенных выражений
+    enum class Operation : uint8_t {
+        NONE,
+        OR,
+        AND,
+        NOT,
+        LESS,
+        GREATER,
+        EQUAL,
+        NOT_EQUAL,
+        LESS_OR_EQUAL,
+        GREATER_OR_EQUAL,
+        ADD,
+        SUB,
+        MULT,
+        DIV,
+        NEGATE,
+        PARENS,
+        CALL,
+    };
+
+    // Вызов, аргументы которого ещё разбираются
+    struct PendingCall {
+        vector<string> names;
+        // Число операндов в стеке перед первым аргументом
+        size_t first_arg = 0;
+    };
+
+    struct ExpressionStacks {
+        vector<unique_ptr<ast::Statement>> operands;
+        vector<Operation> operations;
+        // Незакрытые скобки и вызовы, для вызовов хранится PendingCall
+        vector<std::optional<PendingCall>> groups;
+    };
+
+    static int Priority(Operation op) {
+        switch (op) {
+            case Operation::OR:
+                return 1;
+            case Operation::AND:
+                return 2;
+            case Operation::NOT:
+                return 3;
+            case Operation::ADD:
+            case Operation::SUB:
+                return 5;
+            case Operation::MULT:
+            case Operation::DIV:
+                return 6;
+            case Operation::NEGATE:
+                return 7;
+            case Operation::NONE:
+            case Operation::PARENS:
+            case Operation::CALL:
+                return 0;
+            default:
+                return 4;
         }
-        return ParseComparison();
     }
 
-    // Comparison -> Expr [COMP_OP Expr]
-    unique_ptr<ast::Statement> ParseComparison()  // NOLINT
-    {
-        auto result = ParseExpression();
-
-        const auto tok = lexer_.CurrentToken();
+    static bool IsComparison(Operation op) {
+        return Priority(op) == 4;
+    }
 
-        if (tok == '<') {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::Less, std::move(result),
-                                                ParseExpression());
+    static Operation BinaryOperationOf(parse::CompactToken tok) {
+        if (tok.Is<TokenType::Or>()) {
+            return Operation::OR;
         }
-        if (tok == '>') {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::Greater, std::move(result),
-                                                ParseExpression());
+        if (tok.Is<TokenType::And>()) {
+            return Operation::AND;
         }
         if (tok.Is<TokenType::Eq>()) {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::Equal, std::move(result),
-                                                ParseExpression());
+            return Operation::EQUAL;
         }
         if (tok.Is<TokenType::NotEq>()) {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::NotEqual, std::move(result),
-                                                ParseExpression());
+            return Operation::NOT_EQUAL;
         }
         if (tok.Is<TokenType::LessOrEq>()) {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::LessOrEqual, std::move(result),
-                                                ParseExpression());
+            return Operation::LESS_OR_EQUAL;
         }
         if (tok.Is<TokenType::GreaterOrEq>()) {
-            lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::GreaterOrEqual, std::move(result),
-                                                ParseExpression());
+            return Operation::GREATER_OR_EQUAL;
+        }
+        if (!tok.Is<TokenType::Char>()) {
+            return Operation::NONE;
+        }
+        switch (tok.AsChar()) {
+            case '<':
+                return Operation::LESS;
+            case '>':
+                return Operation::GREATER;
+            case '+':
+                return Operation::ADD;
+            case '-':
+                return Operation::SUB;
+            case '*':
+                return Operation::MULT;
+            case '/':
+                return Operation::DIV;
+            default:
+                return Operation::NONE;
+        }
+    }
+
+    // Разбирает префиксную часть операнда. Возвращает true, если операнд ещё не завершён
+    bool ParsePrefix(parse::CompactToken tok, ExpressionStacks& stacks) {
+        if (tok.Is<TokenType::Not>()) {
+            // not допустим только там, где грамматика ожидает NotTest
+            const bool allowed = stacks.operations.empty()
+                                 || stacks.operations.back() == Operation::OR
+                                 || stacks.operations.back() == Operation::AND
+                                 || stacks.operations.back() == Operation::NOT
+                                 || stacks.operations.back() == Operation::PARENS
+                                 || stacks.operations.back() == Operation::CALL;
+            if (!allowed) {
+                throw ParseError("Unexpected 'not' in expression"s);
+            }
+            lexer_.Advance();
+            stacks.operations.push_back(Operation::NOT);
+            return true;
+        }
+        if (tok == '-') {
+            lexer_.Advance();
+            stacks.operations.push_back(Operation::NEGATE);
+            return true;
+        }
+        if (tok == '(') {
+            lexer_.Advance();
+            stacks.operations.push_back(Operation::PARENS);
+            stacks.groups.emplace_back();
+            return true;
+        }
+        if (tok.Is<TokenType::Number>()) {
+            stacks.operands.push_back(make_unique<ast::NumericConst>(tok.AsNumber()));
+        } else if (tok.Is<TokenType::String>()) {
+            // Одинаковые строковые литералы разделяют одно значение из пула строк
+            stacks.operands.push_back(
+                make_unique<ast::StringConst>(runtime::String::Intern(lexer_.TextOf(tok))));
+        } else if (tok.Is<TokenType::True>()) {
+            stacks.operands.push_back(make_unique<ast::BoolConst>(runtime::Bool(true)));
+        } else if (tok.Is<TokenType::False>()) {
+            stacks.operands.push_back(make_unique<ast::BoolConst>(runtime::Bool(false)));
+        } else if (tok.Is<TokenType::None>()) {
+            stacks.operands.push_back(make_unique<ast::None>());
+        } else {
+            vector<string> names = ParseDottedIds();
+            if (lexer_.Current() != '(') {
+                stacks.operands.push_back(MakeVariable(std::move(names)));
+                return false;
+            }
+            if (lexer_.Advance() == ')') {
+                lexer_.Advance();
+                stacks.operands.push_back(MakeCall(std::move(names), {}));
+                return false;
+            }
+            stacks.operations.push_back(Operation::CALL);
+            stacks.groups.emplace_back(PendingCall{std::move(names), stacks.operands.size()});
+            return true;
+        }
+        lexer_.Advance();
+        return false;
+    }
+
+    // Выполняет операции на вершине стека, приоритет которых не ниже priority.
+    // Цепочка сравнений a < b < c в Mython недопустима
+    void ReduceOperations(ExpressionStacks& stacks, int priority, bool is_comparison) {
+        while (!stacks.operations.empty()) {
+            const Operation op = stacks.operations.back();
+            if (op == Operation::PARENS || op == Operation::CALL || Priority(op) < priority) {
+                return;
+            }
+            if (is_comparison && IsComparison(op)) {
+                throw ParseError("Comparison operators can't be chained"s);
+            }
+            stacks.operations.pop_back();
+            ApplyOperation(op, stacks.operands);
         }
-        return result;
+    }
+
+    void ApplyOperation(Operation op, vector<unique_ptr<ast::Statement>>& operands) {
+        auto arg = std::move(operands.back());
+        operands.pop_back();
+        if (op == Operation::NOT) {
+            operands.push_back(Fold(make_unique<ast::Not>(std::move(arg))));
+            return;
+        }
+        if (op == Operation::NEGATE) {
+            if (options_.optimize) {
+                operands.push_back(Fold(make_unique<ast::Negate>(std::move(arg))));
+            } else {
+                operands.push_back(
+                    make_unique<ast::Mult>(std::move(arg), make_unique<ast::NumericConst>(-1)));
+            }
+            return;
+        }
+
+        auto& lhs = operands.back();
+        switch (op) {
+            case Operation::OR:
+                lhs = Fold(make_unique<ast::Or>(std::move(lhs), std::move(arg)));
+                break;
+            case Operation::AND:
+                lhs = Fold(make_unique<ast::And>(std::move(lhs), std::move(arg)));
+                break;
+            case Operation::ADD:
+                lhs = Fold(make_unique<ast::Add>(std::move(lhs), std::move(arg)));
+                break;
+            case Operation::SUB:
+                lhs = Fold(make_unique<ast::Sub>(std::move(lhs), std::move(arg)));
+                break;
+            case Operation::MULT:
+                lhs = Fold(make_unique<ast::Mult>(std::move(lhs), std::move(arg)));
+                break;
+            case Operation::DIV:
+                lhs = Fold(make_unique<ast::Div>(std::move(lhs), std::move(arg)));
+                break;
+            default:
+                lhs = Fold(make_unique<ast::Comparison>(ComparatorOf(op), std::move(lhs),
+                                                        std::move(arg)));
+                break;
+        }
+    }
+
+    static ast::Comparison::Comparator ComparatorOf(Operation op) {
+        switch (op) {
+            case Operation::LESS:
+                return runtime::Less;
+            case Operation::GREATER:
+                return runtime::Greater;
+            case Operation::EQUAL:
+                return runtime::Equal;
+            case Operation::NOT_EQUAL:
+                return runtime::NotEqual;
+            case Operation::LESS_OR_EQUAL:
+                return runtime::LessOrEqual;
+            default:
+                return runtime::GreaterOrEqual;
+        }
+    }
+
+    // Закрывает последнюю скобку либо вызов. Операции внутри уже выполнены
+    void CloseGroup(ExpressionStacks& stacks) {
+        const Operation op = stacks.operations.back();
+        stacks.operations.pop_back();
+        std::optional<PendingCall> call = std::move(stacks.groups.back());
+        stacks.groups.pop_back();
+        if (op == Operation::PARENS) {
+            return;
+        }
+        auto first = stacks.operands.begin() + static_cast<ptrdiff_t>(call->first_arg);
+        vector<unique_ptr<ast::Statement>> args(std::make_move_iterator(first),
+                                                std::make_move_iterator(stacks.operands.end()));
+        stacks.operands.erase(first, stacks.operands.end());
+        stacks.operands.push_back(MakeCall(std::move(call->names), std::move(args)));
+    }
+
+    // WhileLoop -> while LogicalExpr: Suite
+    unique_ptr<ast::Statement> ParseWhileLoop()  // NOLINT
+    {
+        lexer_.Expect<TokenType::While>();
+        lexer_.Advance();
+
+        auto condition = ParseTest();
+
+        lexer_.Expect<TokenType::Char>(':');
+        lexer_.Advance();
+
+        return make_unique<ast::While>(std::move(condition), ParseSuite());
+    }
+
+    // ForLoop -> for Id in range '(' [Expr ','] Expr ')': Suite
+    unique_ptr<ast::Statement> ParseForLoop()  // NOLINT
+    {
+        auto [var, bounds] = ParseForHeader();
+        lexer_.Expect<TokenType::Char>(':');
+        lexer_.Advance();
+
+        return make_unique<ast::ForRange>(std::move(var), std::move(bounds[0]),
+                                          std::move(bounds[1]), ParseSuite());
+    }
+
+    // ParallelForLoop -> parallel for Id in range(ExprList) [Reducer [, Reducer]*]: Suite
+    // Reducer -> sum Id | min Id | max Id | append Id
+    unique_ptr<ast::Statement> ParseParallelForLoop()  // NOLINT
+    {
+        lexer_.Expect<TokenType::Parallel>();
+        lexer_.ExpectNext<TokenType::For>();
+        // Итерации выполняются в других потоках
+        MarkSideEffect();
+        auto [var, bounds] = ParseForHeader();
+
+        static const unordered_map<string_view, ast::ParallelFor::Reduction> reductions = {
+            {"sum"sv, ast::ParallelFor::Reduction::SUM},
+            {"min"sv, ast::ParallelFor::Reduction::MIN},
+            {"max"sv, ast::ParallelFor::Reduction::MAX},
+            {"append"sv, ast::ParallelFor::Reduction::APPEND},
+        };
+        vector<ast::ParallelFor::Reducer> reducers;
+        while (lexer_.Current() != ':') {
+            if (!reducers.empty()) {
+                lexer_.Expect<TokenType::Char>(',');
+                lexer_.Advance();
+            }
+            auto it = reductions.find(lexer_.ExpectId());
+            if (it == reductions.end()) {
+                throw ParseError("Unknown reduction "s + lexer_.ExpectId());
+            }
+            string reduced = lexer_.ExpectNextId();
+            if (reduced == var) {
+                throw ParseError("Loop variable "s + var + " can't be reduced"s);
+            }
+            reducers.push_back({it->second, std::move(reduced)});
+            lexer_.Advance();
+        }
+        lexer_.Advance();
+
+        return make_unique<ast::ParallelFor>(std::move(var), std::move(bounds[0]),
+                                             std::move(bounds[1]), std::move(reducers),
+                                             ParseSuite());
+    }
+
+    // ForHeader -> for Id in range(ExprList). Возвращает имя переменной и границы диапазона
+    pair<string, vector<unique_ptr<ast::Statement>>> ParseForHeader() {
+        lexer_.Expect<TokenType::For>();
+        string var = lexer_.ExpectNextId();
+        if (var == "self"sv) {
+            MarkSideEffect();
+        }
+        lexer_.ExpectNext<TokenType::In>();
+        lexer_.ExpectNext<TokenType::Id>("range"s);
+        lexer_.ExpectNext<TokenType::Char>('(');
+        lexer_.Advance();
+
+        vector<unique_ptr<ast::Statement>> bounds = ParseTestList();
+        if (bounds.size() == 1) {
+            bounds.insert(bounds.begin(), make_unique<ast::NumericConst>(0));
+        }
+        if (bounds.size() != 2) {
+            throw ParseError("Function range takes one or two arguments"s);
+        }
+
+        lexer_.Expect<TokenType::Char>(')');
+        lexer_.Advance();
+        return {std::move(var), std::move(bounds)};
     }
 
     // Statement -> SimpleStatement Newline
     //           | class ClassDefinition
     //           | if Condition
+    //           | while WhileLoop
+    //           | for ForLoop
+    //           | parallel ParallelForLoop
     unique_ptr<ast::Statement> ParseStatement()  // NOLINT
     {
-        const auto& tok = lexer_.CurrentToken();
+        const auto tok = lexer_.Current();
 
         if (tok.Is<TokenType::Class>()) {
-            lexer_.NextToken();
+            lexer_.Advance();
             return ParseClassDefinition();  // NOLINT
         }
         if (tok.Is<TokenType::If>()) {
             return ParseCondition();
         }
+        if (tok.Is<TokenType::While>()) {
+            return ParseWhileLoop();
+        }
+        if (tok.Is<TokenType::For>()) {
+            return ParseForLoop();
+        }
+        if (tok.Is<TokenType::Parallel>()) {
+            return ParseParallelForLoop();
+        }
         auto result = ParseSimpleStatement();
         lexer_.Expect<TokenType::Newline>();
-        lexer_.NextToken();
+        lexer_.Advance();
         return result;
     }
 
     // StatementBody -> return Expression
     //               | print ExpressionList
+    //               | import Id
     //               | AssignmentOrCall
     unique_ptr<ast::Statement> ParseSimpleStatement() {
-        const auto& tok = lexer_.CurrentToken();
+        const auto tok = lexer_.Current();
+
+        if (tok.Is<TokenType::Import>()) {
+            MarkSideEffect();
+            string module_name = lexer_.ExpectNextId();
+            lexer_.Advance();
+            return make_unique<ast::Import>(std::move(module_name));
+        }
 
         if (tok.Is<TokenType::Return>()) {
-            lexer_.NextToken();
-            return make_unique<ast::Return>(ParseTest());
+            // Сигнал return забирает только тело метода, поэтому вне методов return запрещён
+            if (!is_in_method_) {
+                throw ParseError("return can be used only inside a method"s);
+            }
+            lexer_.Advance();
+            auto value = ParseTest();
+            if (auto* call = dynamic_cast<ast::MethodCall*>(value.get()); call && options_.optimize) {
+                call->MarkAsTailCall();
+            }
+            return make_unique<ast::Return>(std::move(value));
         }
         if (tok.Is<TokenType::Print>()) {
-            lexer_.NextToken();
+            MarkSideEffect();
+            lexer_.Advance();
             vector<unique_ptr<ast::Statement>> args;
-            if (!lexer_.CurrentToken().Is<TokenType::Newline>()) {
+            if (!lexer_.Current().Is<TokenType::Newline>()) {
                 args = ParseTestList();
             }
             return make_unique<ast::Print>(std::move(args));
@@ -437,12 +815,58 @@ private:
         return ParseAssignmentOrCall();
     }
 
+    // Сворачивает константы в только что построенной операции, если оптимизация включена
+    unique_ptr<ast::Statement> Fold(unique_ptr<ast::Statement> statement) const {
+        if (options_.optimize) {
+            return ast::FoldConstants(std::move(statement));
+        }
+        return statement;
+    }
+
+    // Отмечает, что у разбираемого тела метода есть побочные эффекты
+    void MarkSideEffect() {
+        if (effects_ != nullptr) {
+            effects_->is_side_effect_free = false;
+        }
+    }
+
+    // Учитывает в эффектах разбираемого метода вызов метода method у объекта receiver
+    void NoteMethodCall(const vector<string>& receiver, const string& method) {
+        if (effects_ == nullptr) {
+            return;
+        }
+        if (receiver.size() == 1 && receiver.front() == "self"sv) {
+            effects_->self_calls.push_back(method);
+        } else {
+            MarkSideEffect();
+        }
+    }
+
     parse::Lexer& lexer_;
-    runtime::Closure declared_classes_;
+    shared_ptr<ParseContext> context_;
+    const ParseOptions& options_;
+    size_t visible_classes_;
+    // Эффекты метода, тело которого сейчас разбирается
+    runtime::MethodEffects* effects_ = nullptr;
+    // Разбирается ли сейчас тело метода
+    bool is_in_method_ = false;
 };
 
 }  // namespace
 
-unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer) {
-    return Parser{lexer}.ParseProgram();
+unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer, const ParseOptions& options) {
+    return Parser{lexer, make_shared<ParseContext>(options)}.ParseProgram();
+}
+
+unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer, const ParseOptions& options,
+                                             ClassTable& classes) {
+    auto context = make_shared<ParseContext>(options);
+    for (const auto& [name, cls] : classes) {
+        context->classes.emplace(name, pair{context->classes.size(), cls});
+    }
+    auto program = Parser{lexer, context}.ParseProgram();
+    for (const auto& [name, declared] : context->classes) {
+        classes.emplace(name, declared.second);
+    }
+    return program;
 }
\ No newline at end of file
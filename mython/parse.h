@@ -2,6 +2,8 @@
 
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <unordered_map>
 
 namespace parse {
 class Lexer;
@@ -9,10 +11,32 @@ class Lexer;
 
 namespace runtime {
 class Executable;
-}
+class Class;
+}  // namespace runtime
 
 struct ParseError : std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
-std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer);
\ No newline at end of file
+// Настройки разбора программы
+struct ParseOptions {
+    // Оптимизировать программу во время разбора: сворачивать константные выражения,
+    // удалять недостижимые ветки if с константным условием, заменять унарный минус на Negate,
+    // выполнять return object.method(args) как хвостовой вызов без роста стека
+    bool optimize = true;
+    // Разбирать тело метода при его первом вызове, а не при объявлении класса.
+    // Ошибки в теле метода обнаруживаются только при его вызове. Такие методы
+    // считаются имеющими побочные эффекты, и их результаты не запоминаются
+    bool lazy_methods = false;
+};
+
+// Классы программы по именам. Классами владеет дерево разобранной программы
+using ClassTable = std::unordered_map<std::string, runtime::Class*>;
+
+std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer,
+                                                  const ParseOptions& options = {});
+
+// Разбирает программу, которой видны классы из classes, как если бы они были объявлены
+// перед её началом. Классы, объявленные самой программой, добавляются в classes
+std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer, const ParseOptions& options,
+                                                  ClassTable& classes);
\ No newline at end of file
@@ -1,18 +1,17 @@
+#include "call_stack.h"
 #include "lexer.h"
+#include "optimizer.h"
 #include "parse.h"
 #include "statement.h"
+#include "test_program_p.h"
 #include "test_runner_p.h"
 
+#include <thread>
+
 using namespace std;
 
 namespace parse {
 
-unique_ptr<ast::Statement> ParseProgramFromString(const string& program) {
-    istringstream is(program);
-    parse::Lexer lexer(is);
-    return ParseProgram(lexer);
-}
-
 void TestSimpleProgram() {
     const string program = R"(
 x = 4
@@ -266,6 +265,553 @@ x = X(xh)
     ASSERT_EQUAL(xh->Fields().at("x"s).Get(), closure.at("x"s).Get());
 }
 
+void TestOptimizationPreservesOutput() {
+    const string program = R"(
+class Checker:
+  def check(x):
+    if 1 + 2 * 3 == 7 and not False:
+      return -x + 10 / 2
+    else:
+      return x / 0
+
+y = -(2 + 3)
+s = "a" + "b" + str(-y)
+if False or None:
+  print "unreachable"
+c = Checker()
+print y, s, c.check(y), "a" < "b" or 1 / 0, 1 > 2 and 1 / 0
+)"s;
+
+    for (bool optimize : {true, false}) {
+        auto tree = ParseProgramFromString(program, ParseOptions{optimize});
+
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        tree->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), "-5 ab5 10 True False\n"s);
+    }
+}
+
+void TestTailRecursion() {
+    const string program = R"(
+class Counter:
+  def count(n, acc):
+    if n == 0:
+      return acc
+    return self.count(n - 1, acc + 1)
+
+class Parity:
+  def is_even(n):
+    if n == 0:
+      return True
+    return self.is_odd(n - 1)
+  def is_odd(n):
+    if n == 0:
+      return False
+    return self.is_even(n - 1)
+
+c = Counter()
+print c.count(30000, 0)
+p = Parity()
+print p.is_even(30001), p.is_odd(30001)
+)"s;
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    auto tree = ParseProgramFromString(program);
+    tree->Execute(closure, context);
+
+    ASSERT_EQUAL(context.output.str(), "30000\nFalse True\n"s);
+}
+
+void TestReturnOutsideMethod() {
+    // Сигнал return забирает только тело метода, поэтому return вне метода не разбирается
+    ASSERT_THROWS(ParseProgramFromString("print 1\nreturn 5\nprint 2\n"s), ParseError);
+    ASSERT_THROWS(ParseProgramFromString("if True:\n  return 5\n"s), ParseError);
+
+    const string tail_call = R"(
+class Counter:
+  def count(n):
+    if n == 0:
+      return 0
+    return self.count(n - 1)
+
+c = Counter()
+print c.count(3)
+)"s;
+    for (const bool lazy_methods : {false, true}) {
+        ParseOptions options;
+        options.lazy_methods = lazy_methods;
+        // Программы выполняются одна за другой в одном потоке: выход из метода
+        // в первой программе не должен прерывать вторую
+        runtime::DummyContext context;
+        for (const string& program : {tail_call, "print \"b1\"\nprint \"b2\"\n"s}) {
+            runtime::Closure closure;
+            ParseProgramFromString(program, options)->Execute(closure, context);
+        }
+        ASSERT_EQUAL(context.output.str(), "0\nb1\nb2\n"s);
+    }
+}
+
+void TestDeepRecursion() {
+    const string program = R"(
+class Summator:
+  def sum(n):
+    if n == 0:
+      return 0
+    return n + self.sum(n - 1)
+
+s = Summator()
+print s.sum(5000)
+)"s;
+
+    {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        auto tree = ParseProgramFromString(program);
+        tree->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), "12502500\n"s);
+    }
+
+    const size_t max_depth = runtime::GetMaxCallDepth();
+    runtime::SetMaxCallDepth(1000);
+    {
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        auto tree = ParseProgramFromString(program);
+        ASSERT_THROWS(tree->Execute(closure, context), runtime::RecursionError);
+    }
+    runtime::SetMaxCallDepth(max_depth);
+}
+
+void TestLoops() {
+    const string program = R"(
+class Math:
+  def first_square_above(limit):
+    for i in range(limit):
+      if i * i > limit:
+        return i
+    return None
+
+i = 0
+total = 0
+while i < 5:
+  i = i + 1
+  total = total + i
+print i, total
+
+squares = ''
+for k in range(1, 4):
+  last = k
+  squares = squares + str(k * k) + ' '
+  k = 100
+print squares, k, last
+
+for n in range(3, 3):
+  print 'never'
+m = Math()
+print m.first_square_above(50), m.first_square_above(0)
+)"s;
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    auto tree = ParseProgramFromString(program);
+    tree->Execute(closure, context);
+
+    ASSERT_EQUAL(context.output.str(), "5 15\n1 4 9  100 3\n8 None\n"s);
+    ASSERT(closure.find("n"s) == closure.end());
+}
+
+void TestMemoization() {
+    const string program = R"(
+class Fib:
+  def fib(n):
+    if n < 2:
+      return n
+    return self.fib(n - 1) + self.fib(n - 2)
+  def label(n):
+    return str(self.fib(n)) + '!'
+
+class Counter:
+  def __init__():
+    self.calls = 0
+  def next(n):
+    self.calls = self.calls + 1
+    return n + self.calls
+  def twice(n):
+    return self.next(n) + self.next(n)
+
+f = Fib()
+c = Counter()
+print f.fib(40), f.label(10), f.label(10)
+print c.twice(1), c.twice(1)
+)"s;
+
+    // Без запоминания всех 41 результата fib(40) вычислялось бы очень долго
+    const bool memoization_enabled = runtime::IsMemoizationEnabled();
+    const size_t memo_table_limit = runtime::GetMemoTableLimit();
+    runtime::SetMemoizationEnabled(true);
+    runtime::SetMemoTableLimit(1000);
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    auto tree = ParseProgramFromString(program);
+    tree->Execute(closure, context);
+    runtime::SetMemoizationEnabled(memoization_enabled);
+    runtime::SetMemoTableLimit(memo_table_limit);
+
+    ASSERT_EQUAL(context.output.str(), "102334155 55! 55!\n5 9\n"s);
+
+    auto fib_stats = context.memo.GetStats(*closure.at("Fib"s).TryAs<runtime::Class>());
+    ASSERT_EQUAL(fib_stats.size(), 2u);
+    ASSERT_EQUAL(fib_stats[0].first, "fib"s);
+    ASSERT_EQUAL(fib_stats[0].second.entries, 41u);
+    ASSERT_EQUAL(fib_stats[1].first, "label"s);
+    ASSERT_EQUAL(fib_stats[1].second.hits, 1u);
+    ASSERT(context.memo.GetStats(*closure.at("Counter"s).TryAs<runtime::Class>()).empty());
+}
+
+void TestConstantFolding() {
+    using namespace ast;
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+
+    auto sum = FoldConstants(make_unique<Add>(
+        make_unique<NumericConst>(1),
+        FoldConstants(make_unique<Mult>(make_unique<NumericConst>(2), make_unique<NumericConst>(3)))));
+    ASSERT(IsConstant(*sum));
+    ASSERT_EQUAL(sum->Execute(closure, context).TryAs<runtime::Number>()->GetValue(), 7);
+
+    auto negated = FoldConstants(make_unique<Negate>(make_unique<NumericConst>(5)));
+    ASSERT(IsConstant(*negated));
+    ASSERT_EQUAL(negated->Execute(closure, context).TryAs<runtime::Number>()->GetValue(), -5);
+
+    auto concat = FoldConstants(make_unique<Add>(make_unique<StringConst>("a"s),
+                                                 make_unique<StringConst>("b"s)));
+    ASSERT(IsConstant(*concat));
+    ASSERT_EQUAL(concat->Execute(closure, context).TryAs<runtime::String>()->GetValue(), "ab"s);
+
+    auto division = FoldConstants(make_unique<Div>(make_unique<NumericConst>(1),
+                                                   make_unique<NumericConst>(0)));
+    ASSERT(!IsConstant(*division));
+    ASSERT_THROWS(division->Execute(closure, context), std::runtime_error);
+
+    auto variable = FoldConstants(make_unique<Add>(make_unique<VariableValue>("x"s),
+                                                   make_unique<NumericConst>(1)));
+    ASSERT(!IsConstant(*variable));
+
+    auto dead_branch = FoldIfElse(make_unique<BoolConst>(runtime::Bool(false)),
+                                  make_unique<Print>(make_unique<StringConst>("if"s)), nullptr);
+    ASSERT(dynamic_cast<Compound*>(dead_branch.get()) != nullptr);
+    auto live_branch = FoldIfElse(make_unique<NumericConst>(1),
+                                  make_unique<Print>(make_unique<StringConst>("if"s)),
+                                  make_unique<Print>(make_unique<StringConst>("else"s)));
+    live_branch->Execute(closure, context);
+    ASSERT_EQUAL(context.output.str(), "if\n"s);
+}
+
+void TestOperatorPrecedence() {
+    const string program = R"(
+x = 3
+print 2 + 3 * -4 - 6 / 2, -x * 2, (1 + 2) * (3 - 5)
+print not 1 < 2 and 3 > 2 or True, not x == 3 or x >= 3 and x <= 2
+print str(1 + 2) + str(-(x - 5)), not not x
+)"s;
+
+    for (bool optimize : {true, false}) {
+        auto tree = ParseProgramFromString(program, ParseOptions{optimize});
+
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        tree->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), "-13 -6 -6\nTrue False\n32 True\n"s);
+    }
+
+    ASSERT_THROWS(ParseProgramFromString("print 1 < 2 < 3\n"s), std::exception);
+    ASSERT_THROWS(ParseProgramFromString("print 1 + not 2\n"s), std::exception);
+    ASSERT_THROWS(ParseProgramFromString("print (1 + 2\n"s), std::exception);
+}
+
+void TestHugeExpressions() {
+    // Разбор, вычисление и разрушение выражений не ограничены размером стека потока
+    constexpr int depth = 10000;
+    const string parens = "print "s + string(depth, '(') + "x"s + string(depth, ')') + "\n"s;
+    string sum = "print x"s;
+    string negations = "print "s;
+    for (int i = 1; i < depth; ++i) {
+        sum += " + x"s;
+        negations += "not "s;
+    }
+    negations += "x\n"s;
+
+    runtime::DummyContext context;
+    runtime::Closure closure{{"x"s, runtime::ObjectHolder::Own(runtime::Number(1))}};
+    ParseProgramFromString(parens)->Execute(closure, context);
+    ParseProgramFromString(sum + "\n"s)->Execute(closure, context);
+    ParseProgramFromString(negations)->Execute(closure, context);
+    ASSERT_EQUAL(context.output.str(), "1\n10000\nFalse\n"s);
+}
+
+void TestLazyMethods() {
+    const string program = R"(
+class Shape:
+  def area():
+    return 0
+
+  def describe():
+    return "area " + str(self.area())
+
+class Rect(Shape):
+  def __init__(w, h):
+    self.w = w
+    self.h = h
+
+  def area():
+    return self.w * self.h
+
+  def countdown(n):
+    if n == 0:
+      return "done"
+    return self.countdown(n - 1)
+
+  def broken():
+    return 1 < 2 < 3
+
+class Factory:
+  def make(w, h):
+    return Rect(w, h)
+
+f = Factory()
+r = f.make(3, 4)
+print r.describe(), r.countdown(10000)
+)"s;
+
+    const string expected = "area 12 done\n"s;
+    for (bool lazy : {false, true}) {
+        ParseOptions options;
+        options.lazy_methods = lazy;
+        unique_ptr<ast::Statement> tree;
+        {
+            istringstream is(program);
+            parse::Lexer lexer(is);
+            if (!lazy) {
+                ASSERT_THROWS(ParseProgram(lexer, options), std::exception);
+                continue;
+            }
+            // Тела методов разбираются после того, как лексер уже разрушен
+            tree = ParseProgram(lexer, options);
+        }
+
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        tree->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), expected);
+        // Ошибка в теле метода обнаруживается при его вызове, в том числе повторном
+        for (int i = 0; i < 2; ++i) {
+            ASSERT_THROWS(closure.at("r"s).TryAs<runtime::ClassInstance>()->Call("broken"s, {}, context),
+                          ParseError);
+        }
+    }
+
+    // При отложенном разборе метод видит только классы, объявленные до него
+    istringstream is(R"(
+class A:
+  def make():
+    return B()
+
+class B:
+  def f():
+    return 1
+
+a = A()
+a.make()
+)"s);
+    parse::Lexer lexer(is);
+    ParseOptions options;
+    options.lazy_methods = true;
+    auto tree = ParseProgram(lexer, options);
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ASSERT_THROWS(tree->Execute(closure, context), ParseError);
+}
+
+
+void TestConcurrentExecution() {
+    const string program = R"(
+class Counter:
+  def __init__(start):
+    self.value = start
+
+  def add(n):
+    self.value = self.value + n
+
+class Fib:
+  def fib(n):
+    if n < 2:
+      return n
+    return self.fib(n - 1) + self.fib(n - 2)
+
+  def countdown(n):
+    if n == 0:
+      return "done"
+    return self.countdown(n - 1)
+
+c = Counter(1)
+for i in range(0, 100):
+  c.add(i)
+label = "fib"
+for i in range(0, 20):
+  label = label + "."
+f = Fib()
+print c.value, label, f.fib(10), f.countdown(200), 2 * 3 + 4
+)"s;
+
+    const string expected = "4951 fib.................... 55 done 10\n"s;
+    constexpr size_t THREAD_COUNT = 4;
+    const bool memoization_enabled = runtime::IsMemoizationEnabled();
+    runtime::SetMemoizationEnabled(true);
+    for (bool lazy : {false, true}) {
+        ParseOptions options;
+        options.lazy_methods = lazy;
+        const unique_ptr<const ast::Statement> tree = ParseProgramFromString(program, options);
+
+        // Одно дерево одновременно выполняется всеми потоками, каждый со своим контекстом
+        vector<string> outputs(THREAD_COUNT);
+        vector<thread> threads;
+        for (size_t i = 0; i < THREAD_COUNT; ++i) {
+            threads.emplace_back([&tree, &output = outputs[i]] {
+                for (int run = 0; run < 2; ++run) {
+                    runtime::DummyContext context;
+                    runtime::Closure closure;
+                    tree->Execute(closure, context);
+                    output += context.output.str();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (const auto& output : outputs) {
+            ASSERT_EQUAL(output, expected + expected);
+        }
+    }
+    runtime::SetMemoizationEnabled(memoization_enabled);
+}
+
+void TestParallelFor() {
+    const string program = R"--(
+class Scorer:
+  def __init__(k):
+    self.k = k
+
+  def score(x):
+    return x * self.k
+
+class Box:
+  def __init__(v):
+    self.v = v
+
+  def bump():
+    self.v = self.v + 1
+    return self.v
+
+scorer = Scorer(3)
+total = 100
+log = 'log:'
+parallel for i in range(0, 1000) sum total, max best, min worst, append log:
+  total = scorer.score(i)
+  box = Box(i)
+  if box.bump() > 995:
+    best = box.v
+  if i < 3:
+    worst = box.v
+    log = str(i) + ';'
+    print 'iteration', i
+    parallel for j in range(0, 3) sum inner:
+      inner = i * j
+    print 'inner', inner
+print total, best, worst, log
+parallel for i in range(5, 3) sum empty:
+  empty = 1
+print empty
+)--"s;
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ParseProgramFromString(program)->Execute(closure, context);
+    // Вывод и свёртки следуют порядку итераций, а присваивания в теле не видны после цикла
+    ASSERT_EQUAL(context.output.str(),
+                 "iteration 0\ninner 0\niteration 1\ninner 3\niteration 2\ninner 6\n"
+                 "1498600 1000 1 log:0;1;2;\nNone\n"s);
+    ASSERT(closure.count("box"s) == 0 && closure.count("inner"s) == 0);
+
+    // Изменение объекта, созданного не итерацией, - гонка данных
+    const string racy = R"--(
+class Counter:
+  def __init__():
+    self.n = 0
+
+  def add():
+    self.n = self.n + 1
+
+c = Counter()
+parallel for i in range(0, 100):
+  print i
+  if i == 50:
+    c.add()
+)--"s;
+    runtime::DummyContext racy_context;
+    runtime::Closure racy_closure;
+    try {
+        ParseProgramFromString(racy)->Execute(racy_closure, racy_context);
+        ASSERT(false);
+    } catch (const runtime_error& e) {
+        ASSERT_EQUAL(string(e.what()),
+                     "Data race: parallel for iteration assigns field n of an object it didn't create"s);
+    }
+    // Выводится всё, что вывели итерации до ошибочной, включительно
+    ASSERT_EQUAL(racy_context.output.str().substr(0, 10), "0\n1\n2\n3\n4\n"s);
+    ASSERT(racy_context.output.str().find("\n50\n"s) != string::npos);
+    ASSERT(racy_context.output.str().find("\n51\n"s) == string::npos);
+
+    ASSERT_THROWS(ParseProgramFromString("parallel for i in range(3) avg x:\n  x = i\n"s),
+                  ParseError);
+    ASSERT_THROWS(ParseProgramFromString("parallel for i in range(3) sum i:\n  x = i\n"s),
+                  ParseError);
+}
+
+void TestParallelForSharedStrings() {
+    // Итерации одновременно собирают и хешируют одни и те же rope-строки программы
+    const string program = R"--(
+class Key:
+  def __init__(text):
+    self.text = text
+
+matches = 0
+for round in range(0, 20):
+  text = ''
+  copy = ''
+  for k in range(0, 30):
+    text = text + 'abcdefghij' + str(k)
+    copy = copy + 'abcdefghij' + str(k)
+  key = Key(text)
+  hits = 0
+  parallel for i in range(0, 64) sum hits:
+    hits = 0
+    if key.text == copy:
+      hits = 1
+    if str(i) + text == str(i) + copy:
+      hits = hits + 1
+  matches = matches + hits
+print matches
+)--"s;
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ParseProgramFromString(program)->Execute(closure, context);
+    ASSERT_EQUAL(context.output.str(), "2560\n"s);
+}
+
 }  // namespace parse
 
 void TestParseProgram(TestRunner& tr) {
@@ -278,4 +824,17 @@ void TestParseProgram(TestRunner& tr) {
     RUN_TEST(tr, parse::TestComplexLogicalExpression);
     RUN_TEST(tr, parse::TestClassicalPolymorphism);
     RUN_TEST(tr, parse::TestSelfInConstructor);
+    RUN_TEST(tr, parse::TestOptimizationPreservesOutput);
+    RUN_TEST(tr, parse::TestConstantFolding);
+    RUN_TEST(tr, parse::TestOperatorPrecedence);
+    RUN_TEST(tr, parse::TestHugeExpressions);
+    RUN_TEST(tr, parse::TestTailRecursion);
+    RUN_TEST(tr, parse::TestReturnOutsideMethod);
+    RUN_TEST(tr, parse::TestDeepRecursion);
+    RUN_TEST(tr, parse::TestLoops);
+    RUN_TEST(tr, parse::TestMemoization);
+    RUN_TEST(tr, parse::TestLazyMethods);
+    RUN_TEST(tr, parse::TestConcurrentExecution);
+    RUN_TEST(tr, parse::TestParallelFor);
+    RUN_TEST(tr, parse::TestParallelForSharedStrings);
 }
\ No newline at end of file
@@ -0,0 +1,304 @@
+#include "profiler.h"
+
+#include "runtime.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if __has_include(<sys/time.h>) && __has_include(<signal.h>)
+#include <signal.h>
+#include <sys/time.h>
+#define MYTHON_HAS_PROFILER 1
+#endif
+
+using namespace std;
+
+namespace runtime {
+
+namespace detail {
+
+/*
+Буфер выборок. Выборка занимает несколько подряд идущих записей: заголовок с числом кадров,
+кадры от выполнявшегося метода к вызвавшим его и запись кода вне методов с его строкой.
+Обработчик сигнала резервирует место под выборку атомарным увеличением used
+*/
+struct SampleBuffer {
+    struct Entry {
+        const Class* cls;
+        const Method* method;
+        // В заголовке — число кадров, в остальных записях — строка инструкции
+        uint32_t value;
+        // В заголовке: true, если стек обрезан у корня
+        bool is_truncated;
+    };
+
+    explicit SampleBuffer(size_t capacity)
+        : entries(new Entry[capacity])
+        , capacity(capacity) {
+    }
+
+    // Записывает теневой стек текущего потока. Вызывается из обработчика сигнала
+    void Record() {
+        const ShadowFrame* top = shadow_top;
+        uint32_t line = current_line;
+        if (top == nullptr && line == 0) {
+            native_samples.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        size_t depth = 0;
+        const ShadowFrame* frame = top;
+        for (; frame != nullptr && depth < SamplingProfiler::MAX_SAMPLE_DEPTH; frame = frame->caller) {
+            ++depth;
+        }
+        const size_t size = depth + 2;
+        const size_t pos = used.fetch_add(size, memory_order_relaxed);
+        if (pos + size > capacity) {
+            // Место после первой неудачной попытки не заполняется
+            size_t end = valid_end.load(memory_order_relaxed);
+            while (pos < end && !valid_end.compare_exchange_weak(end, pos, memory_order_relaxed)) {
+            }
+            dropped_samples.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        Entry* entry = &entries[pos];
+        *entry++ = {nullptr, nullptr, static_cast<uint32_t>(depth), frame != nullptr};
+        for (frame = top; depth > 0; --depth, frame = frame->caller) {
+            *entry++ = {frame->cls, frame->method, line, false};
+            line = frame->caller_line;
+        }
+        *entry = {nullptr, nullptr, line, false};
+    }
+
+    // Забывает выборки, уже учтённые в Stop. Вызывается, пока буфер не используется
+    void Reset() {
+        used = 0;
+        valid_end = numeric_limits<size_t>::max();
+        native_samples = 0;
+        dropped_samples = 0;
+    }
+
+    unique_ptr<Entry[]> entries;
+    size_t capacity;
+    atomic<size_t> used{0};
+    atomic<size_t> valid_end{numeric_limits<size_t>::max()};
+    atomic<size_t> native_samples{0};
+    atomic<size_t> dropped_samples{0};
+};
+
+}  // namespace detail
+
+namespace {
+
+// Буфер работающего профилировщика и число выполняющихся обработчиков сигнала
+atomic<detail::SampleBuffer*> active_buffer{nullptr};
+atomic<int> running_handlers{0};
+
+#ifdef MYTHON_HAS_PROFILER
+void HandleProfilerSignal(int /*signal*/) {
+    const int saved_errno = errno;
+    running_handlers.fetch_add(1);
+    if (detail::SampleBuffer* buffer = active_buffer.load()) {
+        buffer->Record();
+    }
+    running_handlers.fetch_sub(1);
+    errno = saved_errno;
+}
+
+void SetTimer(chrono::microseconds interval) {
+    itimerval timer{};
+    timer.it_interval.tv_sec = static_cast<time_t>(interval.count() / 1'000'000);
+    timer.it_interval.tv_usec = static_cast<suseconds_t>(interval.count() % 1'000'000);
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+        throw runtime_error("Can't start the profiling timer"s);
+    }
+}
+#endif
+
+string FrameName(const Class* cls, const Method* method) {
+    if (method == nullptr) {
+        return "<module>"s;
+    }
+    return cls->GetName() + "."s + method->name;
+}
+
+}  // namespace
+
+SamplingProfiler::SamplingProfiler(chrono::microseconds interval, size_t buffer_frames)
+    : interval_(max(interval, chrono::microseconds(1)))
+    , buffer_(make_unique<detail::SampleBuffer>(max(buffer_frames, MAX_SAMPLE_DEPTH + 2))) {
+}
+
+SamplingProfiler::~SamplingProfiler() {
+    Stop();
+}
+
+void SamplingProfiler::Start() {
+    if (is_running_) {
+        return;
+    }
+    // Выборки прежних запусков уже учтены, поэтому буфер заполняется заново
+    buffer_->Reset();
+    detail::SampleBuffer* expected = nullptr;
+    if (!active_buffer.compare_exchange_strong(expected, buffer_.get())) {
+        throw logic_error("Another profiler is already running"s);
+    }
+#ifdef MYTHON_HAS_PROFILER
+    // Обработчик остаётся установленным и после остановки: сигнал, отправленный таймером
+    // перед остановкой, может прийти позже, и действие по умолчанию завершило бы процесс
+    struct sigaction action {};
+    action.sa_handler = HandleProfilerSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    try {
+        if (sigaction(SIGPROF, &action, nullptr) != 0) {
+            throw runtime_error("Can't install the profiling signal handler"s);
+        }
+        SetTimer(interval_);
+    } catch (...) {
+        active_buffer = nullptr;
+        throw;
+    }
+#endif
+    is_running_ = true;
+}
+
+void SamplingProfiler::Stop() {
+    if (!is_running_) {
+        return;
+    }
+    is_running_ = false;
+#ifdef MYTHON_HAS_PROFILER
+    SetTimer(chrono::microseconds(0));
+#endif
+    active_buffer = nullptr;
+    while (running_handlers.load() != 0) {
+        this_thread::yield();
+    }
+
+    // Выборки объединяются по стекам и по методам
+    const detail::SampleBuffer& buffer = *buffer_;
+    const size_t end = min({buffer.used.load(), buffer.valid_end.load(), buffer.capacity});
+    unordered_set<string> seen;
+    vector<pair<string, uint32_t>> frames;
+    for (size_t pos = 0; pos < end;) {
+        const auto& header = buffer.entries[pos];
+        const size_t depth = header.value;
+        frames.clear();
+        for (size_t i = depth + 1; i > 0; --i) {
+            const auto& entry = buffer.entries[pos + i];
+            frames.emplace_back(FrameName(entry.cls, entry.method), entry.value);
+        }
+        if (header.is_truncated) {
+            frames.front() = {"[truncated]"s, 0};
+        }
+        pos += depth + 2;
+
+        string stack;
+        seen.clear();
+        for (const auto& [name, line] : frames) {
+            if (!stack.empty()) {
+                stack += ';';
+            }
+            stack += name;
+            if (line != 0) {
+                stack += ':';
+                stack += to_string(line);
+            }
+            if (seen.insert(name).second) {
+                ++methods_[name].total_samples;
+            }
+        }
+        ++stacks_[stack];
+        MethodStats& self = methods_[frames.back().first];
+        ++self.self_samples;
+        ++self.lines[frames.back().second];
+        ++sample_count_;
+    }
+    native_samples_ += buffer.native_samples.load();
+    sample_count_ += buffer.native_samples.load();
+    dropped_samples_ += buffer.dropped_samples.load();
+}
+
+size_t SamplingProfiler::GetSampleCount() const {
+    return sample_count_;
+}
+
+size_t SamplingProfiler::GetDroppedSamples() const {
+    return dropped_samples_;
+}
+
+const map<string, size_t>& SamplingProfiler::GetCollapsedStacks() const {
+    return stacks_;
+}
+
+const map<string, SamplingProfiler::MethodStats>& SamplingProfiler::GetMethodStats() const {
+    return methods_;
+}
+
+void SamplingProfiler::WriteCollapsedStacks(ostream& out) const {
+    for (const auto& [stack, count] : stacks_) {
+        out << stack << ' ' << count << '\n';
+    }
+}
+
+void SamplingProfiler::WriteTopTable(ostream& out, size_t top) const {
+    const size_t mython_samples = sample_count_ - native_samples_;
+    out << "Samples: "sv << sample_count_ << ", in Mython code: "sv << mython_samples
+        << ", dropped: "sv << dropped_samples_ << '\n';
+    if (mython_samples == 0) {
+        return;
+    }
+
+    vector<const pair<const string, MethodStats>*> order;
+    for (const auto& method : methods_) {
+        order.push_back(&method);
+    }
+    sort(order.begin(), order.end(), [](const auto* lhs, const auto* rhs) {
+        return lhs->second.self_samples != rhs->second.self_samples
+                   ? lhs->second.self_samples > rhs->second.self_samples
+                   : lhs->first < rhs->first;
+    });
+    order.resize(min(order.size(), top));
+
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << fixed << setprecision(1);
+    out << setw(7) << "self%"sv << setw(8) << "self"sv << setw(8) << "total"sv << "  method"sv
+        << " (hottest lines)"sv << '\n';
+    for (const auto* method : order) {
+        const MethodStats& stats = method->second;
+        out << setw(6) << 100.0 * static_cast<double>(stats.self_samples) / mython_samples << '%'
+            << setw(8) << stats.self_samples << setw(8) << stats.total_samples << "  "sv
+            << method->first;
+        vector<pair<uint32_t, size_t>> lines(stats.lines.begin(), stats.lines.end());
+        sort(lines.begin(), lines.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.second != rhs.second ? lhs.second > rhs.second : lhs.first < rhs.first;
+        });
+        lines.resize(min<size_t>(lines.size(), 3));
+        bool is_first = true;
+        for (const auto& [line, count] : lines) {
+            if (line == 0) {
+                continue;
+            }
+            out << (is_first ? " ("sv : ", "sv) << "line "sv << line << ": "sv << count;
+            is_first = false;
+        }
+        if (!is_first) {
+            out << ')';
+        }
+        out << '\n';
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}  // namespace runtime
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace runtime {
+
+class Class;
+struct Method;
+
+/*
+Кадр теневого стека: вызов метода Mython, выполняемый потоком.
+
+Теневой стек повторяет стек вызовов методов Mython, чтобы профилировщик мог прочитать его
+из обработчика сигнала. Кадры живут на стеке потока, а номер строки выполняемой инструкции
+хранится в отдельной переменной потока: составная инструкция записывает его перед каждой
+инструкцией, а кадр при создании запоминает строку вызывающего кода
+*/
+struct ShadowFrame {
+    const Class* cls = nullptr;
+    const Method* method = nullptr;
+    // Строка вызывающего кода, из которой вызван метод
+    uint32_t caller_line = 0;
+    ShadowFrame* caller = nullptr;
+};
+
+namespace detail {
+struct SampleBuffer;
+
+// Вершина теневого стека потока и строка выполняемой инструкции
+inline thread_local ShadowFrame* shadow_top = nullptr;
+inline thread_local uint32_t current_line = 0;
+}  // namespace detail
+
+// Отмечает строку инструкции, которую начинает выполнять поток
+inline void SetCurrentLine(uint32_t line) {
+    detail::current_line = line;
+}
+
+// Добавляет кадр вызова метода в теневой стек потока на время своего существования
+class ShadowFrameGuard {
+public:
+    ShadowFrameGuard(const Class& cls, const Method& method) {
+        frame_.cls = &cls;
+        frame_.method = &method;
+        frame_.caller_line = detail::current_line;
+        frame_.caller = detail::shadow_top;
+        // До первой инструкции метода строка вызывающего кода не относится к кадру
+        detail::current_line = 0;
+        // Обработчик сигнала должен увидеть кадр заполненным
+        std::atomic_signal_fence(std::memory_order_release);
+        detail::shadow_top = &frame_;
+    }
+
+    ~ShadowFrameGuard() {
+        detail::shadow_top = frame_.caller;
+        std::atomic_signal_fence(std::memory_order_release);
+        detail::current_line = frame_.caller_line;
+    }
+
+    ShadowFrameGuard(const ShadowFrameGuard&) = delete;
+    ShadowFrameGuard& operator=(const ShadowFrameGuard&) = delete;
+
+private:
+    ShadowFrame frame_;
+};
+
+// Заменяет метод верхнего кадра теневого стека потока, если он есть:
+// хвостовой вызов выполняется в кадре вызывающего метода
+inline void ReplaceTopShadowFrame(const Class& cls, const Method& method) {
+    if (ShadowFrame* top = detail::shadow_top) {
+        detail::current_line = 0;
+        std::atomic_signal_fence(std::memory_order_release);
+        top->cls = &cls;
+        top->method = &method;
+    }
+}
+
+/*
+Профилировщик, который по сигналу SIGPROF таймера процессорного времени записывает
+теневой стек прерванного потока: классы, методы и строки выполняемых инструкций.
+
+Обработчик сигнала не выделяет памяти и не захватывает блокировок: выборки записываются
+в заранее выделенный буфер, а при его заполнении отбрасываются и подсчитываются.
+Имена классов и методов определяются в Stop, поэтому программа, методы которой
+профилируются, должна существовать до вызова Stop.
+
+Одновременно может работать только один профилировщик. На платформах без setitimer
+выборки не записываются
+*/
+class SamplingProfiler {
+public:
+    // Период выборок по умолчанию
+    static constexpr std::chrono::microseconds DEFAULT_INTERVAL{1000};
+    // Сколько кадров по умолчанию вмещает буфер выборок
+    static constexpr size_t DEFAULT_BUFFER_FRAMES = 1 << 20;
+    // Наибольшее число кадров одной выборки. Более глубокие стеки обрезаются у корня
+    static constexpr size_t MAX_SAMPLE_DEPTH = 256;
+
+    // Выборки метода: собственные — когда метод выполнялся сам, общие — когда он был в стеке
+    struct MethodStats {
+        size_t self_samples = 0;
+        size_t total_samples = 0;
+        // Собственные выборки по строкам метода. Строка 0 - выборки до первой инструкции тела
+        std::map<uint32_t, size_t> lines;
+    };
+
+    explicit SamplingProfiler(std::chrono::microseconds interval = DEFAULT_INTERVAL,
+                              size_t buffer_frames = DEFAULT_BUFFER_FRAMES);
+    // Останавливает профилировщик, если он работает
+    ~SamplingProfiler();
+
+    SamplingProfiler(const SamplingProfiler&) = delete;
+    SamplingProfiler& operator=(const SamplingProfiler&) = delete;
+
+    // Начинает запись выборок. Если уже работает другой профилировщик, выбрасывает logic_error,
+    // а при ошибке настройки таймера — runtime_error
+    void Start();
+    // Прекращает запись выборок и добавляет записанные выборки к выборкам прежних запусков
+    void Stop();
+
+    // Число записанных выборок, в том числе выборок вне кода Mython, и отброшенных выборок
+    [[nodiscard]] size_t GetSampleCount() const;
+    [[nodiscard]] size_t GetDroppedSamples() const;
+
+    // Выборки по стекам в свёрнутом виде: кадры от корня через ';', например
+    // "<module>:12;Fib.fib:5;Fib.fib:5". Выборки вне кода Mython не учитываются
+    [[nodiscard]] const std::map<std::string, size_t>& GetCollapsedStacks() const;
+    // Выборки по методам. Ключ — "Класс.метод", код вне методов — "<module>"
+    [[nodiscard]] const std::map<std::string, MethodStats>& GetMethodStats() const;
+
+    // Выводит свёрнутые стеки в формате flamegraph.pl: стек, пробел и число выборок
+    void WriteCollapsedStacks(std::ostream& out) const;
+    // Выводит top методов с наибольшим числом собственных выборок и их самые частые строки
+    void WriteTopTable(std::ostream& out, size_t top) const;
+
+private:
+    std::chrono::microseconds interval_;
+    std::unique_ptr<detail::SampleBuffer> buffer_;
+    bool is_running_ = false;
+
+    size_t sample_count_ = 0;
+    size_t dropped_samples_ = 0;
+    size_t native_samples_ = 0;
+    std::map<std::string, size_t> stacks_;
+    std::map<std::string, MethodStats> methods_;
+};
+
+}  // namespace runtime
@@ -0,0 +1,125 @@
+#include "profiler.h"
+
+#include "lexer.h"
+#include "statement.h"
+#include "test_program_p.h"
+#include "test_runner_p.h"
+
+#include <sstream>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+void TestLexerLines() {
+    istringstream input("x = 1\n\n# comment\ny = 2\nif x:\n  z = 3\n"s);
+    parse::Lexer lexer(input);
+    ASSERT_EQUAL(lexer.CurrentLine(), 1U);
+    lexer.ExpectNext<parse::token_type::Char>('=');
+    ASSERT_EQUAL(lexer.CurrentLine(), 1U);
+    lexer.NextToken();
+    ASSERT(lexer.NextToken().Is<parse::token_type::Newline>());
+    ASSERT_EQUAL(lexer.CurrentLine(), 1U);
+    lexer.NextToken();
+    ASSERT_EQUAL(lexer.CurrentLine(), 4U);
+    ASSERT(lexer.CurrentToken() == parse::Token(parse::token_type::Id{"y"s}));
+
+    // Записанный блок сохраняет номера строк своих лексем
+    istringstream block_input("def f():\n  a = 1\n\n  b = 2\nc = 3\n"s);
+    parse::Lexer block_lexer(block_input);
+    while (!block_lexer.CurrentToken().Is<parse::token_type::Newline>()) {
+        block_lexer.NextToken();
+    }
+    parse::Lexer recorded(block_lexer.RecordBlock());
+    vector<uint32_t> lines;
+    for (; !recorded.CurrentToken().Is<parse::token_type::Eof>(); recorded.NextToken()) {
+        if (recorded.CurrentToken().Is<parse::token_type::Id>()) {
+            lines.push_back(recorded.CurrentLine());
+        }
+    }
+    ASSERT_EQUAL(lines, (vector<uint32_t>{2, 4}));
+    ASSERT_EQUAL(block_lexer.CurrentLine(), 5U);
+}
+
+void TestSamplingProfiler() {
+    const string program = R"--(
+class Fib:
+  def fib(n):
+    if n < 2:
+      return n
+    return self.fib(n - 1) + self.fib(n - 2)
+
+f = Fib()
+i = 0
+while i < 10:
+  x = f.fib(15)
+  i = i + 1
+)--"s;
+    auto tree = ParseProgramFromString(program);
+
+    // Запомненные результаты fib сократили бы выполнение до нескольких вызовов
+    const bool memoization_enabled = IsMemoizationEnabled();
+    SetMemoizationEnabled(false);
+    SamplingProfiler profiler(chrono::microseconds(200));
+    // Выборки делаются по процессорному времени, поэтому программа выполняется,
+    // пока их не наберётся достаточно
+    for (size_t attempt = 0; attempt < 200 && profiler.GetSampleCount() < 5; ++attempt) {
+        profiler.Start();
+        ostringstream output;
+        SimpleContext context{output};
+        Closure closure;
+        tree->Execute(closure, context);
+        profiler.Stop();
+    }
+    SetMemoizationEnabled(memoization_enabled);
+    ASSERT(profiler.GetSampleCount() >= 5);
+    ASSERT_EQUAL(profiler.GetDroppedSamples(), 0U);
+
+    // Повторный запуск не учитывает выборки прежних запусков ещё раз
+    const size_t sample_count = profiler.GetSampleCount();
+    profiler.Start();
+    profiler.Stop();
+    ASSERT(profiler.GetSampleCount() <= sample_count + 2);
+
+    // Почти всё время выполняется метод fib, вызванный из строки 11
+    const auto& methods = profiler.GetMethodStats();
+    ASSERT(methods.count("Fib.fib"s) > 0);
+    const auto& fib = methods.at("Fib.fib"s);
+    ASSERT(fib.self_samples > 0);
+    ASSERT(fib.total_samples >= fib.self_samples);
+    for (const auto& [line, count] : fib.lines) {
+        ASSERT(line == 0 || (line >= 4 && line <= 6));
+    }
+    bool has_recursive_stack = false;
+    for (const auto& [stack, count] : profiler.GetCollapsedStacks()) {
+        ASSERT(stack.rfind("<module>:11;Fib.fib:"s, 0) == 0 || stack.rfind("<module>:"s, 0) == 0);
+        has_recursive_stack = has_recursive_stack || stack.find(";Fib.fib:6;Fib.fib:"s) != string::npos;
+    }
+    ASSERT(has_recursive_stack);
+
+    ostringstream collapsed;
+    profiler.WriteCollapsedStacks(collapsed);
+    ASSERT(collapsed.str().find("<module>:11;Fib.fib:6;Fib.fib:"s) != string::npos);
+    ostringstream table;
+    profiler.WriteTopTable(table, 5);
+    ASSERT(table.str().find("  Fib.fib (line "s) != string::npos);
+
+    // Одновременно может работать только один профилировщик
+    profiler.Start();
+    SamplingProfiler other;
+    ASSERT_THROWS(other.Start(), logic_error);
+    profiler.Stop();
+    other.Start();
+    other.Stop();
+}
+
+}  // namespace
+
+void RunProfilerTests(TestRunner& tr) {
+    RUN_TEST(tr, TestLexerLines);
+    RUN_TEST(tr, TestSamplingProfiler);
+}
+
+}  // namespace runtime
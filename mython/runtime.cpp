@@ -1,8 +1,18 @@
 #include "runtime.h"
 
+#include "call_stack.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
-#include <optional>
+#include <mutex>
 #include <sstream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
@@ -17,8 +27,9 @@ void ObjectHolder::AssertIsValid() const {
 }
 
 ObjectHolder ObjectHolder::Share(Object& object) {
-    // Возвращаем невладеющий shared_ptr (его deleter ничего не делает)
-    return ObjectHolder(std::shared_ptr<Object>(&object, [](auto* /*p*/) { /* do nothing */ }));
+    // Возвращаем невладеющий shared_ptr. Конструктор псевдонима с пустым владельцем
+    // не создаёт блок управления, поэтому не выделяет память
+    return ObjectHolder(std::shared_ptr<Object>(std::shared_ptr<Object>(), &object));
 }
 
 ObjectHolder ObjectHolder::None() {
@@ -43,12 +54,16 @@ ObjectHolder::operator bool() const {
     return Get() != nullptr;
 }
 
+bool ObjectHolder::IsUnique() const {
+    return data_.use_count() == 1;
+}
+
 bool IsTrue(const ObjectHolder& object) {
     if (!object) return false;
     if (object.TryAs<Number>() != nullptr && object.TryAs<Number>()->GetValue() == 0) {
         return false;
     }
-    if (object.TryAs<String>() != nullptr && object.TryAs<String>()->GetValue().empty()) {
+    if (object.TryAs<String>() != nullptr && object.TryAs<String>()->Size() == 0) {
         return false;
     }
     if (object.TryAs<Bool>() != nullptr && object.TryAs<Bool>()->GetValue() == false) {
@@ -76,6 +91,10 @@ bool ClassInstance::HasMethod(const std::string& method, size_t argument_count)
     return false;
 }
 
+Class& ClassInstance::GetClass() const {
+    return *cls_.TryAs<Class>();
+}
+
 Closure& ClassInstance::Fields() {
     return fields_;
 }
@@ -88,39 +107,205 @@ ClassInstance::ClassInstance(Class& cls) {
     cls_ = move(ObjectHolder::Share(cls));
 }
 
-ObjectHolder ClassInstance::Call(const std::string& method,
-                                 const std::vector<ObjectHolder>& actual_args,
+ClassInstance::~ClassInstance() {
+    // Экземпляры, которыми владеют только поля освобождаемых экземпляров, откладываются
+    // и освобождаются по одному самым внешним деструктором
+    thread_local std::vector<ObjectHolder>* pending = nullptr;
+    std::vector<ObjectHolder> released;
+    const bool is_outermost = pending == nullptr;
+    if (is_outermost) {
+        pending = &released;
+    }
+    for (auto& [name, value] : fields_) {
+        if (value.IsUnique() && value.TryAs<ClassInstance>() != nullptr) {
+            pending->push_back(std::move(value));
+        }
+    }
+    if (!is_outermost) {
+        return;
+    }
+    while (!released.empty()) {
+        ObjectHolder instance = std::move(released.back());
+        released.pop_back();
+    }
+    pending = nullptr;
+}
+
+namespace {
+// Сколько свободных кадров вызовов хранится в пуле потока
+constexpr size_t MAX_POOLED_FRAMES = 256;
+
+// Пул кадров вызовов методов текущего потока. Возвращённый в пул кадр очищается,
+// но сохраняет выделенный массив корзин
+thread_local std::vector<std::unique_ptr<Closure>> frame_pool;
+
+// Кадр вызова метода, взятый из пула на время вызова
+class PooledFrame {
+public:
+    PooledFrame() {
+        if (frame_pool.empty()) {
+            frame_ = std::make_unique<Closure>();
+        } else {
+            frame_ = std::move(frame_pool.back());
+            frame_pool.pop_back();
+        }
+    }
+
+    ~PooledFrame() {
+        if (frame_pool.size() < MAX_POOLED_FRAMES) {
+            frame_->clear();
+            frame_pool.push_back(std::move(frame_));
+        }
+    }
+
+    PooledFrame(const PooledFrame&) = delete;
+    PooledFrame& operator=(const PooledFrame&) = delete;
+
+    Closure& Get() {
+        return *frame_;
+    }
+
+private:
+    std::unique_ptr<Closure> frame_;
+};
+}  // namespace
+
+ObjectHolder ClassInstance::Call(const std::string& method, ArgumentSpan actual_args,
                                  Context& context) {
+    SafePoint();
+    CallDepthGuard depth_guard;
+
+    MemoCache* memo_cache = IsMemoizationEnabled() ? context.GetMemoCache() : nullptr;
+    MemoTable* memo = memo_cache != nullptr ? memo_cache->GetTable(GetClass(), method) : nullptr;
+    std::string memo_key;
+    if (memo != nullptr && MemoTable::MakeKey(actual_args, memo_key)) {
+        if (const ObjectHolder* cached = memo->Find(memo_key)) {
+            return *cached;
+        }
+    } else {
+        memo = nullptr;
+    }
+
+    PooledFrame frame;
+    Closure& function_args = frame.Get();
+    const Method& meth = BindCall(method, actual_args, function_args);
+    if (meth.body) {
+        CountMethodCall(GetClass(), meth);
+        ShadowFrameGuard shadow_frame(GetClass(), meth);
+        CallTraceSpan trace_span(GetClass(), meth, actual_args.size());
+        ObjectHolder result;
+        RunWithStackReserve([&] {
+            result = meth.body->Execute(function_args, context);
+        });
+        if (memo != nullptr) {
+            memo->Insert(std::move(memo_key), result);
+        }
+        return result;
+    }
+    Throw(std::runtime_error("Not implemented"s));
+}
+
+const Method& ClassInstance::BindCall(const std::string& method, ArgumentSpan actual_args,
+                                      Closure& frame) {
     if (!HasMethod(method, actual_args.size())) {
-        throw std::runtime_error("Not implemented"s);
+        Throw(std::runtime_error("Not implemented"s));
     }
     auto meth = cls_.TryAs<Class>()->GetMethod(method);
-    Closure function_args;
-    function_args["self"] = ObjectHolder::Share(*this);
-    for (size_t i = 0; i < actual_args.size(); ++ i) {
-        if (meth->formal_params[i] == "self") continue;
-        function_args[meth->formal_params[i]] = actual_args[i];
+    frame.clear();
+    frame["self"] = ObjectHolder::Share(*this);
+    for (size_t i : meth->bound_params) {
+        frame[meth->formal_params[i]] = actual_args[i];
     }
-    if (meth->body) {
-        return meth->body->Execute(function_args, context);
+    return *meth;
+}
+
+Class::Class(std::string name, std::vector<Method> methods, const Class* parent) : name_(name), methods_(move(methods)), parent_(parent) {
+    for (auto& method : methods_) {
+        method.bound_params.clear();
+        for (size_t i = 0; i < method.formal_params.size(); ++i) {
+            if (method.formal_params[i] != "self") {
+                method.bound_params.push_back(i);
+            }
+        }
     }
-    throw std::runtime_error("Not implemented"s);
+    FindPureMethods();
 }
 
-Class::Class(std::string name, std::vector<Method> methods, const Class* parent) : name_(name), methods_(move(methods)), parent_(parent){ }
+void Class::FindPureMethods() {
+    unordered_map<string, const Method*> pure;
+    for (const Class* cls = this; cls != nullptr; cls = cls->parent_) {
+        for (const auto& method : cls->methods_) {
+            if (GetMethod(method.name) == &method && method.effects.is_side_effect_free) {
+                pure.emplace(method.name, &method);
+            }
+        }
+    }
 
-const Method* Class::GetMethod(const std::string& name) const {
-    for (const auto& method : methods_) {
-        if (method.name == name) {
-            return &method;
+    // Метод перестаёт считаться чистым, если вызывает у self метод, не являющийся чистым.
+    // Повторяем, пока множество чистых методов меняется
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = pure.begin(); it != pure.end();) {
+            const auto& calls = it->second->effects.self_calls;
+            bool calls_impure = any_of(calls.begin(), calls.end(), [&pure](const string& name) {
+                return pure.count(name) == 0;
+            });
+            if (calls_impure) {
+                it = pure.erase(it);
+                changed = true;
+            } else {
+                ++it;
+            }
         }
     }
-    if (parent_ == nullptr) {
-        return nullptr;
-    } else {
-        return parent_->GetMethod(name);
+
+    for (const auto& [name, method] : pure) {
+        pure_methods_.push_back(name);
     }
+    sort(pure_methods_.begin(), pure_methods_.end());
+}
 
+const std::vector<std::string>& Class::GetPureMethods() const {
+    return pure_methods_;
+}
+
+MemoTable* MemoCache::GetTable(const Class& cls, const std::string& method) {
+    auto [it, inserted] = tables_.try_emplace(&cls);
+    if (inserted) {
+        for (const auto& name : cls.GetPureMethods()) {
+            it->second[name];
+        }
+    }
+    auto table = it->second.find(method);
+    return table == it->second.end() ? nullptr : &table->second;
+}
+
+std::vector<std::pair<std::string, MemoStats>> MemoCache::GetStats(const Class& cls) const {
+    std::vector<std::pair<std::string, MemoStats>> result;
+    auto tables = tables_.find(&cls);
+    for (const auto& name : cls.GetPureMethods()) {
+        MemoStats stats;
+        if (tables != tables_.end()) {
+            stats = tables->second.at(name).GetStats();
+        }
+        result.emplace_back(name, stats);
+    }
+    return result;
+}
+
+const Method* Class::GetMethod(const std::string& name) const {
+    size_t parent_steps = 0;
+    for (const Class* cls = this; cls != nullptr; cls = cls->parent_, ++parent_steps) {
+        for (const auto& method : cls->methods_) {
+            if (method.name == name) {
+                detail::CountMethodLookup(parent_steps);
+                return &method;
+            }
+        }
+    }
+    detail::CountMethodLookup(parent_steps - 1);
+    return nullptr;
 }
 
 [[nodiscard]] const std::string& Class::GetName() const {
@@ -131,10 +316,300 @@ void Class::Print(ostream& os, Context& /*context*/) {
     os << "Class " << GetName();
 }
 
+Module::Module(std::string name)
+    : name_(std::move(name)) {
+}
+
+void Module::Print(ostream& os, Context& /*context*/) {
+    os << "Module "sv << name_;
+}
+
+const std::string& Module::GetName() const {
+    return name_;
+}
+
+Closure& Module::Names() {
+    return names_;
+}
+
+namespace {
+atomic<bool> memoization_enabled{false};
+atomic<size_t> memo_table_limit{100000};
+}  // namespace
+
+void SetMemoizationEnabled(bool enabled) {
+    memoization_enabled = enabled;
+}
+
+bool IsMemoizationEnabled() {
+    return memoization_enabled;
+}
+
+void SetMemoTableLimit(size_t limit) {
+    memo_table_limit = limit;
+}
+
+size_t GetMemoTableLimit() {
+    return memo_table_limit;
+}
+
+bool MemoTable::MakeKey(ArgumentSpan args, std::string& key) {
+    key.clear();
+    for (const auto& arg : args) {
+        if (!arg) {
+            key += 'n';
+        } else if (const auto* num = arg.TryAs<Number>()) {
+            key += 'i';
+            key += to_string(num->GetValue());
+            key += ';';
+        } else if (const auto* boolean = arg.TryAs<Bool>()) {
+            key += boolean->GetValue() ? 'T' : 'F';
+        } else if (const auto* str = arg.TryAs<String>()) {
+            key += 's';
+            key += to_string(str->Size());
+            key += ':';
+            key += str->GetValue();
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+const ObjectHolder* MemoTable::Find(const std::string& key) {
+    auto it = results_.find(key);
+    if (it == results_.end()) {
+        ++stats_.misses;
+        return nullptr;
+    }
+    ++stats_.hits;
+    return &it->second;
+}
+
+void MemoTable::Insert(std::string key, ObjectHolder result) {
+    if (result && !result.TryAs<Number>() && !result.TryAs<String>() && !result.TryAs<Bool>()) {
+        return;
+    }
+    if (results_.size() >= memo_table_limit) {
+        return;
+    }
+    results_.emplace(std::move(key), std::move(result));
+    stats_.entries = results_.size();
+}
+
+const MemoStats& MemoTable::GetStats() const {
+    return stats_;
+}
+
 void Bool::Print(std::ostream& os, [[maybe_unused]] Context& context) {
     os << (GetValue() ? "True"sv : "False"sv);
 }
 
+namespace {
+// Строки не длиннее этого порога при конкатенации сразу копируются в непрерывный буфер:
+// для них узел дерева обходится дороже самого копирования
+constexpr size_t FLAT_CONCAT_LIMIT = 64;
+}  // namespace
+
+// Узел rope-строки. Лист хранит значение в flat, внутренний узел - ссылки на левую и правую части.
+// После сборки значения внутренний узел становится листом.
+// Одну строку могут читать несколько потоков, например итерации parallel for, поэтому
+// узлы собираются под общим мьютексом, а собранное значение и хеш публикуются атомарно
+struct String::Rope {
+    explicit Rope(std::string value)
+        : size(value.size())
+        , flat(std::move(value))
+        , is_flat(true)
+        , charged(size) {
+        detail::ChargeHeap(charged);
+    }
+
+    Rope(std::shared_ptr<Rope> lhs, std::shared_ptr<Rope> rhs)
+        : size(lhs->size + rhs->size)
+        , left(std::move(lhs))
+        , right(std::move(rhs)) {
+    }
+
+    Rope(const Rope&) = delete;
+    Rope& operator=(const Rope&) = delete;
+
+    // Цепочка из многих конкатенаций образует очень глубокое дерево,
+    // поэтому узлы освобождаются итеративно, а не рекурсивным вызовом деструкторов
+    ~Rope() {
+        if (interned) {
+            ForgetInterned();
+        }
+        detail::ReleaseHeap(charged);
+        std::vector<std::shared_ptr<Rope>> pending;
+        pending.push_back(std::move(left));
+        pending.push_back(std::move(right));
+        while (!pending.empty()) {
+            std::shared_ptr<Rope> node = std::move(pending.back());
+            pending.pop_back();
+            if (node && node.use_count() == 1) {
+                pending.push_back(std::move(node->left));
+                pending.push_back(std::move(node->right));
+            }
+        }
+    }
+
+    // Собирает значение узла в flat, обходя дерево без рекурсии
+    void Flatten() {
+        if (is_flat.load(std::memory_order_acquire)) {
+            return;
+        }
+        // Сборка изменяет узлы, общие для нескольких строк, поэтому узлы собираются по одному.
+        // Каждый узел собирается один раз, так что ожидание мьютекса случается редко
+        static std::mutex flatten_mutex;
+        std::lock_guard guard(flatten_mutex);
+        if (is_flat.load(std::memory_order_relaxed)) {
+            return;
+        }
+        // Собранное значение может быть очень большим, поэтому память учитывается до его сборки
+        detail::ChargeHeap(size);
+        charged += size;
+        std::string result;
+        result.reserve(size);
+        std::vector<const Rope*> stack = {right.get(), left.get()};
+        while (!stack.empty()) {
+            const Rope* node = stack.back();
+            stack.pop_back();
+            if (node->is_flat.load(std::memory_order_relaxed)) {
+                result += node->flat;
+            } else {
+                stack.push_back(node->right.get());
+                stack.push_back(node->left.get());
+            }
+        }
+        flat = std::move(result);
+        left.reset();
+        right.reset();
+        is_flat.store(true, std::memory_order_release);
+    }
+
+    // Хеш вычисляется из неизменного собранного значения, поэтому потоки,
+    // вычислившие его одновременно, записывают одно и то же
+    size_t Hash() {
+        if (!is_hashed.load(std::memory_order_acquire)) {
+            Flatten();
+            hash.store(std::hash<std::string>{}(flat), std::memory_order_relaxed);
+            is_hashed.store(true, std::memory_order_release);
+        }
+        return hash.load(std::memory_order_relaxed);
+    }
+
+    // Пул интернированных строк. Пул не владеет строками: строка удаляется из него вместе
+    // с последней ссылкой на неё. Ключи указывают на собственные значения строк
+    struct InternPool {
+        std::mutex m;
+        std::unordered_map<std::string_view, std::weak_ptr<Rope>> ropes;
+    };
+
+    // Пул не удаляется: строки могут освобождаться и после удаления статических объектов
+    static InternPool& GetInternPool() {
+        static InternPool* pool = new InternPool;
+        return *pool;
+    }
+
+    // Удаляет строку из пула, если её место ещё не заняла новая строка с тем же значением
+    void ForgetInterned() {
+        InternPool& pool = GetInternPool();
+        std::lock_guard guard(pool.m);
+        if (auto it = pool.ropes.find(flat); it != pool.ropes.end() && it->first.data() == flat.data()) {
+            pool.ropes.erase(it);
+        }
+    }
+
+    const size_t size;
+    std::string flat;
+    std::shared_ptr<Rope> left;
+    std::shared_ptr<Rope> right;
+    std::atomic<bool> is_flat{false};
+    std::atomic<size_t> hash{0};
+    std::atomic<bool> is_hashed{false};
+    bool interned = false;
+    // Размер значения, учтённый в памяти потока
+    size_t charged = 0;
+};
+
+String::String(std::string v)
+    : rope_(std::allocate_shared<Rope>(PoolAllocator<Rope>{}, std::move(v))) {
+}
+
+String::String(std::shared_ptr<Rope> rope)
+    : rope_(std::move(rope)) {
+}
+
+String String::Concat(const String& lhs, const String& rhs) {
+    if (rhs.Size() == 0) {
+        return lhs;
+    }
+    if (lhs.Size() == 0) {
+        return rhs;
+    }
+    if (lhs.Size() + rhs.Size() <= FLAT_CONCAT_LIMIT) {
+        return String(lhs.GetValue() + rhs.GetValue());
+    }
+    return String(std::allocate_shared<Rope>(PoolAllocator<Rope>{}, lhs.rope_, rhs.rope_));
+}
+
+String String::Intern(std::string value) {
+    Rope::InternPool& pool = Rope::GetInternPool();
+    std::lock_guard guard(pool.m);
+    if (auto it = pool.ropes.find(value); it != pool.ropes.end()) {
+        if (auto rope = it->second.lock()) {
+            return String(std::move(rope));
+        }
+        // Последняя ссылка на прежнюю строку уже удалена, но строка ещё не убрала себя из пула
+        pool.ropes.erase(it);
+    }
+    // Строки пула общие для всех потоков, поэтому в памяти, занятой потоком, они не учитываются
+    auto rope = std::make_shared<Rope>(std::move(value));
+    detail::ReleaseHeap(std::exchange(rope->charged, 0));
+    rope->Hash();
+    rope->interned = true;
+    pool.ropes.emplace(rope->flat, rope);
+    return String(std::move(rope));
+}
+
+String String::Intern(const String& value) {
+    if (value.IsInterned()) {
+        return value;
+    }
+    return Intern(value.GetValue());
+}
+
+size_t String::GetInternPoolSize() {
+    Rope::InternPool& pool = Rope::GetInternPool();
+    std::lock_guard guard(pool.m);
+    return pool.ropes.size();
+}
+
+void String::Print(std::ostream& os, [[maybe_unused]] Context& context) {
+    os << GetValue();
+}
+
+const std::string& String::GetValue() const {
+    rope_->Flatten();
+    return rope_->flat;
+}
+
+size_t String::Size() const {
+    return rope_->size;
+}
+
+size_t String::Hash() const {
+    return rope_->Hash();
+}
+
+bool String::IsInterned() const {
+    return rope_->interned;
+}
+
+bool String::SharesStorageWith(const String& other) const {
+    return rope_ == other.rope_;
+}
+
 bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
     if (lhs.Get() != nullptr && rhs.Get() != nullptr) {
         if (lhs.TryAs<Bool>() != nullptr && rhs.TryAs<Bool>() != nullptr) {
@@ -144,7 +619,15 @@ bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
             return lhs.TryAs<Number>()->GetValue() == rhs.TryAs<Number>()->GetValue();
         }
         if (lhs.TryAs<String>() != nullptr && rhs.TryAs<String>() != nullptr) {
-            return lhs.TryAs<String>()->GetValue() == rhs.TryAs<String>()->GetValue();
+            const String& lhs_str = *lhs.TryAs<String>();
+            const String& rhs_str = *rhs.TryAs<String>();
+            if (lhs_str.SharesStorageWith(rhs_str)) {
+                return true;
+            }
+            if ((lhs_str.IsInterned() && rhs_str.IsInterned()) || lhs_str.Size() != rhs_str.Size()) {
+                return false;
+            }
+            return lhs_str.GetValue() == rhs_str.GetValue();
         }
         if (lhs.TryAs<ClassInstance>() != nullptr && rhs.TryAs<ClassInstance>() != nullptr && lhs.TryAs<ClassInstance>()->HasMethod("__eq__", 1)) {
             return lhs.TryAs<ClassInstance>()->Call("__eq__", {rhs}, context).TryAs<Bool>()->GetValue();
@@ -153,7 +636,7 @@ bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
     if (!lhs && !rhs) {
         return true;
     }
-    throw std::runtime_error("Cannot compare objects for equality"s);
+    Throw(std::runtime_error("Cannot compare objects for equality"s));
 }
 
 bool NotEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
@@ -169,6 +652,9 @@ bool Less(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
             return lhs.TryAs<Number>()->GetValue() < rhs.TryAs<Number>()->GetValue();
         }
         if (lhs.TryAs<String>() != nullptr && rhs.TryAs<String>() != nullptr) {
+            if (lhs.TryAs<String>()->SharesStorageWith(*rhs.TryAs<String>())) {
+                return false;
+            }
             return lhs.TryAs<String>()->GetValue() < rhs.TryAs<String>()->GetValue();
         }
         if (lhs.TryAs<ClassInstance>() != nullptr && lhs.TryAs<ClassInstance>()->HasMethod("__lt__", 1)) {
@@ -176,7 +662,7 @@ bool Less(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
         }
     }
 
-       throw std::runtime_error("Cannot compare objects for less"s);
+       Throw(std::runtime_error("Cannot compare objects for less"s));
 }
 
 
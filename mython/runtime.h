@@ -1,19 +1,40 @@
 #pragma once
 
+#include "memory_pool.h"
+#include "small_vector.h"
+#include "stats.h"
+
+#include <initializer_list>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+class ModuleLoader;
+
 namespace runtime {
 
+class MemoCache;
+
 // Контекст исполнения инструкций Mython
 class Context {
 public:
     // Возвращает поток вывода для команд print
     virtual std::ostream& GetOutputStream() = 0;
 
+    // Возвращает загрузчик модулей для инструкций import либо nullptr, если модули недоступны
+    virtual ModuleLoader* GetModules() {
+        return nullptr;
+    }
+
+    // Возвращает таблицы запомненных результатов методов этого исполнения программы
+    // либо nullptr, если результаты не запоминаются
+    virtual MemoCache* GetMemoCache() {
+        return nullptr;
+    }
+
 protected:
     ~Context() = default;
 };
@@ -33,10 +54,12 @@ public:
 
     // Возвращает ObjectHolder, владеющий объектом типа T
     // Тип T - конкретный класс-наследник Object.
-    // object копируется или перемещается в кучу
+    // object копируется или перемещается в кучу. Память объекта выделяется из пула потока
+    // и учитывается в ограничениях выполнения и в статистике (см. GetStats)
     template <typename T>
     [[nodiscard]] static ObjectHolder Own(T&& object) {
-        return ObjectHolder(std::make_shared<T>(std::forward<T>(object)));
+        detail::CountAllocation<T>();
+        return ObjectHolder(std::allocate_shared<T>(ObjectAllocator<T>{}, std::forward<T>(object)));
     }
 
     // Создаёт ObjectHolder, не владеющий объектом (аналог слабой ссылки)
@@ -62,6 +85,9 @@ public:
     // Возвращает true, если ObjectHolder не пуст
     explicit operator bool() const;
 
+    // Возвращает true, если других ObjectHolder, ссылающихся на этот объект, нет
+    [[nodiscard]] bool IsUnique() const;
+
 private:
     explicit ObjectHolder(std::shared_ptr<Object> data);
     void AssertIsValid() const;
@@ -85,12 +111,67 @@ public:
         return value_;
     }
 
+    // Заменяет значение объекта. Допустимо, только если объект не виден никому, кроме вызывающего
+    void SetValue(T value) {
+        value_ = std::move(value);
+    }
+
 private:
     T value_;
 };
 
-// Таблица символов, связывающая имя объекта с его значением
-using Closure = std::unordered_map<std::string, ObjectHolder>;
+// Таблица символов, связывающая имя объекта с его значением.
+// Узлы таблицы выделяются из пула, поэтому кадры вызовов методов создаются без обращения к malloc
+using Closure = std::unordered_map<std::string, ObjectHolder, std::hash<std::string>,
+                                   std::equal_to<std::string>,
+                                   PoolAllocator<std::pair<const std::string, ObjectHolder>>>;
+
+// Фактические параметры вызова метода. Обычно их немного, поэтому они хранятся без выделения памяти
+using ArgumentList = SmallVector<ObjectHolder, 4>;
+
+// Непрерывная последовательность фактических параметров вызова метода, не владеющая ими
+class ArgumentSpan {
+public:
+    ArgumentSpan() = default;
+
+    ArgumentSpan(const ObjectHolder* data, size_t size)
+        : data_(data)
+        , size_(size) {
+    }
+
+    ArgumentSpan(const std::vector<ObjectHolder>& args)  // NOLINT(google-explicit-constructor)
+        : ArgumentSpan(args.data(), args.size()) {
+    }
+
+    ArgumentSpan(const ArgumentList& args)  // NOLINT(google-explicit-constructor)
+        : ArgumentSpan(args.data(), args.size()) {
+    }
+
+    // Список в фигурных скобках живёт до конца полного выражения, в котором передан
+    ArgumentSpan(std::initializer_list<ObjectHolder> args)  // NOLINT(google-explicit-constructor)
+        : ArgumentSpan(args.begin(), args.size()) {
+    }
+
+    [[nodiscard]] size_t size() const {
+        return size_;
+    }
+
+    const ObjectHolder& operator[](size_t index) const {
+        return data_[index];
+    }
+
+    [[nodiscard]] const ObjectHolder* begin() const {
+        return data_;
+    }
+
+    [[nodiscard]] const ObjectHolder* end() const {
+        return data_ + size_;
+    }
+
+private:
+    const ObjectHolder* data_ = nullptr;
+    size_t size_ = 0;
+};
 
 // Проверяет, содержится ли в object значение, приводимое к True
 // Для отличных от нуля чисел, True и непустых строк возвращается true. В остальных случаях - false.
@@ -102,11 +183,52 @@ public:
     virtual ~Executable() = default;
     // Выполняет действие над объектами внутри closure, используя context
     // Возвращает результирующее значение либо None
-    virtual ObjectHolder Execute(Closure& closure, Context& context) = 0;
+    virtual ObjectHolder Execute(Closure& closure, Context& context) const = 0;
 };
 
-// Строковое значение
-using String = ValueObject<std::string>;
+// Строковое значение.
+// Конкатенация строк не копирует их содержимое: результат хранится в виде дерева (rope),
+// которое превращается в непрерывную строку только при первом обращении к значению
+class String : public Object {
+public:
+    String(std::string v);  // NOLINT(google-explicit-constructor,hicpp-explicit-conversions)
+
+    // Возвращает строку, равную конкатенации lhs и rhs. Содержимое аргументов не копируется
+    [[nodiscard]] static String Concat(const String& lhs, const String& rhs);
+
+    // Возвращает строку из общего пула строк. Строки с одинаковым значением, полученные
+    // через Intern, разделяют одно хранилище и сравниваются на равенство по указателю.
+    // Строка остаётся в пуле, пока на неё есть ссылки
+    [[nodiscard]] static String Intern(std::string value);
+    // Возвращает интернированную строку с тем же значением, что и у value
+    [[nodiscard]] static String Intern(const String& value);
+    // Возвращает число строк в пуле строк
+    [[nodiscard]] static size_t GetInternPoolSize();
+
+    void Print(std::ostream& os, Context& context) override;
+
+    // Возвращает значение строки, при необходимости собирая его из частей
+    [[nodiscard]] const std::string& GetValue() const;
+
+    // Возвращает длину строки, не собирая её из частей
+    [[nodiscard]] size_t Size() const;
+
+    // Возвращает хеш значения строки. Хеш вычисляется один раз и запоминается
+    [[nodiscard]] size_t Hash() const;
+
+    // Возвращает true, если строка получена из пула строк
+    [[nodiscard]] bool IsInterned() const;
+
+    // Возвращает true, если строки разделяют одно хранилище и потому заведомо равны
+    [[nodiscard]] bool SharesStorageWith(const String& other) const;
+
+private:
+    struct Rope;
+
+    explicit String(std::shared_ptr<Rope> rope);
+
+    std::shared_ptr<Rope> rope_;
+};
 // Числовое значение
 using Number = ValueObject<int>;
 
@@ -118,6 +240,15 @@ public:
     void Print(std::ostream& os, Context& context) override;
 };
 
+// Сведения о побочных эффектах метода, собираемые при разборе программы
+struct MethodEffects {
+    // true, если тело метода не читает и не изменяет поля объектов, ничего не выводит,
+    // не создаёт объектов и использует self только для вызова его методов
+    bool is_side_effect_free = false;
+    // Имена методов, которые тело вызывает у self
+    std::vector<std::string> self_calls;
+};
+
 // Метод класса
 struct Method {
     // Имя метода
@@ -126,6 +257,46 @@ struct Method {
     std::vector<std::string> formal_params;
     // Тело метода
     std::unique_ptr<Executable> body;
+    // Побочные эффекты тела метода. По умолчанию считается, что они есть
+    MethodEffects effects{};
+    // Индексы формальных параметров, которые связываются с фактическими при вызове:
+    // параметр с именем self пропускается. Заполняется конструктором класса
+    std::vector<size_t> bound_params{};
+};
+
+// Включает или выключает запоминание результатов чистых методов (по умолчанию выключено)
+void SetMemoizationEnabled(bool enabled);
+[[nodiscard]] bool IsMemoizationEnabled();
+// Задаёт наибольшее число результатов, запоминаемых для одного метода одного класса
+void SetMemoTableLimit(size_t limit);
+[[nodiscard]] size_t GetMemoTableLimit();
+
+// Статистика обращений к таблице запомненных результатов метода
+struct MemoStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t entries = 0;
+};
+
+// Таблица запомненных результатов чистого метода
+class MemoTable {
+public:
+    // Записывает в key ключ для набора аргументов args. Возвращает false, если какой-либо
+    // из аргументов не является числом, строкой, логическим значением или None
+    static bool MakeKey(ArgumentSpan args, std::string& key);
+
+    // Возвращает запомненный результат для ключа key либо nullptr
+    [[nodiscard]] const ObjectHolder* Find(const std::string& key);
+
+    // Запоминает результат, если он - число, строка, логическое значение или None
+    // и таблица ещё не заполнена
+    void Insert(std::string key, ObjectHolder result);
+
+    [[nodiscard]] const MemoStats& GetStats() const;
+
+private:
+    std::unordered_map<std::string, ObjectHolder> results_;
+    MemoStats stats_;
 };
 
 // Класс
@@ -143,16 +314,45 @@ public:
 
     // Выводит в os строку "Class <имя класса>", например "Class cat"
     void Print(std::ostream& os, Context& context) override;
+
+    // Возвращает имена методов, результат которых зависит только от их аргументов
+    [[nodiscard]] const std::vector<std::string>& GetPureMethods() const;
 private:
+    // Находит методы, результат которых зависит только от аргументов: тело метода не имеет
+    // побочных эффектов и вызывает у self только такие же методы
+    void FindPureMethods();
+
     std::string name_;
     std::vector<Method> methods_;
     const Class* parent_;
+    std::vector<std::string> pure_methods_;
+};
+
+// Таблицы запомненных результатов чистых методов, принадлежащие одному исполнению программы.
+// Классы входят в дерево программы, которое могут одновременно выполнять несколько потоков,
+// поэтому изменяемые при выполнении таблицы хранятся не в классах, а в контексте исполнения
+class MemoCache {
+public:
+    // Возвращает таблицу запомненных результатов метода method для экземпляров класса cls
+    // либо nullptr, если результат метода может зависеть не только от его аргументов
+    [[nodiscard]] MemoTable* GetTable(const Class& cls, const std::string& method);
+
+    // Возвращает статистику таблиц чистых методов класса cls по именам методов
+    [[nodiscard]] std::vector<std::pair<std::string, MemoStats>> GetStats(const Class& cls) const;
+
+private:
+    std::unordered_map<const Class*, std::unordered_map<std::string, MemoTable>> tables_;
 };
 
 // Экземпляр класса
 class ClassInstance : public Object {
 public:
     explicit ClassInstance(Class& cls);
+    ClassInstance(ClassInstance&&) = default;
+    ClassInstance& operator=(ClassInstance&&) = default;
+    // Длинная цепочка экземпляров, связанных полями, освобождается без рекурсии деструкторов,
+    // поэтому её освобождение не переполняет стек и на зелёном потоке
+    ~ClassInstance() override;
 
     /*
      * Если у объекта есть метод __str__, выводит в os результат, возвращённый этим методом.
@@ -167,8 +367,16 @@ public:
      * runtime_error
      */
     std::string GetClassName() { return cls_.TryAs<Class>()->GetName(); }
-    ObjectHolder Call(const std::string& method, const std::vector<ObjectHolder>& actual_args,
-                      Context& context);
+    // Возвращает класс объекта
+    [[nodiscard]] Class& GetClass() const;
+    ObjectHolder Call(const std::string& method, ArgumentSpan actual_args, Context& context);
+
+    /*
+     * Готовит кадр frame для вызова метода method с параметрами actual_args: очищает его и
+     * связывает self и формальные параметры метода с фактическими. Возвращает найденный метод.
+     * Если метода с таким числом параметров нет, выбрасывает исключение runtime_error
+     */
+    const Method& BindCall(const std::string& method, ArgumentSpan actual_args, Closure& frame);
 
     // Возвращает true, если объект имеет метод method, принимающий argument_count параметров
     [[nodiscard]] bool HasMethod(const std::string& method, size_t argument_count) const;
@@ -182,6 +390,35 @@ private:
     Closure fields_;
 };
 
+// Модуль: глобальные имена программы, загруженной инструкцией import
+class Module : public Object {
+public:
+    explicit Module(std::string name);
+
+    // Выводит в os строку "Module <имя модуля>"
+    void Print(std::ostream& os, Context& context) override;
+
+    [[nodiscard]] const std::string& GetName() const;
+
+    // Возвращает глобальные имена модуля
+    [[nodiscard]] Closure& Names();
+private:
+    std::string name_;
+    Closure names_;
+};
+
+template <>
+inline constexpr ObjectKind OBJECT_KIND<Number> = ObjectKind::NUMBER;
+template <>
+inline constexpr ObjectKind OBJECT_KIND<String> = ObjectKind::STRING;
+template <>
+inline constexpr ObjectKind OBJECT_KIND<Bool> = ObjectKind::BOOL;
+template <>
+inline constexpr ObjectKind OBJECT_KIND<Class> = ObjectKind::CLASS;
+template <>
+inline constexpr ObjectKind OBJECT_KIND<ClassInstance> = ObjectKind::CLASS_INSTANCE;
+template <>
+inline constexpr ObjectKind OBJECT_KIND<Module> = ObjectKind::MODULE;
 
 bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
 
@@ -197,21 +434,42 @@ struct DummyContext : Context {
         return output;
     }
 
+    ModuleLoader* GetModules() override {
+        return modules;
+    }
+
+    MemoCache* GetMemoCache() override {
+        return &memo;
+    }
+
     std::ostringstream output;
+    ModuleLoader* modules = nullptr;
+    MemoCache memo;
 };
 
 class SimpleContext : public runtime::Context {
 public:
-    explicit SimpleContext(std::ostream& output)
-        : output_(output) {
+    explicit SimpleContext(std::ostream& output, ModuleLoader* modules = nullptr)
+        : output_(output)
+        , modules_(modules) {
     }
 
     std::ostream& GetOutputStream() override {
         return output_;
     }
 
+    ModuleLoader* GetModules() override {
+        return modules_;
+    }
+
+    MemoCache* GetMemoCache() override {
+        return &memo_;
+    }
+
 private:
     std::ostream& output_;
+    ModuleLoader* modules_;
+    MemoCache memo_;
 };
 
 }  // namespace runtime
\ No newline at end of file
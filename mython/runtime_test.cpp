@@ -71,6 +71,42 @@ void TestString() {
     ASSERT_EQUAL(word.GetValue(), "hello!"s);
 }
 
+void TestStringInterning() {
+    String first = String::Intern("hello"s);
+    String second = String::Intern("hel"s + "lo"s);
+    String other = String::Intern("world"s);
+    String plain("hello"s);
+
+    ASSERT(first.IsInterned() && second.IsInterned());
+    ASSERT(!plain.IsInterned());
+    ASSERT(first.SharesStorageWith(second));
+    ASSERT(&first.GetValue() == &second.GetValue());
+    ASSERT(!first.SharesStorageWith(plain));
+    ASSERT_EQUAL(first.Hash(), plain.Hash());
+    ASSERT(String::Intern(plain).SharesStorageWith(first));
+
+    DummyContext context;
+    ASSERT(Equal(ObjectHolder::Own(String(first)), ObjectHolder::Own(String(second)), context));
+    ASSERT(Equal(ObjectHolder::Own(String(first)), ObjectHolder::Own(String(plain)), context));
+    ASSERT(!Equal(ObjectHolder::Own(String(first)), ObjectHolder::Own(String(other)), context));
+    ASSERT(!Less(ObjectHolder::Own(String(first)), ObjectHolder::Own(String(second)), context));
+    ASSERT(Less(ObjectHolder::Own(String(first)), ObjectHolder::Own(String(other)), context));
+
+    // Строка покидает пул вместе с последней ссылкой на неё
+    const size_t pool_size = String::GetInternPoolSize();
+    {
+        String temporary = String::Intern("interned only here"s);
+        ASSERT_EQUAL(String::GetInternPoolSize(), pool_size + 1);
+        String copy = String::Intern(temporary);
+        ASSERT_EQUAL(String::GetInternPoolSize(), pool_size + 1);
+    }
+    ASSERT_EQUAL(String::GetInternPoolSize(), pool_size);
+    String again = String::Intern("interned only here"s);
+    ASSERT(again.IsInterned());
+    ASSERT_EQUAL(again.GetValue(), "interned only here"s);
+    ASSERT_EQUAL(String::GetInternPoolSize(), pool_size + 1);
+}
+
 void TestBool() {
     Bool t(true);
     ASSERT_EQUAL(t.GetValue(), true);
@@ -98,7 +134,7 @@ struct TestMethodBody : Executable {
         : body(std::move(body)) {
     }
 
-    ObjectHolder Execute(Closure& closure, Context& context) override {
+    ObjectHolder Execute(Closure& closure, Context& context) const override {
         if (body) {
             return body(closure, context);
         }
@@ -534,6 +570,7 @@ void TestClassInstance() {
 void RunObjectsTests(TestRunner& tr) {
     RUN_TEST(tr, runtime::TestNumber);
     RUN_TEST(tr, runtime::TestString);
+    RUN_TEST(tr, runtime::TestStringInterning);
     RUN_TEST(tr, runtime::TestBool);
     RUN_TEST(tr, runtime::TestMethodInvocation);
     RUN_TEST(tr, runtime::TestIsTrue);
@@ -0,0 +1,199 @@
+#include "scheduler.h"
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#if __has_include(<ucontext.h>)
+#include <ucontext.h>
+#define MYTHON_HAS_GREEN_THREADS 1
+#endif
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+// Планировщик, выполняющий зелёные потоки на текущем потоке ОС
+thread_local GreenScheduler* current_scheduler = nullptr;
+// Значение, которым счётчик точек приостановки был заполнен после последнего учёта
+thread_local int64_t safe_points_loaded = numeric_limits<int64_t>::max();
+// Сколько точек приостановки осталось до конца кванта. Вне зелёных потоков квант не ограничен
+thread_local int64_t slice_left = numeric_limits<int64_t>::max();
+}  // namespace
+
+struct GreenScheduler::SchedulerContext {
+#ifdef MYTHON_HAS_GREEN_THREADS
+    ucontext_t context;
+#endif
+};
+
+struct GreenScheduler::Task {
+    TaskId id = 0;
+    function<void()> body;
+    size_t weight = 1;
+    TaskStats stats;
+    // Стек существует с первого запуска потока до его завершения
+    unique_ptr<char[]> stack;
+#ifdef MYTHON_HAS_GREEN_THREADS
+    ucontext_t context;
+#endif
+    CallStackState call_stack;
+    BudgetState budget;
+    // Теневой стек профилировщика и строка выполняемой инструкции
+    ShadowFrame* shadow_top = nullptr;
+    uint32_t current_line = 0;
+    chrono::steady_clock::time_point ready_since;
+};
+
+namespace detail {
+
+void EndTimeSlice() {
+    ChargeSteps(TakePassedSafePoints());
+    if (slice_left <= 0) {
+        // Зелёный поток получает новый квант при возобновлении
+        GreenScheduler::Yield();
+    }
+    ReloadSafePoints();
+}
+
+int64_t TakePassedSafePoints() {
+    const int64_t passed = safe_points_loaded - safe_points_left;
+    safe_points_loaded = safe_points_left;
+    if (slice_left != numeric_limits<int64_t>::max()) {
+        slice_left -= passed;
+    }
+    return passed;
+}
+
+void ReloadSafePoints() {
+    safe_points_left = max<int64_t>(min(slice_left, StepsUntilBudgetCheck()), 1);
+    safe_points_loaded = safe_points_left;
+}
+
+}  // namespace detail
+
+GreenScheduler::GreenScheduler(size_t slice, size_t stack_size)
+    : slice_(max<size_t>(slice, 1))
+    , stack_size_(max(stack_size, detail::MIN_STACK_SIZE))
+    , context_(make_unique<SchedulerContext>()) {
+}
+
+GreenScheduler::~GreenScheduler() = default;
+
+GreenScheduler::TaskId GreenScheduler::Spawn(std::function<void()> body, size_t weight) {
+    auto task = make_unique<Task>();
+    task->id = tasks_.size();
+    task->body = std::move(body);
+    task->weight = max<size_t>(weight, 1);
+    task->ready_since = chrono::steady_clock::now();
+    ready_.push_back(task.get());
+    tasks_.push_back(std::move(task));
+    return tasks_.back()->id;
+}
+
+void GreenScheduler::Run() {
+    if (current_scheduler != nullptr) {
+        throw logic_error("Green threads can't run a scheduler"s);
+    }
+    current_scheduler = this;
+    while (!ready_.empty()) {
+        Task& task = *ready_.front();
+        ready_.pop_front();
+        Resume(task);
+        if (!task.stats.is_finished) {
+            task.ready_since = chrono::steady_clock::now();
+            ready_.push_back(&task);
+        }
+    }
+    current_scheduler = nullptr;
+    slice_left = numeric_limits<int64_t>::max();
+    detail::ReloadSafePoints();
+}
+
+const GreenScheduler::TaskStats& GreenScheduler::GetStats(TaskId id) const {
+    return tasks_.at(id)->stats;
+}
+
+void GreenScheduler::Yield() {
+    GreenScheduler* scheduler = current_scheduler;
+    if (scheduler == nullptr || scheduler->running_ == nullptr) {
+        return;
+    }
+#ifdef MYTHON_HAS_GREEN_THREADS
+    swapcontext(&scheduler->running_->context, &scheduler->context_->context);
+#endif
+}
+
+void GreenScheduler::TaskEntry() {
+    Task& task = *current_scheduler->running_;
+    try {
+        task.body();
+    } catch (const exception& e) {
+        task.stats.is_failed = true;
+        task.stats.error = e.what();
+    } catch (...) {
+        task.stats.is_failed = true;
+        task.stats.error = "Unknown error"s;
+    }
+    task.stats.is_finished = true;
+    // Возврат из функции передаёт управление контексту uc_link, то есть планировщику
+}
+
+void GreenScheduler::Resume(Task& task) {
+    task.stats.max_wait = max(task.stats.max_wait, chrono::steady_clock::now() - task.ready_since);
+    ++task.stats.slices;
+    running_ = &task;
+    // Счётчик и ограничения планировщика сохраняются на время кванта
+    const int64_t scheduler_passed = detail::TakePassedSafePoints();
+    BudgetState saved_budget = detail::ExchangeBudgetState(task.budget);
+    if (saved_budget.is_active) {
+        saved_budget.steps_left -= scheduler_passed;
+    }
+    slice_left = static_cast<int64_t>(slice_ * task.weight);
+    detail::ReloadSafePoints();
+    ShadowFrame* const saved_shadow_top = exchange(detail::shadow_top, task.shadow_top);
+    const uint32_t saved_line = exchange(detail::current_line, task.current_line);
+
+#ifdef MYTHON_HAS_GREEN_THREADS
+    if (!task.stack) {
+        // Память стека не заполняется нулями, поэтому система выделяет только использованные страницы
+        task.stack.reset(new char[stack_size_]);
+        task.call_stack = detail::MakeCallStackState(task.stack.get(), stack_size_);
+        getcontext(&task.context);
+        task.context.uc_stack.ss_sp = task.stack.get();
+        task.context.uc_stack.ss_size = stack_size_;
+        task.context.uc_link = &context_->context;
+        makecontext(&task.context, TaskEntry, 0);
+    }
+    const CallStackState saved = detail::ExchangeCallStackState(task.call_stack);
+    swapcontext(&context_->context, &task.context);
+    task.call_stack = detail::ExchangeCallStackState(saved);
+#else
+    // Без переключения контекстов зелёный поток выполняется до конца за один квант
+    TaskEntry();
+#endif
+    // Шаги, пройденные потоком после его последней проверки ограничений, списываются
+    // без проверки: она будет выполнена при возобновлении потока
+    task.shadow_top = exchange(detail::shadow_top, saved_shadow_top);
+    task.current_line = exchange(detail::current_line, saved_line);
+    slice_left = numeric_limits<int64_t>::max();
+    const int64_t passed = detail::TakePassedSafePoints();
+    task.budget = detail::ExchangeBudgetState(saved_budget);
+    if (task.budget.is_active) {
+        task.budget.steps_left -= passed;
+    }
+    detail::ReloadSafePoints();
+
+    running_ = nullptr;
+    if (task.stats.is_finished) {
+        task.stack.reset();
+        task.body = nullptr;
+    }
+}
+
+}  // namespace runtime
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "budget.h"
+#include "call_stack.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace runtime {
+
+namespace detail {
+// Сколько точек приостановки осталось пройти до конца кванта текущего зелёного потока.
+// Вне зелёных потоков значение так велико, что квант не заканчивается.
+// Инициализатор виден в каждой единице трансляции, поэтому обращение к переменной
+// обходится без проверки её динамической инициализации
+inline thread_local int64_t safe_points_left = std::numeric_limits<int64_t>::max();
+// Вызывается, когда счётчик точек приостановки обнулился: проверяет ограничения выполнения
+// (см. BudgetScope), передаёт управление планировщику, если квант зелёного потока закончился,
+// и заполняет счётчик заново
+void EndTimeSlice();
+// Возвращает число точек приостановки, пройденных с прошлого вызова либо заполнения счётчика
+int64_t TakePassedSafePoints();
+// Заполняет счётчик точек приостановки до конца кванта либо до следующей проверки ограничений
+void ReloadSafePoints();
+}  // namespace detail
+
+// Точка, в которой зелёный поток может быть приостановлен. Выполнение Mython проходит её
+// перед каждой инструкцией составной инструкции и при каждом вызове метода.
+// Проверка сводится к уменьшению счётчика потока
+inline void SafePoint() {
+    if (--detail::safe_points_left <= 0) {
+        detail::EndTimeSlice();
+    }
+}
+
+/*
+Планировщик зелёных потоков: выполняет много программ по очереди на одном потоке ОС.
+
+Каждый зелёный поток получает собственный стек, выделяемый при первом запуске и освобождаемый
+по завершении, и выполняется квантами. Квант заканчивается, когда поток проходит
+slice * weight точек приостановки (см. SafePoint), после чего управление переходит
+к следующему потоку очереди. Вес позволяет дать важной программе больше времени,
+не лишая остальные программы права на очередной квант.
+
+Переключение выполняется только в точках приостановки, поэтому зелёные потоки
+не нуждаются в синхронизации между собой. Исключение, выброшенное зелёным потоком,
+завершает только его и сохраняется в его статистике
+*/
+class GreenScheduler {
+public:
+    using TaskId = size_t;
+
+    // Число точек приостановки в кванте по умолчанию
+    static constexpr size_t DEFAULT_SLICE = 1000;
+    // Размер стека зелёного потока по умолчанию. Более глубокие вызовы методов
+    // продолжаются на сегментах стека из кучи, как и на обычном потоке
+    static constexpr size_t DEFAULT_STACK_SIZE = 512 * 1024;
+
+    // Сведения о выполнении зелёного потока
+    struct TaskStats {
+        // Сколько квантов поток получил
+        size_t slices = 0;
+        // Наибольшее время, которое поток ожидал своего кванта
+        std::chrono::steady_clock::duration max_wait{};
+        bool is_finished = false;
+        // true, если поток завершился исключением, и текст этого исключения
+        bool is_failed = false;
+        std::string error;
+    };
+
+    explicit GreenScheduler(size_t slice = DEFAULT_SLICE, size_t stack_size = DEFAULT_STACK_SIZE);
+    ~GreenScheduler();
+
+    GreenScheduler(const GreenScheduler&) = delete;
+    GreenScheduler& operator=(const GreenScheduler&) = delete;
+
+    // Добавляет зелёный поток, выполняющий body, с весом weight (не меньше 1).
+    // Может вызываться и из зелёного потока этого планировщика
+    TaskId Spawn(std::function<void()> body, size_t weight = 1);
+
+    // Выполняет зелёные потоки, пока все они не завершатся. Не может вызываться из зелёного потока
+    void Run();
+
+    [[nodiscard]] const TaskStats& GetStats(TaskId id) const;
+
+    // Приостанавливает текущий зелёный поток до его следующего кванта.
+    // Вне зелёного потока ничего не делает
+    static void Yield();
+
+private:
+    struct Task;
+
+    static void TaskEntry();
+    void Resume(Task& task);
+
+    size_t slice_;
+    size_t stack_size_;
+    std::vector<std::unique_ptr<Task>> tasks_;
+    std::deque<Task*> ready_;
+    Task* running_ = nullptr;
+    // Контекст планировщика, в который возвращается приостановленный либо завершённый поток.
+    // Тип ucontext_t скрыт, чтобы не включать системный заголовок
+    struct SchedulerContext;
+    std::unique_ptr<SchedulerContext> context_;
+};
+
+}  // namespace runtime
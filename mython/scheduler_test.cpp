@@ -0,0 +1,134 @@
+#include "scheduler.h"
+#include "statement.h"
+#include "test_program_p.h"
+#include "test_runner_p.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+void TestWeightedRoundRobin() {
+    string order;
+    GreenScheduler scheduler(2);
+    // Поток с весом 2 проходит за квант вдвое больше точек приостановки
+    scheduler.Spawn(
+        [&order] {
+            for (int i = 0; i < 8; ++i) {
+                order += 'a';
+                SafePoint();
+            }
+        },
+        2);
+    scheduler.Spawn([&order] {
+        for (int i = 0; i < 4; ++i) {
+            order += 'b';
+            SafePoint();
+        }
+    });
+    scheduler.Run();
+    ASSERT_EQUAL(order, "aaaabbaaaabb"s);
+    ASSERT_EQUAL(scheduler.GetStats(0).slices, 3U);
+    ASSERT_EQUAL(scheduler.GetStats(1).slices, 3U);
+    ASSERT(scheduler.GetStats(0).is_finished && scheduler.GetStats(1).is_finished);
+
+    // Yield заканчивает квант досрочно, а вне зелёного потока ничего не делает
+    order.clear();
+    GreenScheduler::Yield();
+    GreenScheduler yielding;
+    for (const char name : "xy"s) {
+        yielding.Spawn([&order, name] {
+            for (int i = 0; i < 3; ++i) {
+                order += name;
+                GreenScheduler::Yield();
+            }
+        });
+    }
+    yielding.Run();
+    ASSERT_EQUAL(order, "xyxyxy"s);
+}
+
+void TestInterleavedPrograms() {
+    const string program = R"--(
+class Counter:
+  def __init__(name):
+    self.name = name
+
+  def count(n):
+    i = 0
+    while i < n:
+      print self.name, i
+      i = i + 1
+
+counter = Counter(NAME)
+counter.count(50)
+)--"s;
+    ostringstream output;
+    GreenScheduler scheduler(20);
+    for (const string& name : {"'a'"s, "'b'"s}) {
+        scheduler.Spawn([&output, program = program, name] {
+            string source = program;
+            source.replace(source.find("NAME"s), 4, name);
+            RunProgram(source, output);
+        });
+    }
+    scheduler.Run();
+
+    // Программы выполняются поочерёдно, и каждая выводит всё, что должна
+    const string text = output.str();
+    ASSERT(text.find("b 0\n"s) < text.find("a 49\n"s));
+    ASSERT(text.find("a 10\n"s) < text.find("b 49\n"s));
+    ASSERT_EQUAL(count(text.begin(), text.end(), '\n'), 100);
+    ASSERT(scheduler.GetStats(0).slices > 5);
+    ASSERT(scheduler.GetStats(1).slices > 5);
+}
+
+void TestFailuresAndDeepRecursion() {
+    const string failing = "print 'partial'\nprint 1 / 0\n"s;
+    const string recursive = R"--(
+class Summator:
+  def sum(n):
+    if n == 0:
+      return 0
+    return n + self.sum(n - 1)
+
+s = Summator()
+print s.sum(5000)
+)--"s;
+    ostringstream failing_output;
+    ostringstream recursive_output;
+    GreenScheduler scheduler(100);
+    scheduler.Spawn([&] {
+        RunProgram(failing, failing_output);
+    });
+    // Глубокая рекурсия продолжается на сегментах стека за пределами стека зелёного потока
+    scheduler.Spawn([&] {
+        RunProgram(recursive, recursive_output);
+    });
+    scheduler.Spawn([&scheduler] {
+        scheduler.Run();
+    });
+    scheduler.Run();
+
+    // Исключение завершает только выбросивший его поток
+    ASSERT(scheduler.GetStats(0).is_failed);
+    ASSERT_EQUAL(failing_output.str(), "partial\n"s);
+    ASSERT(!scheduler.GetStats(1).is_failed);
+    ASSERT(scheduler.GetStats(1).slices > 100);
+    ASSERT_EQUAL(recursive_output.str(), "12502500\n"s);
+    ASSERT(scheduler.GetStats(2).is_failed);
+    ASSERT_EQUAL(scheduler.GetStats(2).error, "Green threads can't run a scheduler"s);
+}
+
+}  // namespace
+
+void RunSchedulerTests(TestRunner& tr) {
+    RUN_TEST(tr, TestWeightedRoundRobin);
+    RUN_TEST(tr, TestInterleavedPrograms);
+    RUN_TEST(tr, TestFailuresAndDeepRecursion);
+}
+
+}  // namespace runtime
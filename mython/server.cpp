@@ -0,0 +1,420 @@
+#include "server.h"
+
+#include "lexer.h"
+#include "module.h"
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+// Наибольший размер программы, принимаемой сервером
+constexpr size_t MAX_PROGRAM_SIZE = 64 * 1024 * 1024;
+// Сколько соединений может ожидать приёма
+constexpr int LISTEN_BACKLOG = 128;
+
+[[noreturn]] void ThrowSystemError(const string& what) {
+    throw runtime_error(what + ": "s + strerror(errno));
+}
+
+sockaddr_un MakeAddress(const fs::path& socket_path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const string path = socket_path.string();
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("Socket path is too long: "s + path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+bool SendAll(int fd, string_view data) {
+    while (!data.empty()) {
+        const ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+// Читает из fd ровно size байт. Возвращает false, если соединение закрылось раньше
+bool ReceiveExactly(int fd, char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t received = recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+// Читает данные из fd до закрытия соединения на запись. Если данные не получены
+// за время timeout, выбрасывает runtime_error
+string ReceiveAll(int fd, chrono::milliseconds timeout) {
+    const auto deadline = chrono::steady_clock::now() + timeout;
+    string result;
+    array<char, 64 * 1024> buffer;
+    while (true) {
+        const auto left = chrono::ceil<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+        pollfd request{fd, POLLIN, 0};
+        const int ready = left.count() > 0
+                              ? poll(&request, 1, static_cast<int>(min<int64_t>(
+                                                      left.count(), numeric_limits<int>::max())))
+                              : 0;
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowSystemError("Can't read program"s);
+        }
+        if (ready == 0) {
+            throw runtime_error("Timed out waiting for the program"s);
+        }
+        const ssize_t received = recv(fd, buffer.data(), buffer.size(), 0);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowSystemError("Can't read program"s);
+        }
+        if (received == 0) {
+            return result;
+        }
+        if (result.size() + static_cast<size_t>(received) > MAX_PROGRAM_SIZE) {
+            throw runtime_error("Program is too large"s);
+        }
+        result.append(buffer.data(), static_cast<size_t>(received));
+    }
+}
+
+bool SendFrame(int fd, char kind, string_view data) {
+    const auto size = static_cast<uint32_t>(data.size());
+    const array<char, 5> header = {kind,
+                                   static_cast<char>(size & 0xFF),
+                                   static_cast<char>((size >> 8) & 0xFF),
+                                   static_cast<char>((size >> 16) & 0xFF),
+                                   static_cast<char>((size >> 24) & 0xFF)};
+    return SendAll(fd, {header.data(), header.size()}) && SendAll(fd, data);
+}
+
+// Буфер потока вывода, отправляющий накопленные данные клиенту кадрами OUTPUT
+class ConnectionBuffer : public streambuf {
+public:
+    explicit ConnectionBuffer(int fd)
+        : fd_(fd) {
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (!Flush()) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() override {
+        return Flush() ? 0 : -1;
+    }
+
+private:
+    bool Flush() {
+        const string_view data(pbase(), static_cast<size_t>(pptr() - pbase()));
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+        return data.empty() || SendFrame(fd_, Server::OUTPUT_FRAME, data);
+    }
+
+    int fd_;
+    array<char, 16 * 1024> buffer_;
+};
+
+// Закрывает дескриптор при выходе из области видимости
+class FileDescriptor {
+public:
+    explicit FileDescriptor(int fd)
+        : fd_(fd) {
+    }
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    ~FileDescriptor() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    [[nodiscard]] int Get() const {
+        return fd_;
+    }
+
+private:
+    int fd_;
+};
+
+}  // namespace
+
+ProgramCache::ProgramCache(size_t capacity, const ParseOptions& options)
+    : capacity_(capacity)
+    , options_(options) {
+}
+
+std::shared_ptr<CachedProgram> ProgramCache::Get(const std::string& source) {
+    const size_t hash = std::hash<string>{}(source);
+    auto find = [&]() -> std::shared_ptr<CachedProgram> {
+        auto [begin, end] = index_.equal_range(hash);
+        for (auto it = begin; it != end; ++it) {
+            if ((*it->second)->source == source) {
+                lru_.splice(lru_.begin(), lru_, it->second);
+                return lru_.front();
+            }
+        }
+        return nullptr;
+    };
+
+    {
+        lock_guard lock(mutex_);
+        if (auto program = find()) {
+            ++stats_.hits;
+            return program;
+        }
+        ++stats_.misses;
+    }
+
+    // Программа разбирается без блокировки, чтобы не задерживать запросы других программ
+    auto program = make_shared<CachedProgram>();
+    program->source = source;
+    istringstream input(source);
+    parse::Lexer lexer(input);
+    program->tree = ParseProgram(lexer, options_);
+
+    lock_guard lock(mutex_);
+    // Ту же программу мог разобрать и добавить в кэш другой запрос
+    if (auto cached = find()) {
+        return cached;
+    }
+    lru_.push_front(program);
+    index_.emplace(hash, lru_.begin());
+    while (lru_.size() > capacity_) {
+        const auto& oldest = lru_.back();
+        auto [begin, end] = index_.equal_range(std::hash<string>{}(oldest->source));
+        for (auto it = begin; it != end; ++it) {
+            if (it->second == prev(lru_.end())) {
+                index_.erase(it);
+                break;
+            }
+        }
+        lru_.pop_back();
+        ++stats_.evictions;
+    }
+    return program;
+}
+
+ProgramCache::Stats ProgramCache::GetStats() const {
+    lock_guard lock(mutex_);
+    return stats_;
+}
+
+Server::Server(ServerOptions options)
+    : options_(std::move(options))
+    , cache_(options_.cache_capacity, options_.parse) {
+}
+
+Server::~Server() {
+    Stop();
+}
+
+void Server::Start() {
+    const sockaddr_un address = MakeAddress(options_.socket_path);
+    listener_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener_ < 0) {
+        ThrowSystemError("Can't create socket"s);
+    }
+    // Сокет, оставшийся от предыдущего запуска, мешает bind
+    error_code ec;
+    fs::remove(options_.socket_path, ec);
+    if (bind(listener_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0
+        || listen(listener_, LISTEN_BACKLOG) < 0) {
+        const int error = errno;
+        close(listener_);
+        listener_ = -1;
+        errno = error;
+        ThrowSystemError("Can't listen on "s + options_.socket_path.string());
+    }
+
+    for (size_t i = 0; i < max<size_t>(options_.threads, 1); ++i) {
+        workers_.emplace_back([this] {
+            ServeConnections();
+        });
+    }
+    acceptor_ = thread([this] {
+        AcceptConnections();
+    });
+}
+
+void Server::Wait() {
+    unique_lock lock(mutex_);
+    stopped_.wait(lock, [this] {
+        return stopping_;
+    });
+}
+
+void Server::Stop() {
+    {
+        lock_guard lock(mutex_);
+        if (listener_ < 0 || stopping_) {
+            return;
+        }
+        stopping_ = true;
+    }
+    stopped_.notify_all();
+    has_work_.notify_all();
+
+    // shutdown прерывает ожидание в accept
+    shutdown(listener_, SHUT_RDWR);
+    acceptor_.join();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    close(listener_);
+    error_code ec;
+    fs::remove(options_.socket_path, ec);
+}
+
+const ProgramCache& Server::GetCache() const {
+    return cache_;
+}
+
+void Server::AcceptConnections() {
+    while (true) {
+        const int connection = accept4(listener_, nullptr, nullptr, SOCK_CLOEXEC);
+        lock_guard lock(mutex_);
+        if (stopping_) {
+            if (connection >= 0) {
+                close(connection);
+            }
+            return;
+        }
+        if (connection >= 0) {
+            pending_.push_back(connection);
+            has_work_.notify_one();
+        }
+    }
+}
+
+void Server::ServeConnections() {
+    while (true) {
+        int connection = -1;
+        {
+            unique_lock lock(mutex_);
+            has_work_.wait(lock, [this] {
+                return stopping_ || !pending_.empty();
+            });
+            if (pending_.empty()) {
+                return;
+            }
+            connection = pending_.front();
+            pending_.pop_front();
+        }
+        Serve(connection);
+    }
+}
+
+void Server::Serve(int connection) {
+    FileDescriptor fd(connection);
+    ConnectionBuffer buffer(fd.Get());
+    ostream output(&buffer);
+    try {
+        auto program = cache_.Get(ReceiveAll(fd.Get(), options_.receive_timeout));
+
+        ModuleLoader modules(options_.module_paths.empty() ? vector<fs::path>{"."s}
+                                                           : options_.module_paths,
+                             options_.parse);
+        runtime::SimpleContext context{output, &modules};
+        runtime::Closure closure;
+        runtime::BudgetScope budget(options_.budget);
+        program->tree->Execute(closure, context);
+        output.flush();
+        SendFrame(fd.Get(), DONE_FRAME, {});
+    } catch (const exception& e) {
+        output.flush();
+        SendFrame(fd.Get(), ERROR_FRAME, e.what());
+    }
+}
+
+int RunOnServer(const fs::path& socket_path, istream& input, ostream& output, ostream& errors) {
+    const sockaddr_un address = MakeAddress(socket_path);
+    FileDescriptor fd(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (fd.Get() < 0) {
+        ThrowSystemError("Can't create socket"s);
+    }
+    if (connect(fd.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+        ThrowSystemError("Can't connect to "s + socket_path.string());
+    }
+
+    const string program{istreambuf_iterator<char>(input), istreambuf_iterator<char>()};
+    if (!SendAll(fd.Get(), program) || shutdown(fd.Get(), SHUT_WR) < 0) {
+        ThrowSystemError("Can't send program"s);
+    }
+
+    string data;
+    while (true) {
+        array<char, 5> header;
+        if (!ReceiveExactly(fd.Get(), header.data(), header.size())) {
+            throw runtime_error("Connection to server closed unexpectedly"s);
+        }
+        uint32_t size = 0;
+        for (int i = 4; i >= 1; --i) {
+            size = (size << 8) | static_cast<unsigned char>(header[i]);
+        }
+        data.resize(size);
+        if (!ReceiveExactly(fd.Get(), data.data(), size)) {
+            throw runtime_error("Connection to server closed unexpectedly"s);
+        }
+        switch (header[0]) {
+            case Server::OUTPUT_FRAME:
+                output << data;
+                break;
+            case Server::DONE_FRAME:
+                output.flush();
+                return 0;
+            case Server::ERROR_FRAME:
+                output.flush();
+                errors << data << endl;
+                return 1;
+            default:
+                throw runtime_error("Unexpected response from server"s);
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "budget.h"
+#include "parse.h"
+#include "runtime.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <iosfwd>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Разобранная программа из кэша сервера. Дерево программы не изменяется при выполнении,
+// поэтому запросы одной программы выполняются одновременно
+struct CachedProgram {
+    std::string source;
+    std::unique_ptr<runtime::Executable> tree;
+};
+
+// Кэш разобранных программ с вытеснением давно не использованных. Ключ — хэш текста программы
+class ProgramCache {
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+    };
+
+    ProgramCache(size_t capacity, const ParseOptions& options);
+
+    // Возвращает программу с текстом source, разбирая её при промахе кэша.
+    // Программа остаётся доступной, даже если её вытеснят из кэша во время выполнения.
+    // Программы с ошибками разбора не кэшируются
+    std::shared_ptr<CachedProgram> Get(const std::string& source);
+
+    [[nodiscard]] Stats GetStats() const;
+
+private:
+    using LruList = std::list<std::shared_ptr<CachedProgram>>;
+
+    size_t capacity_;
+    ParseOptions options_;
+
+    mutable std::mutex mutex_;
+    // Программы от недавно использованных к давно использованным
+    LruList lru_;
+    std::unordered_multimap<size_t, LruList::iterator> index_;
+    Stats stats_;
+};
+
+// Настройки сервера
+struct ServerOptions {
+    // Путь к Unix-сокету, на котором сервер принимает соединения
+    std::filesystem::path socket_path;
+    // Число потоков, выполняющих программы
+    size_t threads = 4;
+    // Сколько разобранных программ хранится в кэше
+    size_t cache_capacity = 64;
+    ParseOptions parse;
+    // Каталоги поиска модулей. Модули загружаются заново для каждого запроса
+    std::vector<std::filesystem::path> module_paths;
+    // Ограничения выполнения каждого запроса. Программа, превысившая их, завершается кадром ERROR
+    runtime::ExecutionBudget budget;
+    // За какое время клиент должен прислать программу целиком. Иначе соединение
+    // закрывается кадром ERROR, чтобы медленный клиент не занимал поток сервера
+    std::chrono::milliseconds receive_timeout{10000};
+};
+
+/*
+Сервер, выполняющий программы Mython, присланные через Unix-сокет.
+
+Клиент отправляет текст программы и закрывает соединение на запись. Сервер отвечает
+последовательностью кадров: байт вида кадра, длина данных (4 байта, little-endian) и данные.
+Кадры OUTPUT несут вывод программы по мере его появления, последним приходит кадр DONE
+или кадр ERROR с текстом ошибки.
+
+Каждый запрос выполняется в потоке из пула с новым Closure и контекстом, выводящим в соединение.
+Разобранные программы хранятся в ProgramCache, поэтому повторный запрос той же программы
+не тратит время на лексический и синтаксический анализ
+*/
+class Server {
+public:
+    // Виды кадров ответа
+    static constexpr char OUTPUT_FRAME = 'O';
+    static constexpr char DONE_FRAME = 'D';
+    static constexpr char ERROR_FRAME = 'E';
+
+    explicit Server(ServerOptions options);
+    ~Server();
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Создаёт сокет и запускает потоки сервера. При ошибке выбрасывает runtime_error
+    void Start();
+    // Ожидает вызова Stop
+    void Wait();
+    // Прекращает приём соединений, дожидается завершения начатых запросов и удаляет сокет
+    void Stop();
+
+    [[nodiscard]] const ProgramCache& GetCache() const;
+
+private:
+    void AcceptConnections();
+    void ServeConnections();
+    void Serve(int connection);
+
+    ServerOptions options_;
+    ProgramCache cache_;
+    int listener_ = -1;
+
+    std::mutex mutex_;
+    std::condition_variable has_work_;
+    std::condition_variable stopped_;
+    std::deque<int> pending_;
+    bool stopping_ = false;
+
+    std::thread acceptor_;
+    std::vector<std::thread> workers_;
+};
+
+// Отправляет программу из input серверу на сокете socket_path, записывая её вывод в output,
+// а сообщение об ошибке — в errors. Возвращает 0 при успешном выполнении и 1 при ошибке
+int RunOnServer(const std::filesystem::path& socket_path, std::istream& input,
+                std::ostream& output, std::ostream& errors);
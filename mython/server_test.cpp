@@ -0,0 +1,134 @@
+#include "server.h"
+#include "test_runner_p.h"
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+fs::path MakeSocketPath() {
+    return fs::temp_directory_path()
+           / ("mython_"s + to_string(chrono::steady_clock::now().time_since_epoch().count())
+              + ".sock"s);
+}
+
+// Отправляет программу серверу и возвращает её вывод и сообщение об ошибке
+pair<string, string> Send(const fs::path& socket_path, const string& program) {
+    istringstream input(program);
+    ostringstream output;
+    ostringstream errors;
+    RunOnServer(socket_path, input, output, errors);
+    return {output.str(), errors.str()};
+}
+
+void TestServerRunsPrograms() {
+    const string counter = R"(
+class Counter:
+  def add():
+    self.value = self.value + 1
+
+c = Counter()
+c.value = 0
+for i in range(0, 1000):
+  c.add()
+print c.value
+)"s;
+    const string failing = "print 'before'\nprint x\n"s;
+
+    const fs::path socket_path = MakeSocketPath();
+    ServerOptions options;
+    options.socket_path = socket_path;
+    Server server(options);
+    server.Start();
+
+    // Запросы нескольких клиентов выполняются одновременно
+    constexpr int clients = 16;
+    vector<pair<string, string>> results(clients);
+    vector<thread> threads;
+    for (int i = 0; i < clients; ++i) {
+        threads.emplace_back([&, i] {
+            results[i] = Send(socket_path, i % 4 == 3 ? failing : counter);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (int i = 0; i < clients; ++i) {
+        if (i % 4 == 3) {
+            ASSERT_EQUAL(results[i].first, "before\n"s);
+            ASSERT(!results[i].second.empty());
+        } else {
+            // Каждый запрос начинает с нового Closure и новых экземпляров классов
+            ASSERT_EQUAL(results[i].first, "1000\n"s);
+            ASSERT(results[i].second.empty());
+        }
+    }
+
+    const auto stats = server.GetCache().GetStats();
+    ASSERT_EQUAL(stats.hits + stats.misses, static_cast<size_t>(clients));
+    ASSERT(stats.hits > 0);
+    server.Stop();
+}
+
+void TestServerReceiveTimeout() {
+    const fs::path socket_path = MakeSocketPath();
+    ServerOptions options;
+    options.socket_path = socket_path;
+    options.threads = 1;
+    options.receive_timeout = chrono::milliseconds(20);
+    Server server(options);
+    server.Start();
+
+    // Клиент, не закрывший соединение на запись, получает кадр ERROR и не занимает поток сервера
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path.c_str());
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT(fd >= 0);
+    ASSERT_EQUAL(connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)), 0);
+    ASSERT_EQUAL(send(fd, "print 1\n", 8, MSG_NOSIGNAL), 8);
+    char kind = 0;
+    ASSERT_EQUAL(recv(fd, &kind, 1, MSG_WAITALL), 1);
+    ASSERT_EQUAL(kind, Server::ERROR_FRAME);
+    close(fd);
+
+    const auto [output, errors] = Send(socket_path, "print 2\n"s);
+    ASSERT_EQUAL(output, "2\n"s);
+    ASSERT(errors.empty());
+    server.Stop();
+}
+
+void TestProgramCacheEviction() {
+    ProgramCache cache(2, {});
+    auto first = cache.Get("print 1\n"s);
+    cache.Get("print 2\n"s);
+    ASSERT_EQUAL(cache.Get("print 1\n"s), first);
+    // Программа 2 использовалась давнее программы 1 и вытесняется программой 3
+    cache.Get("print 3\n"s);
+    ASSERT_EQUAL(cache.Get("print 1\n"s), first);
+    cache.Get("print 2\n"s);
+
+    const auto stats = cache.GetStats();
+    ASSERT_EQUAL(stats.hits, 2U);
+    ASSERT_EQUAL(stats.misses, 4U);
+    ASSERT_EQUAL(stats.evictions, 2U);
+
+    ASSERT_THROWS(cache.Get("print (\n"s), exception);
+}
+
+}  // namespace
+
+void RunServerTests(TestRunner& tr) {
+    RUN_TEST(tr, TestServerRunsPrograms);
+    RUN_TEST(tr, TestServerReceiveTimeout);
+    RUN_TEST(tr, TestProgramCacheEviction);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace runtime {
+
+/*
+Последовательность, хранящая первые N элементов внутри самого объекта.
+Память в куче выделяется, только если элементов становится больше N.
+Тип T должен иметь конструктор по умолчанию
+*/
+template <typename T, size_t N>
+class SmallVector {
+public:
+    SmallVector() = default;
+
+    SmallVector(const SmallVector&) = default;
+    SmallVector& operator=(const SmallVector&) = default;
+
+    // Перемещённая последовательность остаётся пустой
+    SmallVector(SmallVector&& other) noexcept(std::is_nothrow_move_assignable_v<T>)
+        : heap_(std::move(other.heap_))
+        , size_(std::exchange(other.size_, 0)) {
+        MoveInlineFrom(other);
+    }
+
+    SmallVector& operator=(SmallVector&& other) noexcept(std::is_nothrow_move_assignable_v<T>) {
+        if (this != &other) {
+            heap_ = std::move(other.heap_);
+            size_ = std::exchange(other.size_, 0);
+            MoveInlineFrom(other);
+        }
+        return *this;
+    }
+
+    void push_back(T value) {
+        if (size_ < N) {
+            inline_[size_] = std::move(value);
+        } else {
+            if (size_ == N) {
+                heap_.reserve(N * 2);
+                for (auto& item : inline_) {
+                    heap_.push_back(std::move(item));
+                }
+            }
+            heap_.push_back(std::move(value));
+        }
+        ++size_;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < size_ && i < N; ++i) {
+            inline_[i] = T{};
+        }
+        heap_.clear();
+        size_ = 0;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return size_;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] T* data() {
+        return size_ <= N ? inline_.data() : heap_.data();
+    }
+
+    [[nodiscard]] const T* data() const {
+        return size_ <= N ? inline_.data() : heap_.data();
+    }
+
+    T& operator[](size_t index) {
+        return data()[index];
+    }
+
+    const T& operator[](size_t index) const {
+        return data()[index];
+    }
+
+    T* begin() {
+        return data();
+    }
+
+    T* end() {
+        return data() + size_;
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return data() + size_;
+    }
+
+private:
+    // Переносит элементы, хранящиеся внутри other, и оставляет other без элементов
+    void MoveInlineFrom(SmallVector& other) {
+        for (size_t i = 0; i < N; ++i) {
+            inline_[i] = std::exchange(other.inline_[i], T{});
+        }
+        other.heap_.clear();
+    }
+
+    std::array<T, N> inline_{};
+    std::vector<T> heap_;
+    size_t size_ = 0;
+};
+
+}  // namespace runtime
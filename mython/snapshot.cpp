@@ -0,0 +1,392 @@
+#include "snapshot.h"
+
+#include "lexer.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+/*
+Формат снимка. Числа записываются в little-endian, строки — длиной (4 байта) и содержимым.
+
+    SNAPSHOT_MAGIC, версия (4 байта)
+    текст программы
+    число объектов, затем объекты по порядку номеров: байт вида и данные
+        NUMBER_OBJECT: значение (4 байта)
+        BOOL_OBJECT: значение (1 байт)
+        STRING_OBJECT: признак интернированной строки (1 байт), значение
+        CLASS_OBJECT: имя класса
+        INSTANCE_OBJECT: ссылка на класс
+    поля экземпляров классов в порядке их номеров: число полей, затем пары имя — ссылка
+    число глобальных имён, затем пары имя — ссылка
+
+Ссылка — номер объекта, увеличенный на единицу, либо 0 для None. Класс экземпляра
+всегда записывается раньше самого экземпляра
+*/
+constexpr string_view SNAPSHOT_MAGIC = "MYSNAPSH"sv;
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+constexpr char NUMBER_OBJECT = 'N';
+constexpr char BOOL_OBJECT = 'B';
+constexpr char STRING_OBJECT = 'S';
+constexpr char CLASS_OBJECT = 'C';
+constexpr char INSTANCE_OBJECT = 'I';
+
+[[noreturn]] void ThrowCorrupted() {
+    throw runtime_error("Snapshot is corrupted"s);
+}
+
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const ClassTable& classes) {
+        for (const auto& [name, cls] : classes) {
+            class_names_.emplace(cls, &name);
+        }
+    }
+
+    string Write(string_view source, const runtime::Closure& globals) {
+        // Объекты нумеруются обходом в глубину без рекурсии: граф объектов может быть глубоким
+        for (const auto& [name, value] : globals) {
+            AddObject(value);
+        }
+        while (!unvisited_.empty()) {
+            const runtime::ClassInstance* instance = unvisited_.back();
+            unvisited_.pop_back();
+            for (const auto& [name, value] : instance->Fields()) {
+                AddObject(value);
+            }
+        }
+
+        data_.append(SNAPSHOT_MAGIC);
+        WriteUint32(SNAPSHOT_VERSION);
+        WriteString(source);
+        WriteUint32(static_cast<uint32_t>(objects_.size()));
+        for (const runtime::Object* object : objects_) {
+            WriteObject(*object);
+        }
+        for (const runtime::Object* object : objects_) {
+            if (const auto* instance = dynamic_cast<const runtime::ClassInstance*>(object)) {
+                WriteNames(instance->Fields());
+            }
+        }
+        WriteNames(globals);
+        return std::move(data_);
+    }
+
+private:
+    // Присваивает номер объекту и всем ещё не пронумерованным объектам, без которых его
+    // нельзя восстановить. Поля экземпляров классов нумеруются позже
+    void AddObject(const runtime::ObjectHolder& holder) {
+        if (!holder || ids_.count(holder.Get()) != 0) {
+            return;
+        }
+        runtime::Object* object = holder.Get();
+        if (auto* instance = dynamic_cast<runtime::ClassInstance*>(object)) {
+            AddObject(runtime::ObjectHolder::Share(instance->GetClass()));
+            unvisited_.push_back(instance);
+        } else if (auto* cls = dynamic_cast<runtime::Class*>(object)) {
+            if (class_names_.count(cls) == 0) {
+                throw runtime_error("Class "s + cls->GetName()
+                                    + " is not declared in the snapshot program"s);
+            }
+        } else if (auto* module = dynamic_cast<runtime::Module*>(object)) {
+            throw runtime_error("Module "s + module->GetName() + " can't be saved to a snapshot"s);
+        } else if (dynamic_cast<runtime::Number*>(object) == nullptr
+                   && dynamic_cast<runtime::Bool*>(object) == nullptr
+                   && dynamic_cast<runtime::String*>(object) == nullptr) {
+            throw runtime_error("Object can't be saved to a snapshot"s);
+        }
+        ids_.emplace(object, static_cast<uint32_t>(objects_.size()));
+        objects_.push_back(object);
+    }
+
+    void WriteObject(const runtime::Object& object) {
+        if (const auto* number = dynamic_cast<const runtime::Number*>(&object)) {
+            data_.push_back(NUMBER_OBJECT);
+            WriteUint32(static_cast<uint32_t>(number->GetValue()));
+        } else if (const auto* boolean = dynamic_cast<const runtime::Bool*>(&object)) {
+            data_.push_back(BOOL_OBJECT);
+            data_.push_back(boolean->GetValue() ? 1 : 0);
+        } else if (const auto* str = dynamic_cast<const runtime::String*>(&object)) {
+            data_.push_back(STRING_OBJECT);
+            data_.push_back(str->IsInterned() ? 1 : 0);
+            WriteString(str->GetValue());
+        } else if (const auto* cls = dynamic_cast<const runtime::Class*>(&object)) {
+            data_.push_back(CLASS_OBJECT);
+            WriteString(*class_names_.at(cls));
+        } else {
+            const auto& instance = dynamic_cast<const runtime::ClassInstance&>(object);
+            data_.push_back(INSTANCE_OBJECT);
+            WriteUint32(ids_.at(&instance.GetClass()));
+        }
+    }
+
+    void WriteNames(const runtime::Closure& names) {
+        WriteUint32(static_cast<uint32_t>(names.size()));
+        for (const auto& [name, value] : names) {
+            WriteString(name);
+            WriteUint32(value ? ids_.at(value.Get()) + 1 : 0);
+        }
+    }
+
+    void WriteUint32(uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            data_.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+        }
+    }
+
+    void WriteString(string_view value) {
+        WriteUint32(static_cast<uint32_t>(value.size()));
+        data_.append(value);
+    }
+
+    unordered_map<const runtime::Class*, const string*> class_names_;
+    unordered_map<const runtime::Object*, uint32_t> ids_;
+    vector<const runtime::Object*> objects_;
+    vector<const runtime::ClassInstance*> unvisited_;
+    string data_;
+};
+
+class SnapshotReader {
+public:
+    explicit SnapshotReader(string_view data)
+        : data_(data) {
+    }
+
+    uint8_t ReadByte() {
+        return static_cast<uint8_t>(ReadBytes(1)[0]);
+    }
+
+    uint32_t ReadUint32() {
+        const string_view bytes = ReadBytes(4);
+        uint32_t value = 0;
+        for (int i = 3; i >= 0; --i) {
+            value = (value << 8) | static_cast<unsigned char>(bytes[i]);
+        }
+        return value;
+    }
+
+    string_view ReadString() {
+        return ReadBytes(ReadUint32());
+    }
+
+    // Читает число элементов, каждый из которых занимает не меньше min_size байт
+    size_t ReadCount(size_t min_size) {
+        const size_t count = ReadUint32();
+        if (count > data_.size() / min_size) {
+            ThrowCorrupted();
+        }
+        return count;
+    }
+
+    string_view ReadBytes(size_t size) {
+        if (size > data_.size()) {
+            ThrowCorrupted();
+        }
+        string_view result = data_.substr(0, size);
+        data_.remove_prefix(size);
+        return result;
+    }
+
+    [[nodiscard]] bool IsAtEnd() const {
+        return data_.empty();
+    }
+
+private:
+    string_view data_;
+};
+
+// Буфер потока, читающий из области памяти без копирования
+class MemoryBuffer : public streambuf {
+public:
+    explicit MemoryBuffer(string_view data) {
+        char* begin = const_cast<char*>(data.data());  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+        setg(begin, begin, begin + data.size());
+    }
+};
+
+// Файл, отображённый в память только для чтения
+class MappedFile {
+public:
+    explicit MappedFile(const fs::path& path) {
+        fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) {
+            ThrowSystemError("Can't open snapshot "s + path.string());
+        }
+        struct stat status {};
+        if (fstat(fd_, &status) < 0) {
+            ThrowSystemError("Can't open snapshot "s + path.string());
+        }
+        size_ = static_cast<size_t>(status.st_size);
+        if (size_ == 0) {
+            return;
+        }
+        void* address = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (address == MAP_FAILED) {
+            ThrowSystemError("Can't map snapshot "s + path.string());
+        }
+        address_ = address;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (address_ != nullptr) {
+            munmap(address_, size_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    [[nodiscard]] string_view GetData() const {
+        return {static_cast<const char*>(address_), address_ != nullptr ? size_ : 0};
+    }
+
+private:
+    [[noreturn]] void ThrowSystemError(const string& what) {
+        const string reason = strerror(errno);
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+        throw runtime_error(what + ": "s + reason);
+    }
+
+    int fd_ = -1;
+    void* address_ = nullptr;
+    size_t size_ = 0;
+};
+
+runtime::ObjectHolder ReadReference(SnapshotReader& reader,
+                                    const vector<runtime::ObjectHolder>& objects) {
+    const uint32_t reference = reader.ReadUint32();
+    if (reference == 0) {
+        return runtime::ObjectHolder::None();
+    }
+    if (reference > objects.size()) {
+        ThrowCorrupted();
+    }
+    return objects[reference - 1];
+}
+
+void ReadNames(SnapshotReader& reader, const vector<runtime::ObjectHolder>& objects,
+               runtime::Closure& names) {
+    // Имя занимает не меньше 4 байт длины, ссылка — 4 байта
+    const size_t count = reader.ReadCount(8);
+    names.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        const string_view name = reader.ReadString();
+        names.emplace(string(name), ReadReference(reader, objects));
+    }
+}
+
+}  // namespace
+
+std::string MakeSnapshot(std::string_view source, const ClassTable& classes,
+                         const runtime::Closure& globals) {
+    return SnapshotWriter(classes).Write(source, globals);
+}
+
+RestoredSnapshot RestoreSnapshot(std::string_view data, const ParseOptions& options) {
+    SnapshotReader reader(data);
+    if (reader.ReadBytes(SNAPSHOT_MAGIC.size()) != SNAPSHOT_MAGIC) {
+        throw runtime_error("Not a Mython snapshot"s);
+    }
+    if (reader.ReadUint32() != SNAPSHOT_VERSION) {
+        throw runtime_error("Unsupported snapshot version"s);
+    }
+
+    RestoredSnapshot result;
+    MemoryBuffer source(reader.ReadString());
+    istream input(&source);
+    parse::Lexer lexer(input);
+    result.program = ParseProgram(lexer, options, result.classes);
+
+    vector<runtime::ObjectHolder> objects(reader.ReadCount(2));
+    vector<runtime::ClassInstance*> instances;
+    for (auto& object : objects) {
+        switch (reader.ReadByte()) {
+            case NUMBER_OBJECT:
+                object = runtime::ObjectHolder::Own(
+                    runtime::Number(static_cast<int>(reader.ReadUint32())));
+                break;
+            case BOOL_OBJECT:
+                object = runtime::ObjectHolder::Own(runtime::Bool(reader.ReadByte() != 0));
+                break;
+            case STRING_OBJECT: {
+                const bool is_interned = reader.ReadByte() != 0;
+                string value(reader.ReadString());
+                object = runtime::ObjectHolder::Own(is_interned ? runtime::String::Intern(std::move(value))
+                                                                : runtime::String(std::move(value)));
+                break;
+            }
+            case CLASS_OBJECT: {
+                const string name(reader.ReadString());
+                auto it = result.classes.find(name);
+                if (it == result.classes.end()) {
+                    throw runtime_error("Class "s + name + " not found in the snapshot program"s);
+                }
+                object = runtime::ObjectHolder::Share(*it->second);
+                break;
+            }
+            case INSTANCE_OBJECT: {
+                const uint32_t class_id = reader.ReadUint32();
+                auto* cls = class_id < objects.size() ? objects[class_id].TryAs<runtime::Class>() : nullptr;
+                if (cls == nullptr) {
+                    ThrowCorrupted();
+                }
+                object = runtime::ObjectHolder::Own(runtime::ClassInstance(*cls));
+                instances.push_back(object.TryAs<runtime::ClassInstance>());
+                break;
+            }
+            default:
+                ThrowCorrupted();
+        }
+    }
+    for (runtime::ClassInstance* instance : instances) {
+        ReadNames(reader, objects, instance->Fields());
+    }
+    ReadNames(reader, objects, result.globals);
+    if (!reader.IsAtEnd()) {
+        ThrowCorrupted();
+    }
+    return result;
+}
+
+void SaveSnapshotFile(const fs::path& path, std::string_view source, const ClassTable& classes,
+                      const runtime::Closure& globals) {
+    const string data = MakeSnapshot(source, classes, globals);
+    // Снимок записывается во временный файл и переименовывается, чтобы одновременно
+    // восстанавливающий его процесс не увидел файл записанным наполовину
+    fs::path temporary = path;
+    temporary += ".tmp"s;
+    {
+        ofstream output(temporary, ios::binary | ios::trunc);
+        output.write(data.data(), static_cast<streamsize>(data.size()));
+        if (!output.flush()) {
+            throw runtime_error("Can't write snapshot "s + path.string());
+        }
+    }
+    fs::rename(temporary, path);
+}
+
+RestoredSnapshot LoadSnapshotFile(const fs::path& path, const ParseOptions& options) {
+    const MappedFile file(path);
+    return RestoreSnapshot(file.GetData(), options);
+}
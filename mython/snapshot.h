@@ -0,0 +1,48 @@
+#pragma once
+
+#include "parse.h"
+#include "runtime.h"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/*
+Снимок состояния программы после инициализации.
+
+Снимок хранит текст программы и значения её глобальных имён вместе со всеми достижимыми
+из них объектами: числами, строками, логическими значениями, классами и экземплярами классов
+с их полями. Общие объекты и циклические ссылки сохраняются как есть. Классы записываются
+по именам: при восстановлении текст программы разбирается заново, но не выполняется,
+поэтому восстановление не повторяет работу инициализации. Таблицы запомненных результатов
+методов в снимок не попадают.
+
+Модули и объекты классов, объявленных не в сохраняемой программе, в снимок записать нельзя
+*/
+
+// Состояние программы, восстановленное из снимка
+struct RestoredSnapshot {
+    // Дерево программы из снимка. Владеет её классами
+    std::unique_ptr<runtime::Executable> program;
+    // Классы программы по именам
+    ClassTable classes;
+    // Глобальные имена программы на момент создания снимка
+    runtime::Closure globals;
+};
+
+// Возвращает снимок программы с текстом source, классами classes и глобальными именами globals.
+// Выбрасывает runtime_error, если из globals достижим объект, который нельзя записать в снимок
+std::string MakeSnapshot(std::string_view source, const ClassTable& classes,
+                         const runtime::Closure& globals);
+
+// Восстанавливает состояние программы из снимка data. Программа разбирается с настройками options.
+// Выбрасывает runtime_error, если снимок повреждён, и ParseError, если текст программы содержит ошибку
+RestoredSnapshot RestoreSnapshot(std::string_view data, const ParseOptions& options);
+
+// Записывает снимок в файл path
+void SaveSnapshotFile(const std::filesystem::path& path, std::string_view source,
+                      const ClassTable& classes, const runtime::Closure& globals);
+
+// Восстанавливает состояние программы из файла path. Файл отображается в память, а не читается
+RestoredSnapshot LoadSnapshotFile(const std::filesystem::path& path, const ParseOptions& options);
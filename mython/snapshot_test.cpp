@@ -0,0 +1,174 @@
+#include "lexer.h"
+#include "parse.h"
+#include "snapshot.h"
+#include "statement.h"
+#include "test_runner_p.h"
+
+#include <chrono>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+// Выполняет программу в глобальных именах globals, делая видимыми классы classes.
+// Возвращает дерево программы, которое владеет объявленными в ней классами
+unique_ptr<runtime::Executable> Run(const string& program, ClassTable& classes,
+                                    runtime::Closure& globals, runtime::DummyContext& context) {
+    istringstream input(program);
+    parse::Lexer lexer(input);
+    auto tree = ParseProgram(lexer, {}, classes);
+    tree->Execute(globals, context);
+    return tree;
+}
+
+const string INIT_PROGRAM = R"--(
+class Node:
+  def __init__(value, next):
+    self.value = value
+    self.next = next
+
+  def sum():
+    if self.value == 1:
+      return self.value
+    n = self.next
+    return self.value + n.sum()
+
+class Pair:
+  def __init__(first, second):
+    self.first = first
+    self.second = second
+
+  def __str__():
+    return "(" + str(self.first) + ", " + str(self.second) + ")"
+
+list = None
+i = 0
+while i < 100:
+  i = i + 1
+  list = Node(i, list)
+
+shared = Node(-1, None)
+pair = Pair(shared, shared)
+pair.self = pair
+title = "snap" + "shot"
+flag = True
+nothing = None
+kind = Pair
+print "initialized"
+)--"s;
+
+const string ENTRY_PROGRAM = R"(
+first = pair.first
+first.value = 42
+second = pair.second
+again = pair.self
+print list.sum(), second.value, again.second.value, title, flag, nothing
+print Pair(title, flag), kind
+p = Pair(1, 2)
+print p
+)"s;
+
+const string ENTRY_OUTPUT = "5050 42 42 snapshot True None\n(snapshot, True) Class Pair\n(1, 2)\n"s;
+
+void TestSnapshotRestoresObjectGraph() {
+    string snapshot;
+    {
+        ClassTable classes;
+        runtime::Closure globals;
+        runtime::DummyContext context;
+        auto tree = Run(INIT_PROGRAM, classes, globals, context);
+        ASSERT_EQUAL(context.output.str(), "initialized\n"s);
+        snapshot = MakeSnapshot(INIT_PROGRAM, classes, globals);
+    }
+
+    // Восстановленное состояние не зависит от программы, из которой снимок был сделан,
+    // а инициализация при восстановлении не выполняется повторно
+    RestoredSnapshot restored = RestoreSnapshot(snapshot, {});
+    ASSERT_EQUAL(restored.classes.size(), 2U);
+    ASSERT_EQUAL(restored.globals.size(), 10U);
+
+    runtime::DummyContext context;
+    auto tree = Run(ENTRY_PROGRAM, restored.classes, restored.globals, context);
+    ASSERT_EQUAL(context.output.str(), ENTRY_OUTPUT);
+}
+
+void TestSnapshotFile() {
+    const fs::path path = fs::temp_directory_path()
+                          / ("mython_snapshot_"s
+                             + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+    {
+        ClassTable classes;
+        runtime::Closure globals;
+        runtime::DummyContext context;
+        auto tree = Run(INIT_PROGRAM, classes, globals, context);
+        SaveSnapshotFile(path, INIT_PROGRAM, classes, globals);
+    }
+
+    {
+        RestoredSnapshot restored = LoadSnapshotFile(path, {});
+        runtime::DummyContext context;
+        auto tree = Run(ENTRY_PROGRAM, restored.classes, restored.globals, context);
+        ASSERT_EQUAL(context.output.str(), ENTRY_OUTPUT);
+    }
+
+    // Один снимок можно восстанавливать многократно
+    {
+        RestoredSnapshot restored = LoadSnapshotFile(path, {});
+        runtime::DummyContext context;
+        auto tree = Run(ENTRY_PROGRAM, restored.classes, restored.globals, context);
+        ASSERT_EQUAL(context.output.str(), ENTRY_OUTPUT);
+    }
+    fs::remove(path);
+
+    try {
+        LoadSnapshotFile(path, {});
+        ASSERT(false);
+    } catch (const runtime_error&) {
+    }
+}
+
+void TestSnapshotErrors() {
+    ClassTable classes;
+    runtime::Closure globals;
+    runtime::DummyContext context;
+    auto tree = Run("class A:\n  def f():\n    return 1\na = A()\nx = 'text'\n"s, classes, globals,
+                    context);
+    const string snapshot = MakeSnapshot("class A:\n  def f():\n    return 1\n"s, classes, globals);
+
+    // Снимок, обрезанный в любом месте, распознаётся как повреждённый
+    for (size_t size = 0; size < snapshot.size(); ++size) {
+        try {
+            RestoreSnapshot(string_view(snapshot).substr(0, size), {});
+            ASSERT(false);
+        } catch (const runtime_error&) {
+        }
+    }
+    try {
+        RestoreSnapshot(snapshot + "x"s, {});
+        ASSERT(false);
+    } catch (const runtime_error&) {
+    }
+
+    // Классы записываются по именам, поэтому при восстановлении они должны быть объявлены
+    try {
+        MakeSnapshot("class A:\n  def f():\n    return 1\n"s, {}, globals);
+        ASSERT(false);
+    } catch (const runtime_error&) {
+    }
+
+    runtime::Closure with_module = {{"m"s, runtime::ObjectHolder::Own(runtime::Module("m"s))}};
+    try {
+        MakeSnapshot(""sv, classes, with_module);
+        ASSERT(false);
+    } catch (const runtime_error&) {
+    }
+}
+
+}  // namespace
+
+void RunSnapshotTests(TestRunner& tr) {
+    RUN_TEST(tr, TestSnapshotRestoresObjectGraph);
+    RUN_TEST(tr, TestSnapshotFile);
+    RUN_TEST(tr, TestSnapshotErrors);
+}
@@ -1,7 +1,24 @@
 #include "statement.h"
 
+#include "actor.h"
+#include "budget.h"
+#include "call_stack.h"
+#include "module.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <unordered_set>
+#include <utility>
 
 using namespace std;
 
@@ -14,12 +31,80 @@ namespace ast {
     namespace {
         const string ADD_METHOD = "__add__"s;
         const string INIT_METHOD = "__init__"s;
+
+        /*
+        Сигнал о выходе из метода. Инструкция return не бросает исключение, а записывает сюда
+        свой результат (или, для хвостового вызова, вызываемый объект, метод и аргументы).
+        Compound прекращает выполнение своих инструкций, увидев сигнал,
+        а ближайший MethodBody забирает результат и сбрасывает сигнал
+        */
+        struct MethodExit {
+            enum class Kind { NONE, RETURN, TAIL_CALL };
+
+            Kind kind = Kind::NONE;
+            ObjectHolder value;
+            const string* method = nullptr;
+            runtime::ArgumentList args;
+        };
+
+        thread_local MethodExit method_exit;
+
+        // Экземпляры классов, созданные выполняемой в этом потоке итерацией parallel for,
+        // либо nullptr вне итераций. Итерация может присваивать поля только этим объектам
+        thread_local unordered_set<const runtime::Object*>* parallel_owned = nullptr;
+
+        // Запоминает экземпляр, созданный итерацией parallel for
+        void NoteNewInstance(const ObjectHolder& instance) {
+            if (parallel_owned != nullptr) {
+                parallel_owned->insert(instance.Get());
+            }
+        }
+
+        // Вычисляет операнд выражения. Если стек потока почти исчерпан глубоко вложенным
+        // выражением, вычисление продолжается на сегменте стека, выделенном в куче
+        ObjectHolder ExecuteOperand(Statement& operand, Closure& closure, Context& context) {
+            ObjectHolder result;
+            runtime::RunWithStackReserve([&] {
+                result = operand.Execute(closure, context);
+            });
+            return result;
+        }
+
+        // Создаёт экземпляр класса, объявленного в модуле, и вызывает его конструктор
+        ObjectHolder NewModuleInstance(runtime::Module& module, const string& class_name,
+                                       runtime::ArgumentSpan args, Context& context) {
+            auto it = module.Names().find(class_name);
+            auto* cls = it == module.Names().end() ? nullptr : it->second.TryAs<runtime::Class>();
+            if (cls == nullptr) {
+                runtime::Throw(runtime_error("Module "s + module.GetName() + " has no class "s + class_name));
+            }
+            auto instance = ObjectHolder::Own(runtime::ClassInstance(*cls));
+            NoteNewInstance(instance);
+            auto& object = *instance.TryAs<runtime::ClassInstance>();
+            if (object.HasMethod(INIT_METHOD, args.size())) {
+                object.Call(INIT_METHOD, args, context);
+            }
+            return instance;
+        }
     }  // namespace
 
-    ObjectHolder Assignment::Execute(Closure& closure, Context& context) {
+    UnaryOperation::~UnaryOperation() {
+        runtime::RunWithStackReserve([this] {
+            arg_.reset();
+        });
+    }
+
+    BinaryOperation::~BinaryOperation() {
+        runtime::RunWithStackReserve([this] {
+            lhs_.reset();
+            rhs_.reset();
+        });
+    }
+
+    ObjectHolder Assignment::Execute(Closure& closure, Context& context) const {
         auto val = rv_->Execute(closure, context);
         closure[var_] = val;
-        return closure[var_];
+        return val;
     }
 
     Assignment::Assignment(std::string var, std::unique_ptr<Statement> rv) : var_(var), rv_(std::move(rv)) {}
@@ -30,14 +115,33 @@ namespace ast {
 
     VariableValue::VariableValue(std::vector<std::string> dotted_ids) : dotted_ids_(std::move(dotted_ids)) {}
 
-    ObjectHolder VariableValue::Execute(Closure& closure, Context& context) {
-        if (closure.count(dotted_ids_[0]) == 0) throw runtime_error("");
-        if (dotted_ids_.size() == 1) {
-            return closure[dotted_ids_[0]];
-        } else {
-            std::vector<std::string> new_closure (dotted_ids_.begin() + 1, dotted_ids_.end());
-            return VariableValue(new_closure).Execute(closure[dotted_ids_[0]].TryAs<runtime::ClassInstance>()->Fields(),context);
+    const std::vector<std::string>& VariableValue::GetDottedIds() const {
+        return dotted_ids_;
+    }
+
+    ObjectHolder& VariableValue::Resolve(Closure& closure) const {
+        Closure* scope = &closure;
+        ObjectHolder* slot = nullptr;
+        for (const auto& id : dotted_ids_) {
+            if (slot != nullptr) {
+                if (auto* instance = slot->TryAs<runtime::ClassInstance>()) {
+                    scope = &instance->Fields();
+                } else if (auto* module = slot->TryAs<runtime::Module>()) {
+                    scope = &module->Names();
+                } else {
+                    runtime::Throw(runtime_error(""));
+                }
+            }
+            auto it = scope->find(id);
+            runtime::detail::CountClosureLookup(it != scope->end());
+            if (it == scope->end()) runtime::Throw(runtime_error(""));
+            slot = &it->second;
         }
+        return *slot;
+    }
+
+    ObjectHolder VariableValue::Execute(Closure& closure, [[maybe_unused]] Context& context) const {
+        return Resolve(closure);
     }
 
     unique_ptr<Print> Print::Variable(const std::string& name) {
@@ -52,7 +156,7 @@ namespace ast {
 
     Print::Print(vector<unique_ptr<Statement>> args) : args_(std::move(args)) {}
 
-    ObjectHolder Print::Execute(Closure& closure, Context& context) {
+    ObjectHolder Print::Execute(Closure& closure, Context& context) const {
         if (args_.empty()) {
             context.GetOutputStream() << std::endl;
             return {};
@@ -80,18 +184,39 @@ namespace ast {
     MethodCall::MethodCall(std::unique_ptr<Statement> object, std::string method,
                            std::vector<std::unique_ptr<Statement>> args) : object_(std::move(object)), method_(method), args_(std::move(args)) {}
 
-    ObjectHolder MethodCall::Execute(Closure& closure, Context& context) {
-        std::vector<ObjectHolder> actual_args;
+    void MethodCall::MarkAsTailCall() {
+        is_tail_call_ = true;
+    }
+
+    ObjectHolder MethodCall::Execute(Closure& closure, Context& context) const {
+        runtime::ArgumentList actual_args;
         for (const auto & arg : args_) {
             actual_args.push_back(arg->Execute(closure, context));
         }
-        return object_->Execute(closure, context).TryAs<runtime::ClassInstance>()->Call(method_, actual_args, context);
+        auto object = object_->Execute(closure, context);
+        if (auto* module = object.TryAs<runtime::Module>()) {
+            return NewModuleInstance(*module, method_, actual_args, context);
+        }
+        if (auto* actor = object.TryAs<runtime::Actor>()) {
+            return actor->Ask(method_, actual_args, context);
+        }
+        if (object.TryAs<runtime::ClassInstance>() == nullptr) {
+            runtime::Throw(runtime_error(""));
+        }
+        if (is_tail_call_) {
+            method_exit.kind = MethodExit::Kind::TAIL_CALL;
+            method_exit.value = std::move(object);
+            method_exit.method = &method_;
+            method_exit.args = std::move(actual_args);
+            return {};
+        }
+        return object.TryAs<runtime::ClassInstance>()->Call(method_, actual_args, context);
     }
 
-    ObjectHolder Stringify::Execute(Closure& closure, Context& context) {
+    ObjectHolder Stringify::Execute(Closure& closure, Context& context) const {
         ostringstream ss;
-        if (arg_->Execute(closure, context)) {
-            arg_->Execute(closure, context)->Print(ss, context);
+        if (auto value = ExecuteOperand(*arg_, closure, context)) {
+            value->Print(ss, context);
         }else {
             ss << "None";
         }
@@ -100,89 +225,146 @@ namespace ast {
         return ObjectHolder::Own(std::move(str));
     }
 
-    ObjectHolder Add::Execute(Closure& closure, Context& context) {
-        if (lhs_->Execute(closure, context).TryAs<runtime::Number>() && rhs_->Execute(closure, context).TryAs<runtime::Number>()) {
-            auto num1 = lhs_->Execute(closure, context).TryAs<runtime::Number>()->GetValue();
-            auto num2 = rhs_->Execute(closure, context).TryAs<runtime::Number>()->GetValue();
-            auto sum = num1 + num2;
+    ObjectHolder Negate::Execute(Closure& closure, Context& context) const {
+        auto value = ExecuteOperand(*arg_, closure, context);
+        if (value.TryAs<runtime::Number>()) {
+            runtime::Number answer(-value.TryAs<runtime::Number>()->GetValue());
+            return ObjectHolder::Own(std::move(answer));
+        }
+        runtime::Throw(runtime_error(""));
+    }
+
+    ObjectHolder Add::Execute(Closure& closure, Context& context) const {
+        auto lhs = ExecuteOperand(*lhs_, closure, context);
+        auto rhs = ExecuteOperand(*rhs_, closure, context);
+        if (lhs.TryAs<runtime::Number>() && rhs.TryAs<runtime::Number>()) {
+            auto sum = lhs.TryAs<runtime::Number>()->GetValue() + rhs.TryAs<runtime::Number>()->GetValue();
             runtime::Number answer(sum);
             return ObjectHolder::Own(std::move(answer));
-        } else if (lhs_->Execute(closure, context).TryAs<runtime::String>() && rhs_->Execute(closure, context).TryAs<runtime::String>()) {
-            auto str1 = lhs_->Execute(closure, context).TryAs<runtime::String>()->GetValue();
-            auto str2 = rhs_->Execute(closure, context).TryAs<runtime::String>()->GetValue();
-            auto str_concat = str1 + str2;
-            runtime::String answer(str_concat);
+        } else if (lhs.TryAs<runtime::String>() && rhs.TryAs<runtime::String>()) {
+            auto answer = runtime::String::Concat(*lhs.TryAs<runtime::String>(), *rhs.TryAs<runtime::String>());
             return ObjectHolder::Own(std::move(answer));
-        } else if (lhs_->Execute(closure, context).TryAs<runtime::ClassInstance>() && lhs_->Execute(closure, context).TryAs<runtime::ClassInstance>()->HasMethod(ADD_METHOD, 1)) {
-            return lhs_->Execute(closure, context).TryAs<runtime::ClassInstance>()->Call(ADD_METHOD, {rhs_->Execute(closure, context)}, context);
+        } else if (lhs.TryAs<runtime::ClassInstance>() && lhs.TryAs<runtime::ClassInstance>()->HasMethod(ADD_METHOD, 1)) {
+            return lhs.TryAs<runtime::ClassInstance>()->Call(ADD_METHOD, {rhs}, context);
         } else {
-            throw runtime_error("");
+            runtime::Throw(runtime_error(""));
         }
     }
 
-    ObjectHolder Sub::Execute(Closure& closure, Context& context) {
-        if (lhs_->Execute(closure, context).TryAs<runtime::Number>() && rhs_->Execute(closure, context).TryAs<runtime::Number>()) {
-            auto num1 = lhs_->Execute(closure, context).TryAs<runtime::Number>()->GetValue();
-            auto num2 = rhs_->Execute(closure, context).TryAs<runtime::Number>()->GetValue();
+    ObjectHolder Sub::Execute(Closure& closure, Context& context) const {
+        auto lhs = ExecuteOperand(*lhs_, closure, context);
+        auto rhs = ExecuteOperand(*rhs_, closure, context);
+        if (lhs.TryAs<runtime::Number>() && rhs.TryAs<runtime::Number>()) {
+            auto num1 = lhs.TryAs<runtime::Number>()->GetValue();
+            auto num2 = rhs.TryAs<runtime::Number>()->GetValue();
             auto sum = num1 - num2;
             runtime::Number answer(sum);
             return ObjectHolder::Own(std::move(answer));
         } else {
-            throw runtime_error("");
+            runtime::Throw(runtime_error(""));
         }
     }
 
-    ObjectHolder Mult::Execute(Closure& closure, Context& context) {
-        if (lhs_->Execute(closure, context).TryAs<runtime::Number>() && rhs_->Execute(closure, context).TryAs<runtime::Number>()) {
-            auto num1 = lhs_->Execute(closure, context).TryAs<runtime::Number>()->GetValue();
-            auto num2 = rhs_->Execute(closure, context).TryAs<runtime::Number>()->GetValue();
+    ObjectHolder Mult::Execute(Closure& closure, Context& context) const {
+        auto lhs = ExecuteOperand(*lhs_, closure, context);
+        auto rhs = ExecuteOperand(*rhs_, closure, context);
+        if (lhs.TryAs<runtime::Number>() && rhs.TryAs<runtime::Number>()) {
+            auto num1 = lhs.TryAs<runtime::Number>()->GetValue();
+            auto num2 = rhs.TryAs<runtime::Number>()->GetValue();
             auto sum = num1 * num2;
             runtime::Number answer(sum);
             return ObjectHolder::Own(std::move(answer));
         } else {
-            throw runtime_error("");
+            runtime::Throw(runtime_error(""));
         }
     }
 
-    ObjectHolder Div::Execute(Closure& closure, Context& context) {
-        if (lhs_->Execute(closure, context).TryAs<runtime::Number>() && rhs_->Execute(closure, context).TryAs<runtime::Number>()) {
-            auto num1 = lhs_->Execute(closure, context).TryAs<runtime::Number>()->GetValue();
-            auto num2 = rhs_->Execute(closure, context).TryAs<runtime::Number>()->GetValue();
-            if (num2 == 0) {throw runtime_error("");}
+    ObjectHolder Div::Execute(Closure& closure, Context& context) const {
+        auto lhs = ExecuteOperand(*lhs_, closure, context);
+        auto rhs = ExecuteOperand(*rhs_, closure, context);
+        if (lhs.TryAs<runtime::Number>() && rhs.TryAs<runtime::Number>()) {
+            auto num1 = lhs.TryAs<runtime::Number>()->GetValue();
+            auto num2 = rhs.TryAs<runtime::Number>()->GetValue();
+            if (num2 == 0) {runtime::Throw(runtime_error(""));}
             auto div = num1 / num2;
             runtime::Number answer(div);
             return ObjectHolder::Own(std::move(answer));
         } else {
-            throw runtime_error("");
+            runtime::Throw(runtime_error(""));
         }
     }
 
-    ObjectHolder Compound::Execute(Closure& closure, Context& context) {
-        for (const auto& arg : args_) {
-            arg->Execute(closure, context);
+    ObjectHolder Compound::Execute(Closure& closure, Context& context) const {
+        for (size_t i = 0; i < args_.size(); ++i) {
+            // Между инструкциями сигнал выхода из метода не установлен, поэтому зелёный поток
+            // может быть приостановлен здесь, не затрагивая состояния других потоков
+            runtime::SafePoint();
+            runtime::SetCurrentLine(lines_[i]);
+            args_[i]->Execute(closure, context);
+            if (method_exit.kind != MethodExit::Kind::NONE) {
+                break;
+            }
         }
         return {};
     }
 
-    namespace {
-        class ReturnExcept : exception {
-        public:
-            ReturnExcept(ObjectHolder obj) : answer_(std::move(obj)) {}
-            ObjectHolder GetResponse() const {
-                return answer_;
-            }
-        private:
-            ObjectHolder answer_;
-        };
-    }
-    ObjectHolder Return::Execute(Closure& closure, Context& context) {
+    ObjectHolder Return::Execute(Closure& closure, Context& context) const {
         auto result = statement_->Execute(closure, context);
-        throw ReturnExcept(std::move(result));
+        // Хвостовой вызов уже записал сигнал о выходе из метода
+        if (method_exit.kind == MethodExit::Kind::NONE) {
+            method_exit.kind = MethodExit::Kind::RETURN;
+            method_exit.value = std::move(result);
+        }
+        return {};
     }
 
-    ClassDefinition::ClassDefinition(ObjectHolder cls) : cls_(std::move(cls)) { }
+    Import::Import(std::string module_name) : module_name_(std::move(module_name)) {}
+
+    ObjectHolder Import::Execute(Closure& closure, Context& context) const {
+        ModuleLoader* modules = context.GetModules();
+        if (modules == nullptr) {
+            runtime::Throw(runtime_error("Modules are not available"s));
+        }
+        auto module = modules->Import(module_name_, context);
+        closure[module_name_] = module;
+        return module;
+    }
 
-    ObjectHolder ClassDefinition::Execute(Closure& closure, Context& /*context*/) {
+        ClassDefinition::ClassDefinition(ObjectHolder cls) : cls_(std::move(cls)) { }
+
+    Spawn::Spawn(runtime::Class& cls, std::vector<std::unique_ptr<Statement>> args)
+        : cls_(cls)
+        , args_(std::move(args)) {
+    }
+
+    ObjectHolder Spawn::Execute(Closure& closure, Context& context) const {
+        runtime::ArgumentList actual_args;
+        for (const auto& arg : args_) {
+            actual_args.push_back(arg->Execute(closure, context));
+        }
+        return ObjectHolder::Own(runtime::Actor(cls_, actual_args, context));
+    }
+
+    Send::Send(std::vector<std::unique_ptr<Statement>> args)
+        : args_(std::move(args)) {
+    }
+
+    ObjectHolder Send::Execute(Closure& closure, Context& context) const {
+        auto actor = args_[0]->Execute(closure, context);
+        auto method = args_[1]->Execute(closure, context);
+        if (actor.TryAs<runtime::Actor>() == nullptr || method.TryAs<runtime::String>() == nullptr) {
+            runtime::Throw(runtime_error("send() expects an actor and a method name"s));
+        }
+        runtime::ArgumentList actual_args;
+        for (size_t i = 2; i < args_.size(); ++i) {
+            actual_args.push_back(args_[i]->Execute(closure, context));
+        }
+        actor.TryAs<runtime::Actor>()->Send(method.TryAs<runtime::String>()->GetValue(), actual_args,
+                                            context);
+        return {};
+    }
+
+    ObjectHolder ClassDefinition::Execute(Closure& closure, Context& /*context*/) const {
         auto class_name = cls_.TryAs<runtime::Class>()->GetName();
         closure[class_name] = cls_;
         return closure[class_name];
@@ -191,19 +373,25 @@ namespace ast {
     FieldAssignment::FieldAssignment(VariableValue object, std::string field_name,
                                      std::unique_ptr<Statement> rv) : obj_(object), field_name_(field_name), rv_(std::move(rv)) {}
 
-    ObjectHolder FieldAssignment::Execute(Closure& closure, Context& context) {
-        if (obj_.Execute(closure,context).TryAs<runtime::ClassInstance>() != nullptr) {
-            obj_.Execute(closure,context).TryAs<runtime::ClassInstance>()->Fields()[field_name_] = rv_->Execute(closure, context);
-        } else {
-            throw runtime_error("");
+    ObjectHolder FieldAssignment::Execute(Closure& closure, Context& context) const {
+        auto object = obj_.Execute(closure, context);
+        auto* instance = object.TryAs<runtime::ClassInstance>();
+        if (instance == nullptr) {
+            runtime::Throw(runtime_error(""));
         }
-        return obj_.Execute(closure,context).TryAs<runtime::ClassInstance>()->Fields()[field_name_];
+        if (parallel_owned != nullptr && parallel_owned->count(instance) == 0) {
+            runtime::Throw(runtime_error("Data race: parallel for iteration assigns field "s + field_name_
+                                + " of an object it didn't create"s));
+        }
+        auto value = rv_->Execute(closure, context);
+        instance->Fields()[field_name_] = value;
+        return value;
     }
 
     IfElse::IfElse(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> if_body,
                    std::unique_ptr<Statement> else_body) : condition_(std::move(condition)), if_body_(std::move(if_body)), else_body_(std::move(else_body)){}
 
-    ObjectHolder IfElse::Execute(Closure& closure, Context& context) {
+    ObjectHolder IfElse::Execute(Closure& closure, Context& context) const {
         if (runtime::IsTrue(condition_->Execute(closure, context))) {
             return if_body_->Execute(closure, context);
         } else {
@@ -214,69 +402,387 @@ namespace ast {
         return {};
     }
 
-    ObjectHolder Or::Execute(Closure& closure, Context& context) {
-        bool lhs_bool = IsTrue(lhs_->Execute(closure, context));
+    While::While(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> body)
+        : condition_(std::move(condition)), body_(std::move(body)) {}
+
+    ObjectHolder While::Execute(Closure& closure, Context& context) const {
+        while (runtime::IsTrue(condition_->Execute(closure, context))) {
+            body_->Execute(closure, context);
+            if (method_exit.kind != MethodExit::Kind::NONE) {
+                break;
+            }
+        }
+        return {};
+    }
+
+    ForRange::ForRange(std::string var, std::unique_ptr<Statement> begin, std::unique_ptr<Statement> end,
+                       std::unique_ptr<Statement> body)
+        : var_(std::move(var)), begin_(std::move(begin)), end_(std::move(end)), body_(std::move(body)) {}
+
+    ObjectHolder ForRange::Execute(Closure& closure, Context& context) const {
+        auto begin = begin_->Execute(closure, context);
+        auto end = end_->Execute(closure, context);
+        if (!begin.TryAs<runtime::Number>() || !end.TryAs<runtime::Number>()) {
+            runtime::Throw(runtime_error(""));
+        }
+        const int last = end.TryAs<runtime::Number>()->GetValue();
+
+        // Указатели на элементы unordered_map не инвалидируются при добавлении новых переменных
+        ObjectHolder* slot = nullptr;
+        runtime::Number* counter = nullptr;
+        for (int i = begin.TryAs<runtime::Number>()->GetValue(); i < last; ++i) {
+            if (slot == nullptr) {
+                slot = &closure[var_];
+            }
+            if (counter != nullptr && slot->TryAs<runtime::Number>() == counter && slot->IsUnique()) {
+                counter->SetValue(i);
+            } else {
+                *slot = ObjectHolder::Own(runtime::Number(i));
+                counter = slot->TryAs<runtime::Number>();
+            }
+
+            body_->Execute(closure, context);
+            if (method_exit.kind != MethodExit::Kind::NONE) {
+                break;
+            }
+        }
+        return {};
+    }
+
+    ParallelFor::ParallelFor(std::string var, std::unique_ptr<Statement> begin,
+                             std::unique_ptr<Statement> end, std::vector<Reducer> reducers,
+                             std::unique_ptr<Statement> body)
+        : var_(std::move(var))
+        , begin_(std::move(begin))
+        , end_(std::move(end))
+        , reducers_(std::move(reducers))
+        , body_(std::move(body)) {
+    }
+
+    namespace {
+        atomic<size_t> parallel_thread_count{max(thread::hardware_concurrency(), 1U)};
+
+        // Пул потоков, общий для всех циклов parallel for
+        WorkStealingPool& ParallelPool() {
+            static WorkStealingPool pool(parallel_thread_count.load());
+            return pool;
+        }
+
+        // Сколько частей диапазона приходится на поток пула: итерации разной длительности
+        // выравниваются перехватом частей
+        constexpr size_t CHUNKS_PER_THREAD = 4;
+
+        // Контекст части диапазона parallel for: собственные вывод и таблицы запомненных
+        // результатов, общий с программой загрузчик модулей
+        class IterationContext : public Context {
+        public:
+            explicit IterationContext(ModuleLoader* modules)
+                : modules_(modules) {
+            }
+
+            ostream& GetOutputStream() override {
+                return output_;
+            }
+
+            ModuleLoader* GetModules() override {
+                return modules_;
+            }
+
+            runtime::MemoCache* GetMemoCache() override {
+                return &memo_;
+            }
+
+            string TakeOutput() {
+                return std::move(output_).str();
+            }
+
+        private:
+            ostringstream output_;
+            ModuleLoader* modules_;
+            runtime::MemoCache memo_;
+        };
+
+        // Добавляет value к свёртке acc
+        ObjectHolder Reduce(ParallelFor::Reduction kind, const ObjectHolder& acc,
+                            const ObjectHolder& value, Context& context) {
+            if (!value) {
+                return acc;
+            }
+            if (kind == ParallelFor::Reduction::APPEND) {
+                auto* value_str = value.TryAs<runtime::String>();
+                runtime::String tail = value_str != nullptr ? *value_str : runtime::String([&] {
+                    ostringstream out;
+                    value->Print(out, context);
+                    return out.str();
+                }());
+                auto* acc_str = acc.TryAs<runtime::String>();
+                if (!acc) {
+                    return ObjectHolder::Own(std::move(tail));
+                }
+                if (acc_str == nullptr) {
+                    runtime::Throw(runtime_error("append reduction expects a string"s));
+                }
+                return ObjectHolder::Own(runtime::String::Concat(*acc_str, tail));
+            }
+            if (!acc) {
+                return value;
+            }
+            switch (kind) {
+                case ParallelFor::Reduction::SUM: {
+                    auto* lhs = acc.TryAs<runtime::Number>();
+                    auto* rhs = value.TryAs<runtime::Number>();
+                    if (lhs == nullptr || rhs == nullptr) {
+                        runtime::Throw(runtime_error("sum reduction expects numbers"s));
+                    }
+                    return ObjectHolder::Own(runtime::Number(lhs->GetValue() + rhs->GetValue()));
+                }
+                case ParallelFor::Reduction::MIN:
+                    return runtime::Less(value, acc, context) ? value : acc;
+                default:
+                    return runtime::Greater(value, acc, context) ? value : acc;
+            }
+        }
+    }  // namespace
+
+    void ParallelFor::SetThreadCount(size_t count) {
+        parallel_thread_count = max<size_t>(count, 1);
+    }
+
+    ObjectHolder ParallelFor::Execute(Closure& closure, Context& context) const {
+        auto begin = begin_->Execute(closure, context);
+        auto end = end_->Execute(closure, context);
+        if (!begin.TryAs<runtime::Number>() || !end.TryAs<runtime::Number>()) {
+            runtime::Throw(runtime_error(""));
+        }
+        const int64_t first = begin.TryAs<runtime::Number>()->GetValue();
+        const int64_t last = end.TryAs<runtime::Number>()->GetValue();
+        const size_t count = last > first ? static_cast<size_t>(last - first) : 0;
+
+        // Итерации видят переменные программы через невладеющие ссылки: на время цикла
+        // объектами владеет closure, а копирование таких ссылок не трогает общих счётчиков
+        Closure shared;
+        for (const auto& [name, value] : closure) {
+            shared.emplace(name, value ? ObjectHolder::Share(*value) : ObjectHolder::None());
+        }
+        for (const auto& reducer : reducers_) {
+            shared.erase(reducer.var);
+        }
+
+        struct Chunk {
+            string output;
+            vector<ObjectHolder> partials;
+            exception_ptr error;
+        };
+        const size_t chunk_count = min(count, ParallelPool().GetThreadCount() * CHUNKS_PER_THREAD);
+        vector<Chunk> chunks(chunk_count);
+        // Номер первой части, завершившейся ошибкой. Части после неё прекращают работу,
+        // а предшествующие выполняются до конца: их вывод и результаты нужны программе
+        atomic<size_t> first_failed{numeric_limits<size_t>::max()};
+
+        auto run_chunk = [&](size_t index) {
+            Chunk& chunk = chunks[index];
+            chunk.partials.resize(reducers_.size());
+            IterationContext chunk_context(context.GetModules());
+            unordered_set<const runtime::Object*> owned;
+            auto* outer_owned = parallel_owned;
+            parallel_owned = &owned;
+            const int64_t chunk_first = first + static_cast<int64_t>(count * index / chunk_count);
+            const int64_t chunk_last = first + static_cast<int64_t>(count * (index + 1) / chunk_count);
+            try {
+                for (int64_t i = chunk_first; i < chunk_last && index < first_failed; ++i) {
+                    owned.clear();
+                    Closure iteration = shared;
+                    iteration[var_] = ObjectHolder::Own(runtime::Number(static_cast<int>(i)));
+                    body_->Execute(iteration, chunk_context);
+                    if (method_exit.kind != MethodExit::Kind::NONE) {
+                        method_exit = {};
+                        runtime::Throw(runtime_error("return can't be used inside parallel for"s));
+                    }
+                    for (size_t r = 0; r < reducers_.size(); ++r) {
+                        if (auto it = iteration.find(reducers_[r].var); it != iteration.end()) {
+                            chunk.partials[r] = Reduce(reducers_[r].kind, chunk.partials[r],
+                                                       it->second, chunk_context);
+                        }
+                    }
+                }
+            } catch (...) {
+                chunk.error = current_exception();
+                size_t failed = first_failed;
+                while (index < failed && !first_failed.compare_exchange_weak(failed, index)) {
+                }
+            }
+            parallel_owned = outer_owned;
+            chunk.output = chunk_context.TakeOutput();
+        };
+
+        uint64_t used_steps = 0;
+        if (parallel_owned != nullptr || chunk_count <= 1) {
+            for (size_t i = 0; i < chunk_count; ++i) {
+                run_chunk(i);
+            }
+        } else {
+            // Пул общий, поэтому завершения своих частей цикл ждёт сам, а не через Wait пула
+            // Части, выполняемые другими потоками, получают остаток ограничений выполнения,
+            // а их шаги списываются после завершения цикла
+            const auto budget = runtime::GetRemainingBudget();
+            mutex done_mutex;
+            condition_variable all_done;
+            size_t unfinished = chunk_count;
+            for (size_t i = 0; i < chunk_count; ++i) {
+                ParallelPool().Submit([&, i] {
+                    uint64_t steps = 0;
+                    if (budget) {
+                        runtime::BudgetScope budget_scope(*budget);
+                        run_chunk(i);
+                        steps = budget_scope.GetUsedSteps();
+                    } else {
+                        run_chunk(i);
+                    }
+                    lock_guard lock(done_mutex);
+                    used_steps += steps;
+                    if (--unfinished == 0) {
+                        all_done.notify_one();
+                    }
+                });
+            }
+            unique_lock lock(done_mutex);
+            all_done.wait(lock, [&unfinished] {
+                return unfinished == 0;
+            });
+        }
+        runtime::detail::ChargeSteps(static_cast<int64_t>(used_steps));
+
+        // Вывод и результаты объединяются в порядке итераций до первой ошибки
+        vector<ObjectHolder> results(reducers_.size());
+        for (size_t r = 0; r < reducers_.size(); ++r) {
+            if (auto it = closure.find(reducers_[r].var); it != closure.end()) {
+                results[r] = it->second;
+            }
+        }
+        auto& output = context.GetOutputStream();
+        for (auto& chunk : chunks) {
+            output << chunk.output;
+            if (chunk.error) {
+                rethrow_exception(chunk.error);
+            }
+            for (size_t r = 0; r < reducers_.size(); ++r) {
+                results[r] = Reduce(reducers_[r].kind, results[r], chunk.partials[r], context);
+            }
+        }
+        for (size_t r = 0; r < reducers_.size(); ++r) {
+            // Невладеющую ссылку на переменную программы заменяет владеющая:
+            // после цикла переменную могут переприсвоить
+            for (const auto& [name, value] : closure) {
+                if (results[r] && value.Get() == results[r].Get()) {
+                    results[r] = value;
+                    break;
+                }
+            }
+            closure[reducers_[r].var] = results[r];
+        }
+        return {};
+    }
+
+    ObjectHolder Or::Execute(Closure& closure, Context& context) const {
+        bool lhs_bool = IsTrue(ExecuteOperand(*lhs_, closure, context));
 
         if (lhs_bool) {
             runtime::Bool answer(lhs_bool);
             return ObjectHolder::Own(std::move(answer));
         } else {
-            runtime::Bool answer(runtime::IsTrue(rhs_->Execute(closure, context)));
+            runtime::Bool answer(runtime::IsTrue(ExecuteOperand(*rhs_, closure, context)));
             return ObjectHolder::Own(std::move(answer));
         }
     }
 
-    ObjectHolder And::Execute(Closure& closure, Context& context) {
-        bool lhs_bool = IsTrue(lhs_->Execute(closure, context));
+    ObjectHolder And::Execute(Closure& closure, Context& context) const {
+        bool lhs_bool = IsTrue(ExecuteOperand(*lhs_, closure, context));
 
         if (!lhs_bool) {
             runtime::Bool answer(lhs_bool);
             return ObjectHolder::Own(std::move(answer));
         } else {
-            runtime::Bool answer(runtime::IsTrue(rhs_->Execute(closure, context)));
+            runtime::Bool answer(runtime::IsTrue(ExecuteOperand(*rhs_, closure, context)));
             return ObjectHolder::Own(std::move(answer));
         }
     }
 
-    ObjectHolder Not::Execute(Closure& closure, Context& context) {
-        runtime::Bool answer(!runtime::IsTrue(arg_->Execute(closure, context)));
+    ObjectHolder Not::Execute(Closure& closure, Context& context) const {
+        runtime::Bool answer(!runtime::IsTrue(ExecuteOperand(*arg_, closure, context)));
         return ObjectHolder::Own(std::move(answer));
     }
 
     Comparison::Comparison(Comparator cmp, unique_ptr<Statement> lhs, unique_ptr<Statement> rhs)
             : BinaryOperation(std::move(lhs), std::move(rhs)), cmp_(cmp) { }
 
-    ObjectHolder Comparison::Execute(Closure& closure, Context& context) {
-        auto result = cmp_(lhs_->Execute(closure, context), rhs_->Execute(closure, context), context);
+    ObjectHolder Comparison::Execute(Closure& closure, Context& context) const {
+        auto result = cmp_(ExecuteOperand(*lhs_, closure, context), ExecuteOperand(*rhs_, closure, context), context);
         runtime::Bool result_bool(result);
         return ObjectHolder::Own(std::move(result_bool));
 
     }
 
-    NewInstance::NewInstance(runtime::Class& class_, std::vector<std::unique_ptr<Statement>> args) : new_instance_(class_), args_(std::move(args)) {}
+    NewInstance::NewInstance(runtime::Class& class_, std::vector<std::unique_ptr<Statement>> args) : class_(class_), args_(std::move(args)) {}
 
-    NewInstance::NewInstance(runtime::Class& class_) : new_instance_(class_) {}
+    NewInstance::NewInstance(runtime::Class& class_) : class_(class_) {}
 
-    ObjectHolder NewInstance::Execute(Closure& closure, Context& context) {
-        if (new_instance_.HasMethod(INIT_METHOD, args_.size())) {
-            std::vector<ObjectHolder> actual_args;
+    ObjectHolder NewInstance::Execute(Closure& closure, Context& context) const {
+        auto instance = ObjectHolder::Own(runtime::ClassInstance(class_));
+        NoteNewInstance(instance);
+        auto& new_instance = *instance.TryAs<runtime::ClassInstance>();
+        if (new_instance.HasMethod(INIT_METHOD, args_.size())) {
+            runtime::ArgumentList actual_args;
             for (const auto& arg : args_) {
                 actual_args.push_back(arg->Execute(closure, context));
             }
-            new_instance_.Call(INIT_METHOD, actual_args, context);
+            new_instance.Call(INIT_METHOD, actual_args, context);
         }
-        return ObjectHolder::Share(new_instance_);
+        return instance;
     }
 
     MethodBody::MethodBody(std::unique_ptr<Statement>&& body) : body_(std::move(body)) { }
 
-    ObjectHolder MethodBody::Execute(Closure& closure, Context& context) {
-        try {
-            body_->Execute(closure, context);
-        } catch (ReturnExcept& result) {
-            return result.GetResponse();
+    MethodBody::MethodBody(BodyParser parse_body) : parse_body_(std::move(parse_body)) { }
+
+    const Statement& MethodBody::Body() const {
+        // После первого вызова call_once сводится к проверке флага
+        std::call_once(parsed_, [this] {
+            if (parse_body_) {
+                body_ = parse_body_();
+                // Записанные лексемы тела больше не нужны
+                parse_body_ = nullptr;
+            }
+        });
+        return *body_;
+    }
+
+    ObjectHolder MethodBody::Execute(Closure& closure, Context& context) const {
+        const Statement* body = &Body();
+        ObjectHolder callee;
+        method_exit.kind = MethodExit::Kind::NONE;
+        while (true) {
+            body->Execute(closure, context);
+
+            auto kind = std::exchange(method_exit.kind, MethodExit::Kind::NONE);
+            if (kind == MethodExit::Kind::RETURN) {
+                return std::exchange(method_exit.value, {});
+            }
+            if (kind == MethodExit::Kind::NONE) {
+                return {};
+            }
+
+            callee = std::exchange(method_exit.value, {});
+            auto args = std::move(method_exit.args);
+            auto* instance = callee.TryAs<runtime::ClassInstance>();
+            const runtime::Method& method = instance->BindCall(*method_exit.method, args, closure);
+            runtime::ReplaceTopShadowFrame(instance->GetClass(), method);
+            runtime::CountMethodCall(instance->GetClass(), method);
+            auto* method_body = dynamic_cast<MethodBody*>(method.body.get());
+            if (method_body == nullptr) {
+                return method.body->Execute(closure, context);
+            }
+            body = &method_body->Body();
         }
-        return {};
     }
 
 }  // namespace ast
\ No newline at end of file
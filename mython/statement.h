@@ -3,27 +3,32 @@
 #include "runtime.h"
 
 #include <functional>
+#include <mutex>
 
 namespace ast {
 
 using Statement = runtime::Executable;
 
 // Выражение, возвращающее значение типа T,
-// используется как основа для создания констант
+// используется как основа для создания констант.
+// Значение константы никогда не изменяется, поэтому один узел могут одновременно выполнять
+// несколько потоков. Execute возвращает невладеющую ссылку на значение: так потокам
+// не приходится изменять общий счётчик ссылок, а ForRange не меняет число на месте,
+// потому что невладеющая ссылка не бывает единственной
 template <typename T>
 class ValueStatement : public Statement {
 public:
     explicit ValueStatement(T v)
-        : value_(std::move(v)) {
+        : value_(runtime::ObjectHolder::Own(std::move(v))) {
     }
 
     runtime::ObjectHolder Execute(runtime::Closure& /*closure*/,
-                                  runtime::Context& /*context*/) override {
-        return runtime::ObjectHolder::Share(value_);
+                                  runtime::Context& /*context*/) const override {
+        return runtime::ObjectHolder::Share(*value_);
     }
 
 private:
-    T value_;
+    runtime::ObjectHolder value_;
 };
 
 using NumericConst = ValueStatement<runtime::Number>;
@@ -40,7 +45,14 @@ public:
     explicit VariableValue(const std::string& var_name);
     explicit VariableValue(std::vector<std::string> dotted_ids);
 
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+
+    // Проходит цепочку id1.id2...idN по полям объектов, не создавая промежуточных копий,
+    // и возвращает ячейку, в которой хранится значение idN.
+    // Если какого-либо имени нет либо промежуточное значение не объект класса, выбрасывает runtime_error
+    runtime::ObjectHolder& Resolve(runtime::Closure& closure) const;
+
+    [[nodiscard]] const std::vector<std::string>& GetDottedIds() const;
 private:
     std::vector<std::string> dotted_ids_;
 };
@@ -50,7 +62,7 @@ class Assignment : public Statement {
 public:
     Assignment(std::string var, std::unique_ptr<Statement> rv);
 
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
     std::string var_;
     std::unique_ptr<Statement> rv_;
@@ -61,7 +73,7 @@ class FieldAssignment : public Statement {
 public:
     FieldAssignment(VariableValue object, std::string field_name, std::unique_ptr<Statement> rv);
 
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
     VariableValue obj_;
     std::string field_name_;
@@ -72,7 +84,7 @@ private:
 class None : public Statement {
 public:
     runtime::ObjectHolder Execute([[maybe_unused]] runtime::Closure& closure,
-                                  [[maybe_unused]] runtime::Context& context) override {
+                                  [[maybe_unused]] runtime::Context& context) const override {
         return {};
     }
 };
@@ -89,22 +101,29 @@ public:
 
     // Во время выполнения команды print вывод должен осуществляться в поток, возвращаемый из
     // context.GetOutputStream()
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
     std::vector<std::unique_ptr<Statement>> args_;
 };
 
-// Вызывает метод object.method со списком параметров args
+// Вызывает метод object.method со списком параметров args.
+// Если object — модуль, создаёт экземпляр класса method, объявленного в этом модуле,
+// а если актор — выполняет метод в потоке актора и дожидается результата
 class MethodCall : public Statement {
 public:
     MethodCall(std::unique_ptr<Statement> object, std::string method,
                std::vector<std::unique_ptr<Statement>> args);
 
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    // Помечает вызов как хвостовой (return object.method(args)). Такой вызов выполняется
+    // в кадре вызывающего метода: MethodBody переиспользует его closure вместо рекурсии
+    void MarkAsTailCall();
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
     std::unique_ptr<Statement> object_;
     std::string method_;
     std::vector<std::unique_ptr<Statement>> args_;
+    bool is_tail_call_ = false;
 };
 
 /*
@@ -124,10 +143,11 @@ class NewInstance : public Statement {
 public:
     explicit NewInstance(runtime::Class& class_);
     NewInstance(runtime::Class& class_, std::vector<std::unique_ptr<Statement>> args);
-    // Возвращает объект, содержащий значение типа ClassInstance
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    // Возвращает новый объект типа ClassInstance. Каждое выполнение создаёт отдельный экземпляр,
+    // поэтому повторный запуск программы не видит полей, заданных предыдущим
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
-    runtime::ClassInstance new_instance_;
+    runtime::Class& class_;
     std::vector<std::unique_ptr<Statement>> args_;
 };
 
@@ -135,6 +155,8 @@ private:
 class UnaryOperation : public Statement {
 public:
     explicit UnaryOperation(std::unique_ptr<Statement> argument) : arg_(std::move(argument)){}
+    // Глубоко вложенные выражения разрушаются без переполнения стека потока
+    ~UnaryOperation() override;
     std::unique_ptr<Statement> arg_;
 };
 
@@ -142,13 +164,24 @@ public:
 class Stringify : public UnaryOperation {
 public:
     using UnaryOperation::UnaryOperation;
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+};
+
+// Операция унарного минуса, возвращающая число с противоположным знаком
+class Negate : public UnaryOperation {
+public:
+    using UnaryOperation::UnaryOperation;
+
+    // Поддерживается только число. В противном случае выбрасывается исключение runtime_error
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Родительский класс Бинарная операция с аргументами lhs и rhs
 class BinaryOperation : public Statement {
 public:
     BinaryOperation(std::unique_ptr<Statement> lhs, std::unique_ptr<Statement> rhs) : lhs_(std::move(lhs)), rhs_(std::move(rhs)) {}
+    // Глубоко вложенные выражения разрушаются без переполнения стека потока
+    ~BinaryOperation() override;
     std::unique_ptr<Statement> lhs_;
     std::unique_ptr<Statement> rhs_;
 };
@@ -163,7 +196,7 @@ public:
     //  строка + строка
     //  объект1 + объект2, если у объект1 - пользовательский класс с методом _add__(rhs)
     // В противном случае при вычислении выбрасывается runtime_error
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат вычитания аргументов lhs и rhs
@@ -174,7 +207,7 @@ public:
     // Поддерживается вычитание:
     //  число - число
     // Если lhs и rhs - не числа, выбрасывается исключение runtime_error
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат умножения аргументов lhs и rhs
@@ -185,7 +218,7 @@ public:
     // Поддерживается умножение:
     //  число * число
     // Если lhs и rhs - не числа, выбрасывается исключение runtime_error
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат деления lhs и rhs
@@ -198,7 +231,7 @@ public:
     //  число / число
     // Если lhs и rhs - не числа, выбрасывается исключение runtime_error
     // Если rhs равен 0, выбрасывается исключение runtime_error
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат вычисления логической операции or над lhs и rhs
@@ -207,7 +240,7 @@ public:
     using BinaryOperation::BinaryOperation;
     // Значение аргумента rhs вычисляется, только если значение lhs
     // после приведения к Bool равно False
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат вычисления логической операции and над lhs и rhs
@@ -216,14 +249,14 @@ public:
     using BinaryOperation::BinaryOperation;
     // Значение аргумента rhs вычисляется, только если значение lhs
     // после приведения к Bool равно True
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 // Возвращает результат вычисления логической операции not над единственным аргументом операции
 class Not : public UnaryOperation {
 public:
     using UnaryOperation::UnaryOperation;
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 };
 
 class Compound : public Statement {
@@ -245,28 +278,46 @@ public:
         }
     }
 
-    // Добавляет очередную инструкцию в конец составной инструкции
-    void AddStatement(std::unique_ptr<Statement> stmt) {
+    // Добавляет очередную инструкцию в конец составной инструкции.
+    // line — номер строки программы, на которой начинается инструкция, либо 0, если он неизвестен
+    void AddStatement(std::unique_ptr<Statement> stmt, uint32_t line = 0) {
         args_.push_back(std::move(stmt));
+        lines_.push_back(line);
     }
 
-    // Последовательно выполняет добавленные инструкции. Возвращает None
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    // Последовательно выполняет добавленные инструкции, отмечая для профилировщика
+    // строку выполняемой инструкции. Возвращает None
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
     std::vector<std::unique_ptr<Statement>> args_;
+    std::vector<uint32_t> lines_;
 };
 
 // Тело метода. Как правило, содержит составную инструкцию
 class MethodBody : public Statement {
 public:
+    // Функция, которая разбирает тело метода при первом вызове
+    using BodyParser = std::function<std::unique_ptr<Statement>()>;
+
     explicit MethodBody(std::unique_ptr<Statement>&& body);
+    // Создаёт тело, которое будет разобрано функцией parse_body при первом выполнении.
+    // Если разбор завершится исключением, он будет повторён при следующем вызове
+    explicit MethodBody(BodyParser parse_body);
 
     // Вычисляет инструкцию, переданную в качестве body.
     // Если внутри body была выполнена инструкция return, возвращает результат return
     // В противном случае возвращает None
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    // Хвостовые вызовы выполняются в цикле, переиспользуя closure в качестве кадра вызываемого метода
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
-    std::unique_ptr<Statement> body_;
+    // Возвращает тело метода, разбирая его при необходимости
+    const Statement& Body() const;
+
+    // Единственное состояние узла, изменяемое при выполнении: тело разбирается однократно
+    // под защитой parsed_, даже если метод впервые вызывают одновременно несколько потоков
+    mutable std::unique_ptr<Statement> body_;
+    mutable BodyParser parse_body_;
+    mutable std::once_flag parsed_;
 };
 
 // Выполняет инструкцию return с выражением statement
@@ -276,7 +327,7 @@ public:
 
     // Останавливает выполнение текущего метода. После выполнения инструкции return метод,
     // внутри которого она была исполнена, должен вернуть результат вычисления выражения statement.
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
     std::unique_ptr<Statement> statement_;
 };
@@ -289,11 +340,46 @@ public:
 
     // Создаёт внутри closure новый объект, совпадающий с именем класса и значением, переданным в
     // конструктор
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
     runtime::ObjectHolder cls_;
 };
 
+// Инструкция import <module_name>: загружает модуль загрузчиком из контекста исполнения
+// и связывает его с именем module_name в closure
+class Import : public Statement {
+public:
+    explicit Import(std::string module_name);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+private:
+    std::string module_name_;
+};
+
+// Встроенная функция spawn(cls, args...): запускает актор с экземпляром класса cls
+// и возвращает ссылку на него (см. runtime::Actor)
+class Spawn : public Statement {
+public:
+    Spawn(runtime::Class& cls, std::vector<std::unique_ptr<Statement>> args);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+private:
+    runtime::Class& cls_;
+    std::vector<std::unique_ptr<Statement>> args_;
+};
+
+// Встроенная функция send(actor, method, args...): ставит вызов метода method с параметрами args
+// в почтовый ящик актора и возвращает None, не дожидаясь выполнения.
+// Если actor не актор либо method не строка, выбрасывает runtime_error
+class Send : public Statement {
+public:
+    explicit Send(std::vector<std::unique_ptr<Statement>> args);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+private:
+    std::vector<std::unique_ptr<Statement>> args_;
+};
+
 // Инструкция if <condition> <if_body> else <else_body>
 class IfElse : public Statement {
 public:
@@ -301,13 +387,87 @@ public:
     IfElse(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> if_body,
            std::unique_ptr<Statement> else_body);
 
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
     std::unique_ptr<Statement> condition_;
     std::unique_ptr<Statement> if_body_;
     std::unique_ptr<Statement> else_body_;
 };
 
+// Инструкция while <condition>: <body>
+class While : public Statement {
+public:
+    While(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> body);
+
+    // Выполняет body, пока значение condition приводится к True. Возвращает None
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+private:
+    std::unique_ptr<Statement> condition_;
+    std::unique_ptr<Statement> body_;
+};
+
+// Инструкция for <var> in range(<begin>, <end>): <body>
+class ForRange : public Statement {
+public:
+    ForRange(std::string var, std::unique_ptr<Statement> begin, std::unique_ptr<Statement> end,
+             std::unique_ptr<Statement> body);
+
+    // Вычисляет begin и end (они должны быть числами) и выполняет body для каждого значения
+    // var из полуинтервала [begin, end). Если значение переменной var не сохранено в другом месте,
+    // число в ней обновляется на месте, без создания нового объекта. Возвращает None
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+private:
+    std::string var_;
+    std::unique_ptr<Statement> begin_;
+    std::unique_ptr<Statement> end_;
+    std::unique_ptr<Statement> body_;
+};
+
+/*
+Инструкция parallel for <var> in range(<begin>, <end>) [<reduction> <name>, ...]: <body>
+
+Итерации выполняются в пуле потоков. Каждая итерация получает собственный closure,
+в котором видны переменные программы на момент начала цикла и значение var; присваивания
+переменным в теле не видны ни другим итерациям, ни программе после цикла.
+Результаты передаются только через свёртки: значение, которое итерация оставила в переменной
+name, объединяется со значениями других итераций и с исходным значением name (если оно есть)
+в порядке номеров итераций и записывается в name после цикла. Итерация, не присвоившая name
+значения, в свёртку не входит. Свёртки:
+  sum — сумма чисел;
+  min, max — наименьшее и наибольшее значение в смысле операции <;
+  append — строка, составленная из строковых представлений значений.
+
+Итерация может изменять поля только тех объектов, которые сама создала: присваивание поля
+любого другого объекта — гонка данных, и оно выбрасывает runtime_error. Вывод print
+появляется в порядке номеров итераций. При ошибке итерации цикл прекращается, выводится
+вывод итераций до неё, а её исключение выбрасывается из Execute.
+Цикл внутри итерации другого parallel for выполняется в её потоке
+*/
+class ParallelFor : public Statement {
+public:
+    // Задаёт число потоков пула, выполняющего итерации (по умолчанию - число ядер).
+    // Действует, только если вызвана до первого выполнения parallel for
+    static void SetThreadCount(size_t count);
+
+    enum class Reduction { SUM, MIN, MAX, APPEND };
+
+    struct Reducer {
+        Reduction kind;
+        std::string var;
+    };
+
+    ParallelFor(std::string var, std::unique_ptr<Statement> begin, std::unique_ptr<Statement> end,
+                std::vector<Reducer> reducers, std::unique_ptr<Statement> body);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
+private:
+    std::string var_;
+    std::unique_ptr<Statement> begin_;
+    std::unique_ptr<Statement> end_;
+    std::vector<Reducer> reducers_;
+    std::unique_ptr<Statement> body_;
+};
+
 // Операция сравнения
 class Comparison : public BinaryOperation {
 public:
@@ -319,7 +479,7 @@ public:
 
     // Вычисляет значение выражений lhs и rhs и возвращает результат работы comparator,
     // приведённый к типу runtime::Bool
-    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) const override;
 private:
     Comparator cmp_;
 };
@@ -106,6 +106,19 @@ void TestAssignment() {
     ASSERT(context.output.str().empty());
 }
 
+void TestNewInstanceCreatesDistinctObjects() {
+    runtime::DummyContext context;
+    runtime::Class empty("Empty"s, {}, nullptr);
+    NewInstance new_instance(empty);
+    Closure closure;
+
+    ObjectHolder first = new_instance.Execute(closure, context);
+    first.TryAs<runtime::ClassInstance>()->Fields()["x"s] = ObjectHolder::Own(runtime::Number(1));
+    ObjectHolder second = new_instance.Execute(closure, context);
+    ASSERT(first.Get() != second.Get());
+    ASSERT(second.TryAs<runtime::ClassInstance>()->Fields().empty());
+}
+
 void TestFieldAssignment() {
     runtime::DummyContext context;
 
@@ -237,6 +250,32 @@ void TestStringsAddition() {
     ASSERT(context.output.str().empty());
 }
 
+void TestRepeatedStringsAddition() {
+    runtime::DummyContext context;
+
+    const string piece = "0123456789"s;
+    const size_t count = 100000;
+    Closure closure = {{"s"s, ObjectHolder::Own(runtime::String(""s))}};
+
+    Assignment append("s"s, make_unique<Add>(make_unique<VariableValue>("s"s),
+                                             make_unique<StringConst>(piece)));
+    for (size_t i = 0; i < count; ++i) {
+        append.Execute(closure, context);
+    }
+
+    const auto* result = closure.at("s"s).TryAs<runtime::String>();
+    ASSERT(result != nullptr);
+    ASSERT_EQUAL(result->Size(), piece.size() * count);
+    ASSERT(runtime::IsTrue(closure.at("s"s)));
+
+    const string& value = result->GetValue();
+    ASSERT_EQUAL(value.size(), piece.size() * count);
+    ASSERT_EQUAL(value.substr(0, piece.size()), piece);
+    ASSERT_EQUAL(value.substr(value.size() - piece.size()), piece);
+
+    ASSERT(context.output.str().empty());
+}
+
 void TestBadAddition() {
     runtime::DummyContext context;
 
@@ -344,6 +383,78 @@ void TestFields() {
     ASSERT(context.output.str().empty());
 }
 
+void TestDeepFieldChain() {
+    runtime::DummyContext context;
+
+    runtime::Class cls("Node"s, {}, nullptr);
+    Closure closure;
+    closure["a"s] = ObjectHolder::Own(runtime::ClassInstance{cls});
+    closure["a"s].TryAs<runtime::ClassInstance>()->Fields()["b"s] = ObjectHolder::Own(runtime::ClassInstance{cls});
+    auto& b = *closure["a"s].TryAs<runtime::ClassInstance>()->Fields()["b"s].TryAs<runtime::ClassInstance>();
+    b.Fields()["c"s] = ObjectHolder::Own(runtime::Number(42));
+
+    VariableValue chain(vector{"a"s, "b"s, "c"s});
+    ASSERT_OBJECT_VALUE_EQUAL(chain.Execute(closure, context), 42);
+    ASSERT_EQUAL(&chain.Resolve(closure), &b.Fields().at("c"s));
+
+    FieldAssignment assign(VariableValue(vector{"a"s, "b"s}), "c"s, make_unique<NumericConst>(7));
+    ASSERT_OBJECT_VALUE_EQUAL(assign.Execute(closure, context), 7);
+    ASSERT_OBJECT_VALUE_EQUAL(chain.Execute(closure, context), 7);
+
+    try {
+        VariableValue(vector{"a"s, "b"s, "c"s, "d"s}).Execute(closure, context);
+        ASSERT(false);
+    } catch (const std::runtime_error&) {
+    }
+    try {
+        VariableValue(vector{"a"s, "x"s}).Execute(closure, context);
+        ASSERT(false);
+    } catch (const std::runtime_error&) {
+    }
+}
+
+void TestSingleEvaluation() {
+    // Считает, сколько раз было вычислено выражение
+    class Counted : public Statement {
+    public:
+        Counted(unique_ptr<Statement> arg, int& counter)
+            : arg_(std::move(arg))
+            , counter_(counter) {
+        }
+
+        ObjectHolder Execute(Closure& closure, runtime::Context& context) const override {
+            ++counter_;
+            return arg_->Execute(closure, context);
+        }
+
+    private:
+        unique_ptr<Statement> arg_;
+        int& counter_;
+    };
+
+    runtime::DummyContext context;
+    runtime::Class cls("Box"s, {}, nullptr);
+    Closure closure{{"box"s, ObjectHolder::Own(runtime::ClassInstance{cls})}};
+
+    int stringified = 0;
+    Stringify str(make_unique<Counted>(make_unique<NumericConst>(5), stringified));
+    ASSERT_OBJECT_VALUE_EQUAL(str.Execute(closure, context), "5"s);
+    ASSERT_EQUAL(stringified, 1);
+
+    int assigned = 0;
+    FieldAssignment assign(VariableValue("box"s), "x"s,
+                           make_unique<Counted>(make_unique<NumericConst>(3), assigned));
+    ASSERT_OBJECT_VALUE_EQUAL(assign.Execute(closure, context), 3);
+    ASSERT_EQUAL(assigned, 1);
+
+    int lhs = 0, rhs = 0;
+    Sub sub(make_unique<Counted>(make_unique<NumericConst>(10), lhs),
+            make_unique<Counted>(make_unique<NumericConst>(4), rhs));
+    ASSERT_OBJECT_VALUE_EQUAL(sub.Execute(closure, context), 6);
+    ASSERT_EQUAL(lhs, 1);
+    ASSERT_EQUAL(rhs, 1);
+}
+
 void TestBaseClass() {
     vector<runtime::Method> methods;
     methods.push_back({"GetValue"s, {}, make_unique<VariableValue>(vector{"self"s, "value"s})});
@@ -460,17 +571,21 @@ void RunUnitTests(TestRunner& tr) {
     RUN_TEST(tr, ast::TestStringConst);
     RUN_TEST(tr, ast::TestVariable);
     RUN_TEST(tr, ast::TestAssignment);
+    RUN_TEST(tr, ast::TestNewInstanceCreatesDistinctObjects);
     RUN_TEST(tr, ast::TestFieldAssignment);
     RUN_TEST(tr, ast::TestPrintVariable);
     RUN_TEST(tr, ast::TestPrintMultipleStatements);
     RUN_TEST(tr, ast::TestStringify);
     RUN_TEST(tr, ast::TestNumbersAddition);
     RUN_TEST(tr, ast::TestStringsAddition);
+    RUN_TEST(tr, ast::TestRepeatedStringsAddition);
     RUN_TEST(tr, ast::TestBadAddition);
     RUN_TEST(tr, ast::TestSuccessfulClassInstanceAdd);
     RUN_TEST(tr, ast::TestClassInstanceAddWithoutMethod);
     RUN_TEST(tr, ast::TestCompound);
     RUN_TEST(tr, ast::TestFields);
+    RUN_TEST(tr, ast::TestDeepFieldChain);
+    RUN_TEST(tr, ast::TestSingleEvaluation);
     RUN_TEST(tr, ast::TestBaseClass);
     RUN_TEST(tr, ast::TestInheritance);
     RUN_TEST(tr, ast::TestOr);
@@ -0,0 +1,262 @@
+#include "stats.h"
+
+#include "runtime.h"
+
+#include <algorithm>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+#if MYTHON_STATS
+// Вызовы метода, выполненные потоком
+struct CallCounter {
+    string class_name;
+    string method_name;
+    uint64_t count = 0;
+};
+
+// Статистика потока. Вызовы методов учитываются в таблице, которую читает GetStats,
+// поэтому таблица защищена мьютексом потока
+struct ThreadStats {
+    ThreadStats();
+    ~ThreadStats();
+
+    detail::ThreadCounters counters;
+    mutex calls_mutex;
+    // Вызовы по адресам методов. Адрес удалённого метода может достаться другому методу,
+    // поэтому счётчик хранит имена и при их несовпадении переносится в retired_calls
+    unordered_map<const Method*, CallCounter> calls;
+    map<string, uint64_t> retired_calls;
+};
+
+// Потоки, собирающие статистику, статистика завершившихся потоков
+// и значения счётчиков на момент вызова ResetStats
+struct Registry {
+    mutex m;
+    vector<ThreadStats*> threads;
+    Stats finished;
+    Stats baseline;
+};
+
+// Реестр не удаляется: потоки могут завершаться и после удаления статических объектов
+Registry& GetRegistry() {
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+thread_local ThreadStats thread_stats;
+
+// Объекты ObjectHolder::Own, существующие сейчас, и их наибольшее число с вызова ResetStats
+atomic<int64_t> live_objects{0};
+atomic<int64_t> peak_live_objects{0};
+// Число существующих объектов при последнем вызове ResetStats
+atomic<int64_t> reset_live_objects{0};
+
+string CallName(const string& class_name, const string& method_name) {
+    return class_name + "."s + method_name;
+}
+
+// Добавляет к stats статистику потока thread. Вызывается под мьютексом реестра
+void AddThreadStats(ThreadStats& thread, Stats& stats) {
+    const detail::ThreadCounters& counters = thread.counters;
+    for (size_t i = 0; i < stats.allocations.size(); ++i) {
+        stats.allocations[i] += counters.allocations[i].load(memory_order_relaxed);
+    }
+    stats.closure_lookups += counters.closure_lookups.load(memory_order_relaxed);
+    stats.closure_misses += counters.closure_misses.load(memory_order_relaxed);
+    stats.method_lookups += counters.method_lookups.load(memory_order_relaxed);
+    stats.method_lookup_parent_steps +=
+        counters.method_lookup_parent_steps.load(memory_order_relaxed);
+    stats.exceptions += counters.exceptions.load(memory_order_relaxed);
+
+    lock_guard lock(thread.calls_mutex);
+    for (const auto& [method, counter] : thread.calls) {
+        stats.calls[CallName(counter.class_name, counter.method_name)] += counter.count;
+    }
+    for (const auto& [name, count] : thread.retired_calls) {
+        stats.calls[name] += count;
+    }
+}
+
+// Собирает статистику всех потоков, включая завершившиеся
+Stats CollectStats() {
+    Registry& registry = GetRegistry();
+    Stats stats = registry.finished;
+    for (ThreadStats* thread : registry.threads) {
+        AddThreadStats(*thread, stats);
+    }
+    return stats;
+}
+
+ThreadStats::ThreadStats() {
+    Registry& registry = GetRegistry();
+    lock_guard lock(registry.m);
+    registry.threads.push_back(this);
+}
+
+ThreadStats::~ThreadStats() {
+    Registry& registry = GetRegistry();
+    lock_guard lock(registry.m);
+    AddThreadStats(*this, registry.finished);
+    registry.threads.erase(find(registry.threads.begin(), registry.threads.end(), this));
+}
+#endif
+
+}  // namespace
+
+#if MYTHON_STATS
+namespace detail {
+
+ThreadCounters& GetThreadCounters() {
+    return thread_stats.counters;
+}
+
+void CountObjectCreated() {
+    const int64_t live = live_objects.fetch_add(1, memory_order_relaxed) + 1;
+    int64_t peak = peak_live_objects.load(memory_order_relaxed);
+    while (live > peak && !peak_live_objects.compare_exchange_weak(peak, live, memory_order_relaxed)) {
+    }
+}
+
+void CountObjectDestroyed() {
+    live_objects.fetch_sub(1, memory_order_relaxed);
+}
+
+void CountMethodCall(const Class& cls, const Method& method) {
+    ThreadStats& stats = thread_stats;
+    lock_guard lock(stats.calls_mutex);
+    CallCounter& counter = stats.calls[&method];
+    if (counter.method_name != method.name || counter.class_name != cls.GetName()) {
+        if (counter.count > 0) {
+            stats.retired_calls[CallName(counter.class_name, counter.method_name)] += counter.count;
+        }
+        counter = {cls.GetName(), method.name, 0};
+    }
+    ++counter.count;
+}
+
+}  // namespace detail
+#endif
+
+uint64_t Stats::GetTotalAllocations() const {
+    uint64_t total = 0;
+    for (uint64_t count : allocations) {
+        total += count;
+    }
+    return total;
+}
+
+const char* GetObjectKindName(ObjectKind kind) {
+    switch (kind) {
+        case ObjectKind::NUMBER:
+            return "Number";
+        case ObjectKind::STRING:
+            return "String";
+        case ObjectKind::BOOL:
+            return "Bool";
+        case ObjectKind::CLASS_INSTANCE:
+            return "ClassInstance";
+        case ObjectKind::CLASS:
+            return "Class";
+        case ObjectKind::MODULE:
+            return "Module";
+        case ObjectKind::ACTOR:
+            return "Actor";
+        default:
+            return "Other";
+    }
+}
+
+Stats GetStats() {
+    Stats stats;
+#if MYTHON_STATS
+    Registry& registry = GetRegistry();
+    lock_guard lock(registry.m);
+    stats = CollectStats();
+    const Stats& baseline = registry.baseline;
+    for (size_t i = 0; i < stats.allocations.size(); ++i) {
+        stats.allocations[i] -= baseline.allocations[i];
+    }
+    stats.closure_lookups -= baseline.closure_lookups;
+    stats.closure_misses -= baseline.closure_misses;
+    stats.method_lookups -= baseline.method_lookups;
+    stats.method_lookup_parent_steps -= baseline.method_lookup_parent_steps;
+    stats.exceptions -= baseline.exceptions;
+    for (auto it = stats.calls.begin(); it != stats.calls.end();) {
+        if (auto base = baseline.calls.find(it->first); base != baseline.calls.end()) {
+            it->second -= base->second;
+        }
+        it = it->second == 0 ? stats.calls.erase(it) : next(it);
+    }
+    stats.max_method_lookup_depth = detail::max_method_lookup_depth.load(memory_order_relaxed);
+    stats.peak_live_objects = static_cast<uint64_t>(max<int64_t>(
+        peak_live_objects.load(memory_order_relaxed) - reset_live_objects.load(memory_order_relaxed),
+        0));
+#endif
+    return stats;
+}
+
+void ResetStats() {
+#if MYTHON_STATS
+    // Счётчики потоков изменяют только сами потоки, поэтому запоминаются их текущие значения
+    Registry& registry = GetRegistry();
+    lock_guard lock(registry.m);
+    registry.baseline = CollectStats();
+    detail::max_method_lookup_depth.store(0, memory_order_relaxed);
+    const int64_t live = live_objects.load(memory_order_relaxed);
+    reset_live_objects.store(live, memory_order_relaxed);
+    peak_live_objects.store(live, memory_order_relaxed);
+#endif
+}
+
+void PrintStats(const Stats& stats, ostream& os, size_t top) {
+    if (!Stats::IS_ENABLED) {
+        os << "Statistics are not collected: the interpreter is built without MYTHON_STATS"sv
+           << endl;
+        return;
+    }
+    os << "Objects allocated: "sv << stats.GetTotalAllocations();
+    bool is_first = true;
+    for (size_t i = 0; i < stats.allocations.size(); ++i) {
+        if (stats.allocations[i] == 0) {
+            continue;
+        }
+        os << (is_first ? " ("sv : ", "sv) << GetObjectKindName(static_cast<ObjectKind>(i)) << ' '
+           << stats.allocations[i];
+        is_first = false;
+    }
+    os << (is_first ? ""sv : ")"sv) << '\n';
+    os << "Peak live objects: "sv << stats.peak_live_objects << '\n';
+    os << "Closure lookups: "sv << stats.closure_lookups << ", misses: "sv << stats.closure_misses
+       << '\n';
+    os << "Method lookups: "sv << stats.method_lookups << ", parent classes walked: "sv
+       << stats.method_lookup_parent_steps << ", max depth: "sv << stats.max_method_lookup_depth
+       << '\n';
+    os << "Exceptions thrown: "sv << stats.exceptions << '\n';
+
+    vector<pair<string, uint64_t>> calls(stats.calls.begin(), stats.calls.end());
+    uint64_t total_calls = 0;
+    for (const auto& [name, count] : calls) {
+        total_calls += count;
+    }
+    os << "Method calls: "sv << total_calls << '\n';
+    sort(calls.begin(), calls.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second != rhs.second ? lhs.second > rhs.second : lhs.first < rhs.first;
+    });
+    calls.resize(min(calls.size(), top));
+    for (const auto& [name, count] : calls) {
+        os << "  "sv << name << ": "sv << count << '\n';
+    }
+    os.flush();
+}
+
+}  // namespace runtime
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "memory_pool.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+
+// Статистика выполнения собирается, только если программа собрана с MYTHON_STATS=1.
+// Иначе счётчики не компилируются, а GetStats возвращает нули
+#ifndef MYTHON_STATS
+#define MYTHON_STATS 0
+#endif
+
+namespace runtime {
+
+class Class;
+struct Method;
+
+// Виды объектов, создание которых учитывает статистика
+enum class ObjectKind { NUMBER, STRING, BOOL, CLASS_INSTANCE, CLASS, MODULE, ACTOR, OTHER, COUNT };
+
+// Вид объектов типа T. Уточняется для типов объектов Mython там, где они объявлены
+template <typename T>
+inline constexpr ObjectKind OBJECT_KIND = ObjectKind::OTHER;
+
+// Название вида объектов, например "Number"
+[[nodiscard]] const char* GetObjectKindName(ObjectKind kind);
+
+// Статистика выполнения программ всеми потоками процесса
+struct Stats {
+    static constexpr bool IS_ENABLED = MYTHON_STATS != 0;
+
+    // Объекты, созданные ObjectHolder::Own, по видам
+    std::array<uint64_t, static_cast<size_t>(ObjectKind::COUNT)> allocations{};
+    // Наибольшее число одновременно существующих объектов, созданных ObjectHolder::Own,
+    // сверх тех, что существовали при вызове ResetStats
+    uint64_t peak_live_objects = 0;
+    // Поиски имён в таблицах символов и сколько из них не нашли имени
+    uint64_t closure_lookups = 0;
+    uint64_t closure_misses = 0;
+    // Поиски методов по иерархии классов, сколько всего родительских классов они просмотрели
+    // и наибольшее число просмотренных родительских классов
+    uint64_t method_lookups = 0;
+    uint64_t method_lookup_parent_steps = 0;
+    uint64_t max_method_lookup_depth = 0;
+    // Вызовы методов, включая хвостовые, по именам "Класс.метод", где класс — класс объекта
+    std::map<std::string, uint64_t> calls;
+    // Исключения, выброшенные интерпретатором
+    uint64_t exceptions = 0;
+
+    [[nodiscard]] uint64_t GetTotalAllocations() const;
+};
+
+// Возвращает статистику, собранную с последнего вызова ResetStats
+[[nodiscard]] Stats GetStats();
+// Начинает сбор статистики заново
+void ResetStats();
+// Выводит статистику в os в виде таблицы, вызовы — top самых частых методов
+void PrintStats(const Stats& stats, std::ostream& os, size_t top = 20);
+
+namespace detail {
+
+#if MYTHON_STATS
+// Скалярные счётчики потока. Их изменяет только сам поток, а читает GetStats,
+// поэтому они атомарны, но увеличиваются без блокирующих инструкций
+struct ThreadCounters {
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(ObjectKind::COUNT)> allocations{};
+    std::atomic<uint64_t> closure_lookups{0};
+    std::atomic<uint64_t> closure_misses{0};
+    std::atomic<uint64_t> method_lookups{0};
+    std::atomic<uint64_t> method_lookup_parent_steps{0};
+    std::atomic<uint64_t> exceptions{0};
+};
+
+inline void Increment(std::atomic<uint64_t>& counter, uint64_t value = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// Счётчики текущего потока. Создаются при первом обращении
+ThreadCounters& GetThreadCounters();
+void CountObjectCreated();
+void CountObjectDestroyed();
+void CountMethodCall(const Class& cls, const Method& method);
+// Наибольшее число родительских классов, просмотренных одним поиском метода
+inline std::atomic<uint64_t> max_method_lookup_depth{0};
+
+// Распределитель памяти, который выделяет блоки из пула потока и считает существующие объекты:
+// allocate_shared выделяет один блок на объект и освобождает его при удалении объекта
+template <typename T>
+class CountingAllocator : public PoolAllocator<T> {
+public:
+    CountingAllocator() = default;
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& /*other*/) {  // NOLINT(google-explicit-constructor)
+    }
+
+    T* allocate(size_t n) {
+        T* block = PoolAllocator<T>::allocate(n);
+        CountObjectCreated();
+        return block;
+    }
+
+    void deallocate(T* p, size_t n) {
+        CountObjectDestroyed();
+        PoolAllocator<T>::deallocate(p, n);
+    }
+};
+#endif
+
+// Учитывает создание объекта типа T
+template <typename T>
+inline void CountAllocation() {
+#if MYTHON_STATS
+    Increment(GetThreadCounters().allocations[static_cast<size_t>(OBJECT_KIND<T>)]);
+#endif
+}
+
+// Учитывает поиск имени в таблице символов
+inline void CountClosureLookup([[maybe_unused]] bool is_found) {
+#if MYTHON_STATS
+    ThreadCounters& counters = GetThreadCounters();
+    Increment(counters.closure_lookups);
+    if (!is_found) {
+        Increment(counters.closure_misses);
+    }
+#endif
+}
+
+// Учитывает поиск метода, просмотревший parent_steps родительских классов
+inline void CountMethodLookup([[maybe_unused]] size_t parent_steps) {
+#if MYTHON_STATS
+    ThreadCounters& counters = GetThreadCounters();
+    Increment(counters.method_lookups);
+    Increment(counters.method_lookup_parent_steps, parent_steps);
+    uint64_t max_depth = max_method_lookup_depth.load(std::memory_order_relaxed);
+    while (parent_steps > max_depth
+           && !max_method_lookup_depth.compare_exchange_weak(max_depth, parent_steps,
+                                                             std::memory_order_relaxed)) {
+    }
+#endif
+}
+
+// Учитывает выброшенное исключение
+inline void CountException() {
+#if MYTHON_STATS
+    Increment(GetThreadCounters().exceptions);
+#endif
+}
+
+}  // namespace detail
+
+// Учитывает вызов метода method класса cls
+inline void CountMethodCall([[maybe_unused]] const Class& cls,
+                            [[maybe_unused]] const Method& method) {
+#if MYTHON_STATS
+    detail::CountMethodCall(cls, method);
+#endif
+}
+
+// Выбрасывает исключение error, учитывая его в статистике
+template <typename Exception>
+[[noreturn]] void Throw(Exception error) {
+    detail::CountException();
+    throw error;
+}
+
+// Распределитель памяти для объектов ObjectHolder::Own
+#if MYTHON_STATS
+template <typename T>
+using ObjectAllocator = detail::CountingAllocator<T>;
+#else
+template <typename T>
+using ObjectAllocator = PoolAllocator<T>;
+#endif
+
+}  // namespace runtime
@@ -0,0 +1,95 @@
+#include "stats.h"
+
+#include "statement.h"
+#include "test_program_p.h"
+#include "test_runner_p.h"
+
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+const string HIERARCHY = R"--(
+class A:
+  def f():
+    return 1
+
+class B(A):
+  def g(n):
+    if n == 0:
+      return self.f()
+    return self.g(n - 1)
+
+b = B()
+print b.g(3)
+)--"s;
+
+void TestStatsOfProgram() {
+    ResetStats();
+    ostringstream output;
+    RunProgram(HIERARCHY, output);
+    ASSERT_EQUAL(output.str(), "1\n"s);
+    const Stats stats = GetStats();
+    if (!Stats::IS_ENABLED) {
+        ASSERT_EQUAL(stats.GetTotalAllocations(), 0U);
+        ASSERT(stats.calls.empty());
+        return;
+    }
+
+    ASSERT_EQUAL(stats.allocations[static_cast<size_t>(ObjectKind::CLASS_INSTANCE)], 1U);
+    ASSERT_EQUAL(stats.allocations[static_cast<size_t>(ObjectKind::CLASS)], 2U);
+    ASSERT(stats.peak_live_objects >= 3);
+    // Объекты, существовавшие до ResetStats, не учитываются
+    ASSERT(stats.peak_live_objects <= stats.GetTotalAllocations());
+    // Хвостовые вызовы тоже учитываются. Унаследованный метод учитывается под классом объекта
+    ASSERT_EQUAL(stats.calls, (map<string, uint64_t>{{"B.f"s, 1}, {"B.g"s, 4}}));
+    ASSERT(stats.method_lookups >= 5);
+    ASSERT_EQUAL(stats.max_method_lookup_depth, 1U);
+    ASSERT(stats.closure_lookups > 0);
+    ASSERT_EQUAL(stats.closure_misses, 0U);
+    ASSERT_EQUAL(stats.exceptions, 0U);
+
+    ostringstream report;
+    PrintStats(stats, report);
+    ASSERT(report.str().find("ClassInstance 1"s) != string::npos);
+    ASSERT(report.str().find("  B.g: 4\n  B.f: 1\n"s) != string::npos);
+}
+
+void TestStatsOfFailuresAndThreads() {
+    ResetStats();
+    ostringstream output;
+    ASSERT_THROWS(RunProgram("print missing\n"s, output), runtime_error);
+    // Статистика завершившегося потока сохраняется
+    thread worker([] {
+        ostringstream output;
+        RunProgram(HIERARCHY, output);
+    });
+    worker.join();
+    const Stats stats = GetStats();
+    if (!Stats::IS_ENABLED) {
+        ASSERT_EQUAL(stats.exceptions, 0U);
+        return;
+    }
+    ASSERT_EQUAL(stats.closure_misses, 1U);
+    ASSERT_EQUAL(stats.exceptions, 1U);
+    ASSERT_EQUAL(stats.calls.at("B.g"s), 4U);
+
+    // После сброса учитывается только новая работа
+    ResetStats();
+    RunProgram("x = 1\n"s, output);
+    ASSERT(GetStats().calls.empty());
+    ASSERT_EQUAL(GetStats().exceptions, 0U);
+}
+
+}  // namespace
+
+void RunStatsTests(TestRunner& tr) {
+    RUN_TEST(tr, TestStatsOfProgram);
+    RUN_TEST(tr, TestStatsOfFailuresAndThreads);
+}
+
+}  // namespace runtime
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "lexer.h"
+#include "parse.h"
+#include "runtime.h"
+
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+// Разбирает программу из строки program
+inline std::unique_ptr<runtime::Executable> ParseProgramFromString(const std::string& program,
+                                                                   const ParseOptions& options = {}) {
+    std::istringstream input(program);
+    parse::Lexer lexer(input);
+    return ParseProgram(lexer, options);
+}
+
+// Выполняет программу из строки program с новой таблицей символов, выводя в output
+inline void RunProgram(const std::string& program, std::ostream& output) {
+    auto tree = ParseProgramFromString(program);
+    runtime::SimpleContext context{output};
+    runtime::Closure closure;
+    tree->Execute(closure, context);
+}
@@ -0,0 +1,118 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+// Пул, которому принадлежит текущий поток, и номер очереди потока в нём
+thread_local const WorkStealingPool* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(size_t thread_count) {
+    thread_count = max<size_t>(thread_count, 1);
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues_.push_back(make_unique<Queue>());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads_.emplace_back([this, i] {
+            WorkerLoop(i);
+        });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    Wait();
+    {
+        lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    has_work_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::Submit(Task task) {
+    const size_t index = current_pool == this ? current_queue
+                                               : next_queue_.fetch_add(1) % queues_.size();
+    // Счётчики увеличиваются раньше, чем задача становится видна потокам,
+    // иначе выполнивший её поток мог бы уменьшить их первым
+    {
+        lock_guard lock(mutex_);
+        ++queued_;
+        ++unfinished_;
+    }
+    {
+        lock_guard lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    has_work_.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+    unique_lock lock(mutex_);
+    all_done_.wait(lock, [this] {
+        return unfinished_ == 0;
+    });
+}
+
+size_t WorkStealingPool::GetThreadCount() const {
+    return threads_.size();
+}
+
+size_t WorkStealingPool::GetStolenCount() const {
+    return stolen_;
+}
+
+bool WorkStealingPool::TryTake(size_t index, Task& task) {
+    {
+        Queue& own = *queues_[index];
+        lock_guard lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t offset = 1; offset < queues_.size(); ++offset) {
+        Queue& victim = *queues_[(index + offset) % queues_.size()];
+        lock_guard lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            ++stolen_;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::WorkerLoop(size_t index) {
+    current_pool = this;
+    current_queue = index;
+    Task task;
+    while (true) {
+        if (TryTake(index, task)) {
+            {
+                lock_guard lock(mutex_);
+                --queued_;
+            }
+            task();
+            task = nullptr;
+            lock_guard lock(mutex_);
+            if (--unfinished_ == 0) {
+                all_done_.notify_all();
+            }
+            continue;
+        }
+        unique_lock lock(mutex_);
+        has_work_.wait(lock, [this] {
+            return stopping_ || queued_ > 0;
+        });
+        if (stopping_ && queued_ == 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Пул потоков с перехватом задач (work stealing).
+
+У каждого потока пула своя очередь задач. Поток берёт задачи с конца своей очереди,
+а когда она пустеет, перехватывает задачи из начала очередей других потоков. Задачи,
+добавленные извне пула, раскладываются по очередям по кругу, а задачи, добавленные
+из потока пула, попадают в его собственную очередь. Поэтому неравномерные по длительности
+задачи не простаивают в очереди занятого потока, пока другие потоки свободны.
+
+Задача не должна выбрасывать исключений: результат и ошибки она передаёт сама
+*/
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    // Создаёт пул из thread_count потоков (не меньше одного)
+    explicit WorkStealingPool(size_t thread_count);
+    // Дожидается выполнения всех задач и останавливает потоки
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Добавляет задачу в пул
+    void Submit(Task task);
+
+    // Ожидает, пока не будут выполнены все добавленные задачи.
+    // Вызывается из потока, не принадлежащего пулу
+    void Wait();
+
+    [[nodiscard]] size_t GetThreadCount() const;
+
+    // Возвращает, сколько задач было перехвачено из чужих очередей
+    [[nodiscard]] size_t GetStolenCount() const;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void WorkerLoop(size_t index);
+    // Извлекает задачу из своей очереди index либо перехватывает её из чужой
+    bool TryTake(size_t index, Task& task);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_queue_{0};
+    std::atomic<size_t> stolen_{0};
+
+    std::mutex mutex_;
+    std::condition_variable has_work_;
+    std::condition_variable all_done_;
+    // Задачи, ещё не извлечённые из очередей
+    size_t queued_ = 0;
+    // Задачи, ещё не выполненные до конца
+    size_t unfinished_ = 0;
+    bool stopping_ = false;
+};
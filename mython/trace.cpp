@@ -0,0 +1,236 @@
+#include "trace.h"
+
+#include "call_stack.h"
+#include "runtime.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+using namespace std;
+
+namespace runtime {
+
+namespace detail {
+
+// Отрезки, записанные одним потоком. Имена вызовов определяются при остановке записи
+struct TraceBuffer {
+    struct RawEvent {
+        // Имя этапа либо nullptr для вызова метода
+        const char* phase;
+        const Class* cls;
+        const Method* method;
+        size_t arg_count;
+        chrono::steady_clock::time_point start;
+        chrono::steady_clock::time_point end;
+        bool is_finished;
+    };
+
+    TraceBuffer(uint64_t generation, uint32_t thread)
+        : generation(generation)
+        , thread(thread) {
+    }
+
+    // Добавляет начатый отрезок и возвращает его номер
+    size_t Begin(const char* phase, const Class* cls, const Method* method, size_t arg_count) {
+        const auto start = chrono::steady_clock::now();
+        lock_guard lock(m);
+        events.push_back({phase, cls, method, arg_count, start, start, false});
+        return events.size() - 1;
+    }
+
+    // Заканчивает отрезок. Отрезок, законченный после остановки записи, уже не учитывается
+    void End(size_t index) {
+        const auto end = chrono::steady_clock::now();
+        lock_guard lock(m);
+        if (index < events.size()) {
+            events[index].end = end;
+            events[index].is_finished = true;
+        }
+    }
+
+    const uint64_t generation;
+    const uint32_t thread;
+    // Сколько вызовов методов встретил поток. Изменяется только им
+    size_t call_count = 0;
+
+    mutex m;
+    vector<RawEvent> events;
+};
+
+}  // namespace detail
+
+namespace {
+
+// Число потоков, начинающих отрезок. Stop дожидается, пока они добавят отрезки в буферы
+atomic<int> beginning_spans{0};
+atomic<uint64_t> last_generation{0};
+
+// Буфер, в который поток записывал отрезки последней трассы
+thread_local shared_ptr<detail::TraceBuffer> thread_buffer;
+
+// Начинает отрезок в трассе, которая записывается сейчас. Возвращает буфер, в который
+// записан отрезок, либо nullptr, если трасса не записывается или вызов не нужно записывать
+template <typename Fn>
+shared_ptr<detail::TraceBuffer> BeginSpan(Fn begin) {
+    beginning_spans.fetch_add(1);
+    shared_ptr<detail::TraceBuffer> buffer;
+    if (TraceRecorder* recorder = detail::active_trace.load()) {
+        buffer = begin(*recorder);
+    }
+    beginning_spans.fetch_sub(1);
+    return buffer;
+}
+
+void WriteJsonString(ostream& out, const string& value) {
+    out << '"';
+    for (const char c : value) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u"sv << hex << setw(4) << setfill('0') << static_cast<int>(c) << dec
+                << setfill(' ');
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+double ToMicroseconds(chrono::nanoseconds duration) {
+    return static_cast<double>(duration.count()) / 1000.0;
+}
+
+}  // namespace
+
+TraceRecorder::TraceRecorder(TraceOptions options)
+    : options_(options) {
+    options_.call_sample_rate = max<size_t>(options_.call_sample_rate, 1);
+}
+
+TraceRecorder::~TraceRecorder() {
+    Stop();
+}
+
+void TraceRecorder::Start() {
+    if (is_running_) {
+        return;
+    }
+    generation_ = ++last_generation;
+    origin_ = chrono::steady_clock::now();
+    TraceRecorder* expected = nullptr;
+    if (!detail::active_trace.compare_exchange_strong(expected, this)) {
+        throw logic_error("Another trace is already being recorded"s);
+    }
+    is_running_ = true;
+}
+
+void TraceRecorder::Stop() {
+    if (!is_running_) {
+        return;
+    }
+    is_running_ = false;
+    detail::active_trace = nullptr;
+    while (beginning_spans.load() != 0) {
+        this_thread::yield();
+    }
+
+    // Отрезки, не законченные к остановке, заканчиваются в момент остановки
+    const auto stop = chrono::steady_clock::now();
+    lock_guard buffers_lock(buffers_mutex_);
+    for (const auto& buffer : buffers_) {
+        lock_guard lock(buffer->m);
+        for (const auto& raw : buffer->events) {
+            Event event;
+            event.is_call = raw.phase == nullptr;
+            event.name = event.is_call ? raw.cls->GetName() + "."s + raw.method->name
+                                       : string(raw.phase);
+            event.arg_count = raw.arg_count;
+            event.thread = buffer->thread;
+            event.start = raw.start - origin_;
+            event.duration = (raw.is_finished ? raw.end : stop) - raw.start;
+            events_.push_back(move(event));
+        }
+        buffer->events.clear();
+    }
+    buffers_.clear();
+    // Вложенные отрезки следуют за объемлющими
+    stable_sort(events_.begin(), events_.end(), [](const Event& lhs, const Event& rhs) {
+        return lhs.thread != rhs.thread ? lhs.thread < rhs.thread : lhs.start < rhs.start;
+    });
+}
+
+size_t TraceRecorder::GetEventCount() const {
+    return events_.size();
+}
+
+void TraceRecorder::WriteJson(ostream& out) const {
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << fixed << setprecision(3);
+    out << "{\"traceEvents\":["sv;
+    bool is_first = true;
+    for (const Event& event : events_) {
+        out << (is_first ? "\n"sv : ",\n"sv) << "{\"name\":"sv;
+        WriteJsonString(out, event.name);
+        out << ",\"cat\":\""sv << (event.is_call ? "call"sv : "phase"sv)
+            << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"sv << event.thread << ",\"ts\":"sv
+            << ToMicroseconds(event.start) << ",\"dur\":"sv << ToMicroseconds(event.duration);
+        if (event.is_call) {
+            out << ",\"args\":{\"arg_count\":"sv << event.arg_count << '}';
+        }
+        out << '}';
+        is_first = false;
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n"sv;
+    out.flags(flags);
+    out.precision(precision);
+}
+
+shared_ptr<detail::TraceBuffer> TraceRecorder::GetThreadBuffer() {
+    if (!thread_buffer || thread_buffer->generation != generation_) {
+        lock_guard lock(buffers_mutex_);
+        thread_buffer = make_shared<detail::TraceBuffer>(
+            generation_, static_cast<uint32_t>(buffers_.size() + 1));
+        buffers_.push_back(thread_buffer);
+    }
+    return thread_buffer;
+}
+
+TraceSpan::TraceSpan(const char* name) {
+    buffer_ = BeginSpan([&](TraceRecorder& recorder) {
+        auto buffer = recorder.GetThreadBuffer();
+        index_ = buffer->Begin(name, nullptr, nullptr, 0);
+        return buffer;
+    });
+}
+
+TraceSpan::~TraceSpan() {
+    if (buffer_) {
+        buffer_->End(index_);
+    }
+}
+
+void CallTraceSpan::Begin(const Class& cls, const Method& method, size_t arg_count) {
+    buffer_ = BeginSpan([&](TraceRecorder& recorder) -> shared_ptr<detail::TraceBuffer> {
+        if (detail::GetCallDepth() > recorder.options_.max_call_depth) {
+            return nullptr;
+        }
+        auto buffer = recorder.GetThreadBuffer();
+        if (buffer->call_count++ % recorder.options_.call_sample_rate != 0) {
+            return nullptr;
+        }
+        index_ = buffer->Begin(nullptr, &cls, &method, arg_count);
+        return buffer;
+    });
+}
+
+void CallTraceSpan::End() {
+    buffer_->End(index_);
+}
+
+}  // namespace runtime
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace runtime {
+
+class Class;
+struct Method;
+
+// Настройки записи трассы
+struct TraceOptions {
+    // Записывается каждый call_sample_rate-й вызов метода каждого потока
+    size_t call_sample_rate = 1;
+    // Вызовы на глубине больше max_call_depth не записываются
+    size_t max_call_depth = 64;
+};
+
+class TraceRecorder;
+
+namespace detail {
+struct TraceBuffer;
+
+// Трасса, которая записывается сейчас
+inline std::atomic<TraceRecorder*> active_trace{nullptr};
+}  // namespace detail
+
+/*
+Записывает трассу выполнения в формате Trace Event, который открывают chrome://tracing и Perfetto:
+отрезки этапов работы интерпретатора (TraceSpan) и вызовов методов Mython (CallTraceSpan).
+
+Каждый поток записывает отрезки в собственный буфер, поэтому потоки не ждут друг друга.
+Имена классов и методов определяются в Stop, поэтому программа, вызовы которой записываются,
+должна существовать до вызова Stop. Одновременно может записываться только одна трасса.
+Отрезки зелёных потоков, выполняемых одним потоком ОС, попадают на одну дорожку трассы
+*/
+class TraceRecorder {
+public:
+    explicit TraceRecorder(TraceOptions options = {});
+    // Прекращает запись, если она идёт
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // Начинает запись. Если уже записывается другая трасса, выбрасывает logic_error
+    void Start();
+    // Прекращает запись и определяет имена записанных вызовов
+    void Stop();
+
+    // Число записанных отрезков. Доступно после Stop
+    [[nodiscard]] size_t GetEventCount() const;
+    // Выводит трассу в формате JSON. Доступно после Stop
+    void WriteJson(std::ostream& out) const;
+
+private:
+    friend class TraceSpan;
+    friend class CallTraceSpan;
+
+    // Отрезок, записанный потоком
+    struct Event {
+        std::string name;
+        // true для вызова метода, false для этапа работы интерпретатора
+        bool is_call;
+        size_t arg_count;
+        uint32_t thread;
+        std::chrono::nanoseconds start;
+        std::chrono::nanoseconds duration;
+    };
+
+    // Возвращает буфер текущего потока, создавая его при первом обращении
+    std::shared_ptr<detail::TraceBuffer> GetThreadBuffer();
+
+    TraceOptions options_;
+    std::chrono::steady_clock::time_point origin_;
+    bool is_running_ = false;
+    // Номер записи: по нему потоки узнают, что их буфер принадлежит прежней записи
+    uint64_t generation_ = 0;
+
+    std::mutex buffers_mutex_;
+    // Буферы потоков. Отрезок, начатый до Stop, может закончиться и после удаления записи,
+    // поэтому буфером совместно владеют запись и незаконченные отрезки
+    std::vector<std::shared_ptr<detail::TraceBuffer>> buffers_;
+    std::vector<Event> events_;
+};
+
+// Записывает этап работы интерпретатора, например разбор программы, на время своего существования
+class TraceSpan {
+public:
+    // Имя должно существовать до вызова TraceRecorder::Stop
+    explicit TraceSpan(const char* name);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    std::shared_ptr<detail::TraceBuffer> buffer_;
+    size_t index_ = 0;
+};
+
+// Записывает вызов метода method класса cls с arg_count параметрами на время своего существования.
+// Если трасса не записывается, стоит одного чтения атомарной переменной
+class CallTraceSpan {
+public:
+    CallTraceSpan(const Class& cls, const Method& method, size_t arg_count) {
+        if (detail::active_trace.load(std::memory_order_relaxed) != nullptr) {
+            Begin(cls, method, arg_count);
+        }
+    }
+
+    ~CallTraceSpan() {
+        if (buffer_) {
+            End();
+        }
+    }
+
+    CallTraceSpan(const CallTraceSpan&) = delete;
+    CallTraceSpan& operator=(const CallTraceSpan&) = delete;
+
+private:
+    void Begin(const Class& cls, const Method& method, size_t arg_count);
+    void End();
+
+    std::shared_ptr<detail::TraceBuffer> buffer_;
+    size_t index_ = 0;
+};
+
+}  // namespace runtime
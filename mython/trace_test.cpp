@@ -0,0 +1,99 @@
+#include "trace.h"
+
+#include "statement.h"
+#include "test_program_p.h"
+#include "test_runner_p.h"
+
+#include <sstream>
+
+using namespace std;
+
+namespace runtime {
+
+namespace {
+
+const string COUNTDOWN = R"--(
+class Counter:
+  def down(n):
+    if n == 0:
+      return 0
+    return 1 + self.down(n - 1)
+
+c = Counter()
+print c.down(5)
+)--"s;
+
+// Записывает трассу программы с настройками options и возвращает её в формате JSON
+string TraceProgram(const string& program, TraceOptions options, size_t& event_count) {
+    TraceRecorder recorder(options);
+    recorder.Start();
+    {
+        TraceSpan span("run");
+        auto tree = ParseProgramFromString(program);
+        ostringstream output;
+        SimpleContext context{output};
+        Closure closure;
+        tree->Execute(closure, context);
+        ASSERT_EQUAL(output.str(), "5\n"s);
+        // Имена вызовов определяются, пока дерево программы существует
+        recorder.Stop();
+    }
+    event_count = recorder.GetEventCount();
+    ostringstream json;
+    recorder.WriteJson(json);
+    return json.str();
+}
+
+size_t CountOf(const string& text, const string& pattern) {
+    size_t count = 0;
+    for (size_t pos = text.find(pattern); pos != string::npos; pos = text.find(pattern, pos + 1)) {
+        ++count;
+    }
+    return count;
+}
+
+void TestTraceOfCalls() {
+    size_t event_count = 0;
+    const string json = TraceProgram(COUNTDOWN, {}, event_count);
+    // Отрезок run, законченный после остановки записи, заканчивается в момент остановки
+    ASSERT_EQUAL(event_count, 7U);
+    ASSERT(json.rfind("{\"traceEvents\":[\n"s, 0) == 0);
+    ASSERT(json.find("{\"name\":\"run\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"s)
+           != string::npos);
+    ASSERT_EQUAL(CountOf(json, "\"name\":\"Counter.down\",\"cat\":\"call\""s), 6U);
+    ASSERT_EQUAL(CountOf(json, "\"args\":{\"arg_count\":1}"s), 6U);
+    ASSERT(json.find("],\"displayTimeUnit\":\"ms\"}\n"s) != string::npos);
+}
+
+void TestTraceLimits() {
+    size_t event_count = 0;
+    TraceOptions options;
+    options.max_call_depth = 2;
+    TraceProgram(COUNTDOWN, options, event_count);
+    ASSERT_EQUAL(event_count, 3U);
+
+    options = {};
+    options.call_sample_rate = 2;
+    const string json = TraceProgram(COUNTDOWN, options, event_count);
+    ASSERT_EQUAL(CountOf(json, "\"cat\":\"call\""s), 3U);
+
+    // Вне записи отрезки не записываются, а одновременно может записываться одна трасса
+    { TraceSpan idle("idle"); }
+    TraceRecorder first;
+    TraceRecorder second;
+    first.Start();
+    ASSERT_THROWS(second.Start(), logic_error);
+    first.Stop();
+    second.Start();
+    second.Stop();
+    ASSERT_EQUAL(first.GetEventCount(), 0U);
+}
+
+}  // namespace
+
+void RunTraceTests(TestRunner& tr) {
+    RUN_TEST(tr, TestTraceOfCalls);
+    RUN_TEST(tr, TestTraceLimits);
+}
+
+}  // namespace runtime